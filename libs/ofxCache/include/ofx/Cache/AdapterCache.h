@@ -0,0 +1,245 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <functional>
+#include "ofx/Cache/BaseCache.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A cache node that translates between cache layers with different
+/// key or value types.
+///
+/// An AdapterCache stores nothing itself. Gets are forwarded to the child
+/// with a mapped key and the child value is decoded for the parent, which
+/// then caches the decoded value, e.g.
+///
+///     LRUMemoryCache<std::string, ofPixels> memory;
+///     memory.setChild<AdapterCache<std::string, ofPixels, std::string, ofBuffer>>(
+///         nullptr,
+///         [](const std::string& key, const ofBuffer& buffer) {
+///             auto pixels = std::make_shared<ofPixels>();
+///             return ofLoadImage(*pixels, buffer) ? pixels : nullptr;
+///         })->setChild<MyDiskCache>();
+///
+/// Each value is decoded once when it is promoted into the parent. If an
+/// encoder is given, values written to the adapter are encoded and written
+/// through to the child.
+///
+/// \tparam KeyType The key type seen by the parent.
+/// \tparam ValueType The value type seen by the parent.
+/// \tparam ChildKeyType The key type of the child.
+/// \tparam ChildValueType The value type of the child.
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+class AdapterCache: public BaseCache<KeyType, ValueType, ChildKeyType, ChildValueType>
+{
+public:
+    /// \brief Maps a parent key to a child key.
+    typedef std::function<ChildKeyType(const KeyType&)> KeyMapper;
+
+    /// \brief Decodes a child value, returning nullptr on failure.
+    typedef std::function<std::shared_ptr<ValueType>(const KeyType&, const ChildValueType&)> Decoder;
+
+    /// \brief Encodes a parent value, returning nullptr on failure.
+    typedef std::function<std::shared_ptr<ChildValueType>(const KeyType&, const ValueType&)> Encoder;
+
+    /// \brief Create an AdapterCache.
+    /// \param keyMapper The key mapping, or nullptr to convert keys
+    /// implicitly.
+    /// \param decoder The child value decoder.
+    /// \param encoder The parent value encoder, or nullptr for a read-only
+    /// adapter.
+    /// \throws Poco::InvalidArgumentException if keyMapper is empty and keys
+    /// don't convert implicitly.
+    AdapterCache(KeyMapper keyMapper, Decoder decoder, Encoder encoder = nullptr);
+
+    /// \brief Create an AdapterCache that converts keys implicitly.
+    ///
+    /// Only compiles if KeyType converts to ChildKeyType.
+    ///
+    /// \param decoder The child value decoder.
+    /// \param encoder The parent value encoder, or nullptr for a read-only
+    /// adapter.
+    AdapterCache(std::nullptr_t, Decoder decoder, Encoder encoder = nullptr);
+
+    /// \brief Destroy the AdapterCache.
+    virtual ~AdapterCache();
+
+protected:
+    bool doHas(const KeyType& key) const override;
+    std::shared_ptr<ValueType> doGet(const KeyType& key) override;
+    void doAdd(const KeyType& key, std::shared_ptr<ValueType> entry) override;
+    void doRemove(const KeyType& key) override;
+    std::size_t doSize() override;
+    void doClear() override;
+
+    ChildKeyType toChildKey(const KeyType& key) const override;
+
+    std::shared_ptr<ValueType> fromChildValue(const KeyType& key,
+                                              std::shared_ptr<ChildValueType> value) const override;
+
+    std::shared_ptr<ChildValueType> toChildValue(const KeyType& key,
+                                                 std::shared_ptr<ValueType> value) const override;
+
+private:
+    static KeyMapper implicitKeyMapper(std::true_type);
+    static KeyMapper implicitKeyMapper(std::false_type);
+
+    KeyMapper _keyMapper;
+    Decoder _decoder;
+    Encoder _encoder;
+
+};
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::AdapterCache(KeyMapper keyMapper,
+                                                                             Decoder decoder,
+                                                                             Encoder encoder):
+    _keyMapper(keyMapper != nullptr ? keyMapper : implicitKeyMapper(std::is_convertible<KeyType, ChildKeyType>())),
+    _decoder(decoder),
+    _encoder(encoder)
+{
+    if (_keyMapper == nullptr)
+    {
+        throw Poco::InvalidArgumentException("AdapterCache: Keys don't convert, a key mapper is required.");
+    }
+
+    // Nothing is stored here, so promoting would only fire events.
+    this->setPromotionPolicy(std::make_shared<NeverPromotionPolicy<KeyType>>());
+
+    if (_encoder != nullptr)
+    {
+        this->setWritePolicy(WritePolicy::WRITE_THROUGH);
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::AdapterCache(std::nullptr_t,
+                                                                             Decoder decoder,
+                                                                             Encoder encoder):
+    AdapterCache(implicitKeyMapper(std::is_convertible<KeyType, ChildKeyType>()), decoder, encoder)
+{
+    static_assert(std::is_convertible<KeyType, ChildKeyType>::value,
+                  "AdapterCache: Keys don't convert, a key mapper is required.");
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::~AdapterCache()
+{
+    // Queued writes are converted with the decoder and encoder.
+    this->stopWriteBehind();
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+bool AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doHas(const KeyType&) const
+{
+    return false;
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+std::shared_ptr<ValueType> AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doGet(const KeyType&)
+{
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+void AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doAdd(const KeyType&, std::shared_ptr<ValueType>)
+{
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+void AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doRemove(const KeyType&)
+{
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+std::size_t AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doSize()
+{
+    return 0;
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+void AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::doClear()
+{
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+ChildKeyType AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::toChildKey(const KeyType& key) const
+{
+    return _keyMapper(key);
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+std::shared_ptr<ValueType> AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::fromChildValue(const KeyType& key,
+                                                                                                          std::shared_ptr<ChildValueType> value) const
+{
+    try
+    {
+        return _decoder(key, *value);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("AdapterCache::fromChildValue") << "Unable to decode value: " << exc.what();
+    }
+
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+std::shared_ptr<ChildValueType> AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::toChildValue(const KeyType& key,
+                                                                                                             std::shared_ptr<ValueType> value) const
+{
+    if (_encoder == nullptr || value == nullptr)
+    {
+        return nullptr;
+    }
+
+    try
+    {
+        return _encoder(key, *value);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("AdapterCache::toChildValue") << "Unable to encode value: " << exc.what();
+    }
+
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+typename AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::KeyMapper AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::implicitKeyMapper(std::true_type)
+{
+    return [](const KeyType& key) -> ChildKeyType { return key; };
+}
+
+
+template<typename KeyType, typename ValueType, typename ChildKeyType, typename ChildValueType>
+typename AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::KeyMapper AdapterCache<KeyType, ValueType, ChildKeyType, ChildValueType>::implicitKeyMapper(std::false_type)
+{
+    return nullptr;
+}
+
+
+} } // namespace ofx::Cache
@@ -8,7 +8,14 @@
 #pragma once
 
 
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include "Poco/Exception.h"
 #include "ofx/Cache/BaseCache.h"
+#include "ofx/Cache/Coroutine.h"
+#include "ofx/Cache/ReadAheadPolicy.h"
 
 
 namespace ofx {
@@ -32,6 +39,26 @@ enum class RequestState
 };
 
 
+/// \brief The priority of a request.
+///
+/// Higher priority requests are started before lower priority requests.
+/// Priorities only order requests that wait for a free slot, so they have no
+/// effect unless the cache limits the number of requests running at once,
+/// e.g. with BaseResourceCache::setMaximumInFlightRequests(). Without a limit
+/// every request is handed to the task queue immediately.
+enum class RequestPriority
+{
+    /// \brief The request should only run when nothing else is waiting.
+    IDLE,
+    /// \brief A low priority request.
+    LOW,
+    /// \brief A normal priority request.
+    NORMAL,
+    /// \brief A high priority request.
+    HIGH
+};
+
+
 template<typename KeyType>
 class RequestFailedArgs
 {
@@ -113,29 +140,239 @@ public:
     typedef RequestCompleteArgs<KeyType, ValueType> _RequestCompleteArgs;
     typedef RequestFailedArgs<KeyType> _RequestFailedArgs;
 
+    /// \brief A callback invoked when a single request completes.
+    typedef std::function<void(const RequestCompleteArgs<KeyType, ValueType>&)> RequestCompleteCallback;
+
+    /// \brief A callback invoked when a single request fails or is cancelled.
+    typedef std::function<void(const RequestFailedArgs<KeyType>&)> RequestFailedCallback;
+
+    /// \brief A future that resolves to the requested value.
+    ///
+    /// If the request fails or is cancelled, the future will hold a
+    /// Poco::IOException describing the error.
+    typedef std::shared_future<std::shared_ptr<ValueType>> RequestFuture;
+
     /// \brief Destroy the BaseCache.
     virtual ~BaseAsyncCache()
     {
+        this->stopWriteBehind();
     }
 
     /// \brief Request a value by its key.
     ///
-    /// The value will be returned via the onRequested event.
+    /// The value will be returned via the returned future and the
+    /// onRequestComplete event. Multiple requests for the same key share a
+    /// single future.
+    ///
+    /// If the cache limits the number of queued requests, this call may block
+    /// or the request may be rejected, depending on the cache's overflow
+    /// policy. Rejected requests fail with an error.
     ///
     /// \param key The key to request.
-    void request(const KeyType& key)
+    /// \param priority The priority of the request.
+    /// \returns a future that resolves when the request is finished.
+    RequestFuture request(const KeyType& key,
+                          RequestPriority priority = RequestPriority::NORMAL)
     {
-        auto result = this->get(key);
+        return request(key, nullptr, nullptr, priority);
+    }
 
-        if (result != nullptr)
+    /// \brief Request a value by its key and deliver the result to a callback.
+    ///
+    /// The callbacks are only called for this request, so callers do not need
+    /// to listen to and filter the shared onRequestComplete event. Callbacks
+    /// are invoked on the thread that processes the cache's completions
+    /// (usually the main thread), or immediately if the value is cached.
+    ///
+    /// \param key The key to request.
+    /// \param onComplete The callback to invoke with the value.
+    /// \param onFailed The callback to invoke on failure or cancellation.
+    /// \param priority The priority of the request.
+    /// \returns a future that resolves when the request is finished.
+    RequestFuture request(const KeyType& key,
+                          RequestCompleteCallback onComplete,
+                          RequestFailedCallback onFailed = nullptr,
+                          RequestPriority priority = RequestPriority::NORMAL)
+    {
+        RequestFuture future;
+
+        if (!startRequest(key, onComplete, onFailed, priority, true, future))
         {
-            RequestCompleteArgs<KeyType, ValueType> args(key, result, CacheStatus::CACHE_HIT);
-            onRequestComplete.notify(this, args);
+            failRequest(key, "Request rejected.");
         }
-        else
+
+        return future;
+    }
+
+    /// \brief Request a value by its key without blocking.
+    ///
+    /// If the cache cannot accept another request, the request is rejected
+    /// instead of waiting for space, regardless of the overflow policy. A
+    /// rejected request calls onFailed but does not fire onRequestFailed.
+    ///
+    /// \param key The key to request.
+    /// \param onComplete The callback to invoke with the value.
+    /// \param onFailed The callback to invoke on failure or cancellation.
+    /// \param priority The priority of the request.
+    /// \returns true if the request was accepted or the value was cached.
+    bool tryRequest(const KeyType& key,
+                    RequestCompleteCallback onComplete = nullptr,
+                    RequestFailedCallback onFailed = nullptr,
+                    RequestPriority priority = RequestPriority::NORMAL)
+    {
+        RequestFuture future;
+
+        if (!startRequest(key, onComplete, onFailed, priority, false, future))
         {
-            doRequest(key);
+            discardPendingRequest(RequestFailedArgs<KeyType>(key, "Request rejected."));
+            return false;
         }
+
+        return true;
+    }
+
+#if OFX_CACHE_HAS_COROUTINES
+
+    /// \brief Request a value by its key from a coroutine.
+    ///
+    /// The returned awaitable resumes the coroutine with the value, e.g.
+    ///
+    ///     auto manifest = co_await cache.asyncGet("manifest.json");
+    ///
+    /// If the request fails or is cancelled, the co_await expression throws a
+    /// Poco::IOException. See RequestAwaiter.
+    ///
+    /// \param key The key to request.
+    /// \param priority The priority of the request.
+    /// \param executor The executor to resume on, or nullptr to resume on the
+    /// thread that completes the request.
+    /// \returns an awaitable that resolves to the value.
+    RequestAwaiter<KeyType, ValueType> asyncGet(const KeyType& key,
+                                                RequestPriority priority = RequestPriority::NORMAL,
+                                                Executor executor = nullptr)
+    {
+        return RequestAwaiter<KeyType, ValueType>(*this, key, priority, executor);
+    }
+
+    /// \brief Request several values from a coroutine.
+    ///
+    /// All requests are started at once and the coroutine resumes once, when
+    /// all of them are finished. Failed or cancelled values are nullptr. See
+    /// BatchRequestAwaiter.
+    ///
+    /// \param keys The keys to request.
+    /// \param priority The priority of the requests.
+    /// \param executor The executor to resume on, or nullptr to resume on the
+    /// thread that completes the last request.
+    /// \returns an awaitable that resolves to the values in order of the keys.
+    BatchRequestAwaiter<KeyType, ValueType> asyncGetAll(const std::vector<KeyType>& keys,
+                                                        RequestPriority priority = RequestPriority::NORMAL,
+                                                        Executor executor = nullptr)
+    {
+        return BatchRequestAwaiter<KeyType, ValueType>(*this, keys, priority, executor);
+    }
+
+#endif
+
+    /// \brief Load a value into the cache ahead of time.
+    ///
+    /// Prefetches run at idle priority and never block. Idle priority only
+    /// defers prefetches behind other requests if the cache limits the
+    /// number of requests running at once, see RequestPriority. When the
+    /// request queue is full, a prefetch never displaces a queued request of
+    /// a higher priority and is rejected instead. They do not fire the
+    /// onRequestComplete, onRequestFailed or onRequestCancelled events. If the
+    /// key is requested with request() while the prefetch is outstanding, the
+    /// prefetch is promoted to a regular request.
+    ///
+    /// \param key The key to prefetch.
+    void prefetch(const KeyType& key)
+    {
+        if (this->has(key))
+        {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+
+            if (_pendingRequests.find(key) != _pendingRequests.end())
+            {
+                return;
+            }
+
+            auto iter = _pendingRequests.emplace(key, PendingRequest()).first;
+            iter->second.future = iter->second.promise.get_future().share();
+            iter->second.isPrefetch = true;
+        }
+
+        if (!doRequest(key, RequestPriority::IDLE, false))
+        {
+            discardPendingRequest(RequestFailedArgs<KeyType>(key, "Request rejected."));
+        }
+    }
+
+    /// \brief Load several values into the cache ahead of time.
+    /// \param keys The keys to prefetch, in order of importance.
+    void prefetch(const std::vector<KeyType>& keys)
+    {
+        for (const auto& key: keys)
+        {
+            prefetch(key);
+        }
+    }
+
+    using BaseCache<KeyType, ValueType>::get;
+
+    /// \brief Get a value and read ahead according to the read-ahead policy.
+    ///
+    /// \param key The key to get.
+    /// \param promote False to leave child values in the child nodes.
+    /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
+    std::shared_ptr<ValueType> get(const KeyType& key, bool promote) override
+    {
+        auto result = BaseCache<KeyType, ValueType>::get(key, promote);
+
+        std::shared_ptr<BaseReadAheadPolicy<KeyType>> readAheadPolicy;
+
+        {
+            std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+            readAheadPolicy = _readAheadPolicy;
+        }
+
+        if (readAheadPolicy != nullptr)
+        {
+            prefetch(readAheadPolicy->predict(key));
+        }
+
+        return result;
+    }
+
+    /// \brief Determine if a request for the given key has not finished.
+    ///
+    /// The lookup does not construct a key, see KeyTraits.
+    ///
+    /// \param key The key to check.
+    /// \returns true if the key was requested or prefetched and is pending.
+    bool isRequestPending(typename BaseCache<KeyType, ValueType>::LookupType key) const
+    {
+        std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+        return _pendingRequests.find(key) != _pendingRequests.end();
+    }
+
+    /// \brief Set the policy used to read ahead on get().
+    /// \param readAheadPolicy The policy, or nullptr to disable read-ahead.
+    void setReadAheadPolicy(std::shared_ptr<BaseReadAheadPolicy<KeyType>> readAheadPolicy)
+    {
+        std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+        _readAheadPolicy = readAheadPolicy;
+    }
+
+    /// \returns the read-ahead policy or nullptr if read-ahead is disabled.
+    std::shared_ptr<BaseReadAheadPolicy<KeyType>> readAheadPolicy() const
+    {
+        std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+        return _readAheadPolicy;
     }
 
     /// \brief Cancel any outstanding request for the given key.
@@ -193,12 +430,230 @@ public:
     mutable ofEvent<const RequestFailedArgs<KeyType>> onRequestFailed;
 
 protected:
-    virtual void doRequest(const KeyType& key) = 0;
+    /// \brief Deliver a loaded value to everyone waiting for the key.
+    ///
+    /// Subclasses call this when an outstanding request finishes.
+    ///
+    /// \param key The requested key.
+    /// \param value The loaded value.
+    /// \param status The cache status of the result.
+    void completeRequest(const KeyType& key,
+                         std::shared_ptr<ValueType> value,
+                         CacheStatus status)
+    {
+        RequestCompleteArgs<KeyType, ValueType> args(key, value, status);
+        PendingRequest pending;
+        bool isPending = takePendingRequest(key, pending);
+
+        // Prefetches only fill the cache.
+        if (!isPending || !pending.isPrefetch)
+        {
+            onRequestComplete.notify(this, args);
+        }
+
+        if (isPending)
+        {
+            pending.promise.set_value(value);
+
+            for (auto& callback: pending.onComplete)
+            {
+                callback(args);
+            }
+        }
+    }
+
+    /// \brief Deliver a failure to everyone waiting for the key.
+    /// \param key The requested key.
+    /// \param error A description of the error.
+    void failRequest(const KeyType& key, const std::string& error)
+    {
+        RequestFailedArgs<KeyType> args(key, error);
+        PendingRequest pending;
+        bool isPending = takePendingRequest(key, pending);
+
+        if (!isPending || !pending.isPrefetch)
+        {
+            onRequestFailed.notify(this, args);
+        }
+
+        if (isPending)
+        {
+            rejectPendingRequest(pending, args);
+        }
+    }
+
+    /// \brief Deliver a cancellation to everyone waiting for the key.
+    /// \param key The requested key.
+    void cancelledRequest(const KeyType& key)
+    {
+        PendingRequest pending;
+        bool isPending = takePendingRequest(key, pending);
+
+        if (!isPending || !pending.isPrefetch)
+        {
+            onRequestCancelled.notify(this, key);
+        }
+
+        if (isPending)
+        {
+            rejectPendingRequest(pending, RequestFailedArgs<KeyType>(key, "Request cancelled."));
+        }
+    }
+
+    /// \brief Start loading a key.
+    /// \param key The key to load.
+    /// \param priority The priority of the request.
+    /// \param wait True if the caller may block until the request fits.
+    /// \returns false if the request was rejected.
+    virtual bool doRequest(const KeyType& key,
+                           RequestPriority priority,
+                           bool wait) = 0;
     virtual void doCancelRequest(const KeyType& key) = 0;
     virtual void doCancelQueuedRequest(const KeyType& key) = 0;
     virtual float doRequestProgress(const KeyType& key) const = 0;
     virtual RequestState doRequestState(const KeyType& key) const = 0;
 
+    std::shared_ptr<ValueType> lookupGet(typename BaseCache<KeyType, ValueType>::LookupType key) override
+    {
+        {
+            std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+
+            // Read-ahead predicts from a key, so take the regular path.
+            if (_readAheadPolicy != nullptr)
+            {
+                lock.unlock();
+                return get(KeyTraits<KeyType>::toKey(key));
+            }
+        }
+
+        return BaseCache<KeyType, ValueType>::lookupGet(key);
+    }
+
+private:
+    /// \brief The per-key state shared by all callers waiting for a key.
+    struct PendingRequest
+    {
+        std::promise<std::shared_ptr<ValueType>> promise;
+        RequestFuture future;
+        std::vector<RequestCompleteCallback> onComplete;
+        std::vector<RequestFailedCallback> onFailed;
+
+        /// \brief True if only prefetch() is waiting for the key.
+        bool isPrefetch = false;
+    };
+
+    /// \returns false if the request was rejected.
+    bool startRequest(const KeyType& key,
+                      RequestCompleteCallback onComplete,
+                      RequestFailedCallback onFailed,
+                      RequestPriority priority,
+                      bool wait,
+                      RequestFuture& future)
+    {
+        auto result = this->get(key);
+
+        if (result != nullptr)
+        {
+            RequestCompleteArgs<KeyType, ValueType> args(key, result, CacheStatus::CACHE_HIT);
+            onRequestComplete.notify(this, args);
+
+            if (onComplete)
+            {
+                onComplete(args);
+            }
+
+            std::promise<std::shared_ptr<ValueType>> promise;
+            promise.set_value(result);
+            future = promise.get_future().share();
+            return true;
+        }
+
+        bool isNewRequest = false;
+        bool isPrefetch = false;
+
+        {
+            std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+            auto iter = _pendingRequests.find(key);
+
+            if (iter == _pendingRequests.end())
+            {
+                iter = _pendingRequests.emplace(key, PendingRequest()).first;
+                iter->second.future = iter->second.promise.get_future().share();
+                isNewRequest = true;
+            }
+
+            isPrefetch = iter->second.isPrefetch;
+            iter->second.isPrefetch = false;
+
+            if (onComplete)
+            {
+                iter->second.onComplete.push_back(onComplete);
+            }
+
+            if (onFailed)
+            {
+                iter->second.onFailed.push_back(onFailed);
+            }
+
+            future = iter->second.future;
+        }
+
+        if (isPrefetch)
+        {
+            // Raise the priority of the prefetch to the priority of the request.
+            doRequest(key, priority, false);
+            return true;
+        }
+
+        return !isNewRequest || doRequest(key, priority, wait);
+    }
+
+    bool takePendingRequest(const KeyType& key, PendingRequest& pending)
+    {
+        std::unique_lock<std::mutex> lock(_pendingRequestsMutex);
+        auto iter = _pendingRequests.find(key);
+
+        if (iter == _pendingRequests.end())
+        {
+            return false;
+        }
+
+        pending = std::move(iter->second);
+        _pendingRequests.erase(iter);
+        return true;
+    }
+
+    void rejectPendingRequest(PendingRequest& pending,
+                              const RequestFailedArgs<KeyType>& args)
+    {
+        pending.promise.set_exception(std::make_exception_ptr(Poco::IOException(args.error())));
+
+        for (auto& callback: pending.onFailed)
+        {
+            callback(args);
+        }
+    }
+
+    /// \brief Reject a request without firing the shared events.
+    void discardPendingRequest(const RequestFailedArgs<KeyType>& args)
+    {
+        PendingRequest pending;
+
+        if (takePendingRequest(args.key(), pending))
+        {
+            rejectPendingRequest(pending, args);
+        }
+    }
+
+    /// \brief Requests that have been started but have not finished.
+    std::map<KeyType, PendingRequest, std::less<>> _pendingRequests;
+
+    /// \brief The optional read-ahead policy.
+    std::shared_ptr<BaseReadAheadPolicy<KeyType>> _readAheadPolicy;
+
+    /// \brief The mutex protecting the pending requests.
+    mutable std::mutex _pendingRequestsMutex;
+
 };
 
 
@@ -8,9 +8,18 @@
 #pragma once
 
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include "Poco/Exception.h"
 #include "ofEvent.h"
 #include "ofLog.h"
 #include "ofx/Cache/BaseStore.h"
+#include "ofx/Cache/CacheStatistics.h"
+#include "ofx/Cache/LatencyHistogram.h"
+#include "ofx/Cache/PromotionPolicy.h"
+#include "ofx/Cache/WriteBehindQueue.h"
 
 
 namespace ofx {
@@ -34,6 +43,173 @@ enum class CacheStatus
 };
 
 
+/// \brief How writes to a cache node reach its child cache node.
+enum class WritePolicy
+{
+    /// \brief Writes only affect the node they are made on.
+    LOCAL,
+    /// \brief Writes are made on the node and then on the child, in the
+    /// calling thread.
+    WRITE_THROUGH,
+    /// \brief Writes are made on the node and queued for the child. Queued
+    /// writes are coalesced per key and written by a background thread.
+    WRITE_BEHIND
+};
+
+
+/// \brief The interface of a cache node as seen by its parent node.
+///
+/// A BaseCache holds its child through this interface, so each node only
+/// depends on the key and value types of its direct child, not on the types
+/// further down the cascade.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+template<typename KeyType, typename ValueType>
+class BaseCacheNode: public BaseWritableStore<KeyType, ValueType>
+{
+public:
+    /// \brief Destroy the BaseCacheNode.
+    virtual ~BaseCacheNode()
+    {
+    }
+
+    using BaseWritableStore<KeyType, ValueType>::get;
+
+    /// \brief Recursively get a value by its key.
+    /// \param key The key to get.
+    /// \param promote False to leave child values in the child nodes.
+    /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
+    virtual std::shared_ptr<ValueType> get(const KeyType& key, bool promote) = 0;
+
+    /// \returns the number of elements in this cache node.
+    virtual std::size_t size() = 0;
+
+    /// \brief Clear all values in this cache node.
+    virtual void clear() = 0;
+
+    /// \returns the sum of the counters of this node and all child nodes.
+    virtual CacheStatistics cascadeStatistics() const = 0;
+
+    /// \returns the latency histograms of this node and all child nodes.
+    virtual ofJson cascadeLatencyToJson() const = 0;
+
+    /// \brief An event called when the cache is cleared.
+    ofEvent<void> onClear;
+
+};
+
+
+/// \brief Converts the keys of a cache node to the keys of its child.
+///
+/// Keys convert implicitly when KeyType converts to ChildKeyType. Otherwise
+/// toChildKey() is pure virtual, so a node that doesn't override it can't be
+/// instantiated.
+///
+/// \tparam KeyType The key type.
+/// \tparam ChildKeyType The key type of the child node.
+template<typename KeyType, typename ChildKeyType, typename Enable = void>
+class ChildKeyConverter
+{
+public:
+    /// \brief Destroy the ChildKeyConverter.
+    virtual ~ChildKeyConverter() { }
+
+protected:
+    /// \brief Convert a key of this node to a key of the child node.
+    /// \param key The key of this node.
+    /// \returns the key of the child node.
+    virtual ChildKeyType toChildKey(const KeyType& key) const = 0;
+
+};
+
+
+template<typename KeyType, typename ChildKeyType>
+class ChildKeyConverter<KeyType, ChildKeyType, typename std::enable_if<std::is_convertible<KeyType, ChildKeyType>::value>::type>
+{
+public:
+    /// \brief Destroy the ChildKeyConverter.
+    virtual ~ChildKeyConverter() { }
+
+protected:
+    /// \brief Convert a key of this node to a key of the child node.
+    /// \param key The key of this node.
+    /// \returns the key of the child node.
+    virtual ChildKeyType toChildKey(const KeyType& key) const
+    {
+        return key;
+    }
+
+};
+
+
+/// \brief Converts the values of a cache node to and from the values of its
+/// child.
+///
+/// Values convert implicitly when their shared pointers convert both ways.
+/// Otherwise fromChildValue() and toChildValue() are pure virtual, so a node
+/// that doesn't override them can't be instantiated.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+/// \tparam ChildValueType The value type of the child node.
+template<typename KeyType, typename ValueType, typename ChildValueType, typename Enable = void>
+class ChildValueConverter
+{
+public:
+    /// \brief Destroy the ChildValueConverter.
+    virtual ~ChildValueConverter() { }
+
+protected:
+    /// \brief Convert a value of the child node to a value of this node.
+    /// \param key The key of this node.
+    /// \param value The value of the child node, never nullptr.
+    /// \returns the value of this node or nullptr if it can't be converted.
+    virtual std::shared_ptr<ValueType> fromChildValue(const KeyType& key,
+                                                      std::shared_ptr<ChildValueType> value) const = 0;
+
+    /// \brief Convert a value of this node to a value of the child node.
+    /// \param key The key of this node.
+    /// \param value The value of this node.
+    /// \returns the value of the child node or nullptr to skip the write.
+    virtual std::shared_ptr<ChildValueType> toChildValue(const KeyType& key,
+                                                         std::shared_ptr<ValueType> value) const = 0;
+
+};
+
+
+template<typename KeyType, typename ValueType, typename ChildValueType>
+class ChildValueConverter<KeyType, ValueType, ChildValueType, typename std::enable_if<std::is_convertible<std::shared_ptr<ChildValueType>, std::shared_ptr<ValueType>>::value
+                                                                                     && std::is_convertible<std::shared_ptr<ValueType>, std::shared_ptr<ChildValueType>>::value>::type>
+{
+public:
+    /// \brief Destroy the ChildValueConverter.
+    virtual ~ChildValueConverter() { }
+
+protected:
+    /// \brief Convert a value of the child node to a value of this node.
+    /// \param key The key of this node.
+    /// \param value The value of the child node, never nullptr.
+    /// \returns the value of this node or nullptr if it can't be converted.
+    virtual std::shared_ptr<ValueType> fromChildValue(const KeyType&,
+                                                      std::shared_ptr<ChildValueType> value) const
+    {
+        return value;
+    }
+
+    /// \brief Convert a value of this node to a value of the child node.
+    /// \param key The key of this node.
+    /// \param value The value of this node.
+    /// \returns the value of the child node or nullptr to skip the write.
+    virtual std::shared_ptr<ChildValueType> toChildValue(const KeyType&,
+                                                         std::shared_ptr<ValueType> value) const
+    {
+        return value;
+    }
+
+};
+
+
 /// \brief A thread-safe cascading cache node.
 ///
 /// Caches can be chained in order to have several layers of caching, e.g.
@@ -45,15 +221,26 @@ enum class CacheStatus
 /// ofPixels object cached in memory), adapter caches are available translate
 /// between cache layers that differ in KeyType or ValueType.
 ///
+/// Keys and values cross to the child node through toChildKey(),
+/// fromChildValue() and toChildValue(). By default they are converted
+/// implicitly, see ChildKeyConverter and ChildValueConverter. Nodes with
+/// child types that don't convert must override them, see AdapterCache.
+///
 /// Subclasses _must_ protect their own data to allow multi-threaded access.
 ///
 /// \tparam KeyType The key type.
 /// \tparam ValueType The value type (e.g. a std::shared_ptr<ValueType>).
+/// \tparam ChildKeyType The key type of the child node.
+/// \tparam ChildValueType The value type of the child node.
 template<typename KeyType, typename ValueType, typename ChildKeyType = KeyType, typename ChildValueType = ValueType>
-class BaseCache: public BaseWritableStore<KeyType, ValueType>
+class BaseCache:
+    public BaseCacheNode<KeyType, ValueType>,
+    protected ChildKeyConverter<KeyType, ChildKeyType>,
+    protected ChildValueConverter<KeyType, ValueType, ChildValueType>
 {
 public:
-    typedef BaseCache<ChildKeyType, ChildValueType> ChildStore;
+    typedef BaseCacheNode<ChildKeyType, ChildValueType> ChildStore;
+    typedef typename BaseCacheNode<KeyType, ValueType>::LookupType LookupType;
 
     /// \brief Create a default BaseCache.
     BaseCache(std::unique_ptr<ChildStore> childStore = nullptr)
@@ -62,8 +249,13 @@ public:
     }
 
     /// \brief Destroy the BaseCache.
+    ///
+    /// Subclasses with write-behind must call stopWriteBehind() first in
+    /// their destructor, see stopWriteBehind().
     virtual ~BaseCache()
     {
+        // Drain queued writes while the child is still alive.
+        stopWriteBehind();
     }
 
     /// \brief Recursively get a value by its key.
@@ -75,24 +267,63 @@ public:
     /// This method is synchronous and will block until the get operation is
     /// complete.
     ///
+    /// Child values are copied into this node if the promotion policy
+    /// allows it.
+    ///
     /// \param key The key to get.
     /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
     std::shared_ptr<ValueType> get(const KeyType& key) override
     {
-        auto result = this->doGet(key);
+        return get(key, true);
+    }
+
+    /// \brief Recursively get a value by its key.
+    ///
+    /// \param key The key to get.
+    /// \param promote False to leave child values in the child nodes, e.g.
+    /// for a one-off scan. True to let the promotion policy decide.
+    /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
+    std::shared_ptr<ValueType> get(const KeyType& key, bool promote) override
+    {
+        this->onGet.notify(this, key);
+
+        auto result = timedGet(key, promote);
 
         if (result != nullptr)
         {
+            CacheCounters::increment(_counters.hits);
             return result;
         }
-        else if (_childStore != nullptr)
+
+        CacheCounters::increment(_counters.misses);
+
+        // A value evicted from this node may not have reached the child yet.
+        if (_writeBehind != nullptr)
         {
-            result = _childStore->get(key);
+            result = _writeBehind->find(key);
 
             if (result != nullptr)
             {
+                if (promote)
+                {
+                    this->onAdd.notify(this, std::make_pair(key, result));
+                    timedAdd(key, result);
+                }
+
+                return result;
+            }
+        }
+
+        if (_childStore != nullptr)
+        {
+            auto childResult = _childStore->get(this->toChildKey(key), promote);
+            result = childResult != nullptr ? this->fromChildValue(key, childResult) : nullptr;
+
+            if (result != nullptr && promote && shouldPromote(key))
+            {
+                CacheCounters::increment(_counters.promotions);
                 this->onAdd.notify(this, std::make_pair(key, result));
-                this->doAdd(key, result);
+                timedAdd(key, result);
             }
 
             // This result might be nullptr if the _childStore doesn't have it.
@@ -103,19 +334,243 @@ public:
         return nullptr;
     }
 
+    using BaseCacheNode<KeyType, ValueType>::get;
+
+    /// \brief Determine if the given value is available from this cache node.
+    /// \param key The key to check.
+    /// \returns true if this cache node has the requested value.
+    bool has(const KeyType& key) const override
+    {
+        this->onHas.notify(this, key);
+        auto latency = activeLatency();
+        ScopedLatency timer(latency != nullptr ? &latency->has : nullptr);
+        return this->doHas(key);
+    }
+
+    using BaseCacheNode<KeyType, ValueType>::has;
+
+    using BaseWritableStore<KeyType, ValueType>::add;
+
+    /// \brief Cache a value in this cache node.
+    /// \param key The key to cache.
+    /// \param entry The value to cache.
+    void add(const KeyType& key, std::shared_ptr<ValueType> entry) override
+    {
+        this->remove(key);
+        this->onAdd.notify(this, std::make_pair(key, entry));
+        timedAdd(key, entry);
+        propagateWrite(key, entry);
+    }
+
+    using BaseWritableStore<KeyType, ValueType>::update;
+
+    /// \brief Update a value in this cache node.
+    /// \param key The key to cache.
+    /// \param entry The value to cache.
+    void update(const KeyType& key, std::shared_ptr<ValueType> entry) override
+    {
+        BaseWritableStore<KeyType, ValueType>::update(key, entry);
+        propagateWrite(key, entry);
+    }
+
+    /// \brief Set the policy deciding which child values are copied up.
+    /// \param promotionPolicy The policy, or nullptr to always promote.
+    void setPromotionPolicy(std::shared_ptr<BasePromotionPolicy<KeyType>> promotionPolicy)
+    {
+        std::unique_lock<std::mutex> lock(_promotionPolicyMutex);
+        _promotionPolicy = promotionPolicy;
+    }
+
+    /// \returns the promotion policy or nullptr if all values are promoted.
+    std::shared_ptr<BasePromotionPolicy<KeyType>> promotionPolicy() const
+    {
+        std::unique_lock<std::mutex> lock(_promotionPolicyMutex);
+        return _promotionPolicy;
+    }
+
+    /// \brief Set how writes to this node reach the child node.
+    ///
+    /// Values are passed to the child through toChildKey() and toChildValue().
+    /// Changing the policy away from write-behind flushes the queued writes
+    /// first. The policy should be set before the cache is shared between
+    /// threads.
+    ///
+    /// \param writePolicy The write policy.
+    /// \param maximumPendingWrites The maximum number of queued keys for
+    /// write-behind. Writes of new keys block while the queue is full.
+    /// \param batchSize The maximum number of writes per batch for write-behind.
+    void setWritePolicy(WritePolicy writePolicy,
+                        std::size_t maximumPendingWrites = WriteBehindQueue<KeyType, ValueType>::DEFAULT_MAXIMUM_PENDING_WRITES,
+                        std::size_t batchSize = WriteBehindQueue<KeyType, ValueType>::DEFAULT_BATCH_SIZE)
+    {
+        _writeBehind.reset();
+        _writePolicy = writePolicy;
+
+        if (_writePolicy == WritePolicy::WRITE_BEHIND)
+        {
+            _writeBehind = std::make_unique<WriteBehindQueue<KeyType, ValueType>>([this](const std::vector<std::pair<KeyType, std::shared_ptr<ValueType>>>& writes) {
+                for (const auto& write: writes)
+                {
+                    writeToChild(write.first, write.second);
+                }
+            }, maximumPendingWrites, batchSize);
+        }
+    }
+
+    /// \returns the write policy.
+    WritePolicy writePolicy() const
+    {
+        return _writePolicy;
+    }
+
+    /// \brief Block until all queued writes have reached the child node.
+    ///
+    /// Does nothing unless the write policy is WritePolicy::WRITE_BEHIND.
+    void flush()
+    {
+        if (_writeBehind != nullptr)
+        {
+            _writeBehind->flush();
+        }
+    }
+
+    /// \returns the number of writes waiting to reach the child node.
+    std::size_t pendingWrites() const
+    {
+        return _writeBehind != nullptr ? _writeBehind->size() : 0;
+    }
+
     /// \returns the number of elements in this cache node cache.
-    std::size_t size()
+    std::size_t size() override
     {
         return doSize();
     }
 
+    /// \brief Remove a value from this cache node.
+    ///
+    /// A write of the key that has not reached the child node yet is
+    /// dropped, so the removed value is not written or returned later.
+    ///
+    /// \param key The key to remove.
+    void remove(const KeyType& key) override
+    {
+        if (_writeBehind != nullptr)
+        {
+            _writeBehind->erase(key);
+        }
+
+        BaseWritableStore<KeyType, ValueType>::remove(key);
+    }
+
     /// \brief Clear all values in this cache node.
-    void clear()
+    ///
+    /// Writes that have not reached the child node yet are dropped.
+    void clear() override
     {
-        onClear.notify(this);
+        if (_writeBehind != nullptr)
+        {
+            _writeBehind->clear();
+        }
+
+        this->onClear.notify(this);
         doClear();
     }
 
+    /// \returns a snapshot of the counters of this cache node.
+    virtual CacheStatistics statistics() const
+    {
+        return _counters.snapshot();
+    }
+
+    /// \returns the sum of the counters of this node and all child nodes.
+    CacheStatistics cascadeStatistics() const override
+    {
+        auto result = statistics();
+
+        if (_childStore != nullptr)
+        {
+            result += _childStore->cascadeStatistics();
+        }
+
+        return result;
+    }
+
+    /// \brief Reset the counters of this cache node.
+    ///
+    /// The byte counter tracks live data and is not reset.
+    void resetStatistics()
+    {
+        _counters.reset();
+    }
+
+    /// \brief Enable or disable the latency histograms of this cache node.
+    ///
+    /// Histograms are allocated the first time they are enabled and keep
+    /// their values while disabled.
+    ///
+    /// \param enabled True to record latencies.
+    void setLatencyTracking(bool enabled)
+    {
+        if (enabled)
+        {
+            std::call_once(_latencyOnce, [this]() {
+                _latency = std::make_unique<CacheLatency>();
+            });
+        }
+
+        _latencyEnabled.store(enabled, std::memory_order_release);
+    }
+
+    /// \returns true if latencies are being recorded.
+    bool isLatencyTracking() const
+    {
+        return _latencyEnabled.load(std::memory_order_acquire);
+    }
+
+    /// \returns the latency histograms or nullptr if they were never enabled.
+    const CacheLatency* latency() const
+    {
+        return _latency.get();
+    }
+
+    /// \brief Clear the latency histograms of this cache node.
+    void resetLatency()
+    {
+        if (_latency != nullptr)
+        {
+            _latency->reset();
+        }
+    }
+
+    /// \brief Export the latency histograms of this node and all child nodes.
+    ///
+    /// Each element of the array describes one tier, starting with this node
+    /// as tier 0.
+    ///
+    /// \returns a JSON array with one element per tier.
+    ofJson cascadeLatencyToJson() const override
+    {
+        ofJson json = ofJson::array();
+        ofJson tier = _latency != nullptr ? _latency->toJson() : ofJson();
+        tier["enabled"] = isLatencyTracking();
+        json.push_back(tier);
+
+        if (_childStore != nullptr)
+        {
+            for (const auto& childTier: _childStore->cascadeLatencyToJson())
+            {
+                json.push_back(childTier);
+            }
+        }
+
+        for (std::size_t i = 0; i < json.size(); ++i)
+        {
+            json[i]["tier"] = i;
+        }
+
+        return json;
+    }
+
     /// \brief Take ownership of the passed std::unique_ptr<StoreType>.
     ///
     /// This this is "sink" meaning that any child passed to this will be
@@ -184,31 +639,164 @@ public:
         return std::move(_childStore);
     }
 
-    /// \brief An event called when the cache is cleared.
-    ofEvent<void> onClear;
-
 protected:
-    bool onChildAdd(const std::pair<KeyType, std::shared_ptr<ValueType>>& evt)
+    /// \returns the child cache node or nullptr if there is none.
+    ChildStore* childStore() const
+    {
+        return _childStore.get();
+    }
+
+    /// \brief The counters of this cache node.
+    ///
+    /// Hits, misses and promotions are counted by get(). Subclasses count
+    /// loads, evictions and bytes as appropriate.
+    CacheCounters _counters;
+
+    /// \returns the histograms to record into or nullptr if disabled.
+    CacheLatency* activeLatency() const
+    {
+        return isLatencyTracking() ? _latency.get() : nullptr;
+    }
+
+    /// \brief Get a value from this node only.
+    ///
+    /// Nodes that hold several tiers internally can override this to honor
+    /// the promote flag of get(). The default calls doGet().
+    ///
+    /// \param key The key to get.
+    /// \param promote False if values must not be copied between tiers.
+    /// \returns the value or nullptr.
+    virtual std::shared_ptr<ValueType> doGetLocal(const KeyType& key, bool)
+    {
+        return this->doGet(key);
+    }
+
+    /// \brief Check this node only for a lookup key.
+    ///
+    /// The default constructs a key and calls doHas(). Nodes that can
+    /// search by LookupType override this.
+    virtual bool doHasLookup(LookupType key) const
+    {
+        return this->doHas(KeyTraits<KeyType>::toKey(key));
+    }
+
+    /// \brief Get a value from this node only for a lookup key.
+    ///
+    /// The default constructs a key and calls doGet().
+    virtual std::shared_ptr<ValueType> doGetLookup(LookupType key)
+    {
+        return this->doGet(KeyTraits<KeyType>::toKey(key));
+    }
+
+    bool lookupHas(LookupType key) const override
+    {
+        // Keys are only constructed for listeners.
+        if (this->onHas.size() > 0)
+        {
+            this->onHas.notify(this, KeyTraits<KeyType>::toKey(key));
+        }
+
+        auto latency = activeLatency();
+        ScopedLatency timer(latency != nullptr ? &latency->has : nullptr);
+        return doHasLookup(key);
+    }
+
+    /// \brief Get a value for a lookup key.
+    ///
+    /// Hits in this node are answered without constructing a key. Misses
+    /// fall back to get(), which checks this node again before asking the
+    /// child.
+    std::shared_ptr<ValueType> lookupGet(LookupType key) override
+    {
+        std::shared_ptr<ValueType> result = nullptr;
+
+        {
+            auto latency = activeLatency();
+            ScopedLatency timer(latency != nullptr ? &latency->get : nullptr);
+            result = doGetLookup(key);
+        }
+
+        if (result == nullptr)
+        {
+            return get(KeyTraits<KeyType>::toKey(key));
+        }
+
+        if (this->onGet.size() > 0)
+        {
+            this->onGet.notify(this, KeyTraits<KeyType>::toKey(key));
+        }
+
+        CacheCounters::increment(_counters.hits);
+        return result;
+    }
+
+    /// \brief Write the queued writes to the child and stop writing behind.
+    ///
+    /// The writer calls toChildKey(), toChildValue() and doOnChildWritten(),
+    /// so every subclass must call this first in its destructor, while its
+    /// overrides and data are still alive. Later writes stay local.
+    void stopWriteBehind()
+    {
+        _writeBehind.reset();
+    }
+
+    /// \brief Call doGet(), recording its latency if enabled.
+    std::shared_ptr<ValueType> timedGet(const KeyType& key, bool promote)
+    {
+        auto latency = activeLatency();
+        ScopedLatency timer(latency != nullptr ? &latency->get : nullptr);
+        return doGetLocal(key, promote);
+    }
+
+    /// \brief Call doAdd(), recording its latency if enabled.
+    void timedAdd(const KeyType& key, std::shared_ptr<ValueType> entry)
+    {
+        auto latency = activeLatency();
+        ScopedLatency timer(latency != nullptr ? &latency->add : nullptr);
+        this->doAdd(key, entry);
+    }
+
+    /// \returns true if a value found in the child should be added here.
+    bool shouldPromote(const KeyType& key)
+    {
+        auto policy = promotionPolicy();
+        return policy == nullptr || policy->shouldPromote(key);
+    }
+
+    /// \brief Write a value to the child according to the write policy.
+    void propagateWrite(const KeyType& key, std::shared_ptr<ValueType> entry)
+    {
+        if (_writePolicy == WritePolicy::WRITE_THROUGH)
+        {
+            writeToChild(key, entry);
+        }
+        else if (_writeBehind != nullptr)
+        {
+            _writeBehind->write(key, entry);
+        }
+    }
+
+    bool onChildAdd(const std::pair<ChildKeyType, std::shared_ptr<ChildValueType>>& evt)
     {
         return doOnChildAdd(evt);
     }
 
-    bool onChildUpdate(const std::pair<KeyType, std::shared_ptr<ValueType>>& evt)
+    bool onChildUpdate(const std::pair<ChildKeyType, std::shared_ptr<ChildValueType>>& evt)
     {
         return doOnChildUpdate(evt);
     }
 
-    bool onChildRemove(const KeyType& evt)
+    bool onChildRemove(const ChildKeyType& evt)
     {
         return doOnChildRemove(evt);
     }
 
-    bool onChildHas(const KeyType& evt)
+    bool onChildHas(const ChildKeyType& evt)
     {
         return doOnChildHas(evt);
     }
 
-    bool onChildGet(const KeyType& evt)
+    bool onChildGet(const ChildKeyType& evt)
     {
         return doOnChildGet(evt);
     }
@@ -221,33 +809,33 @@ protected:
     virtual std::size_t doSize() = 0;
     virtual void doClear() = 0;
 
-    virtual bool doOnChildAdd(const std::pair<KeyType, std::shared_ptr<ValueType>>&)
+    virtual bool doOnChildAdd(const std::pair<ChildKeyType, std::shared_ptr<ChildValueType>>&)
     {
         ofLogVerbose("BaseCache::doOnChildAdd") << "Not implmented.";
         return false;
     }
 
-    virtual bool doOnChildUpdate(const std::pair<KeyType, std::shared_ptr<ValueType>>&)
+    virtual bool doOnChildUpdate(const std::pair<ChildKeyType, std::shared_ptr<ChildValueType>>&)
     {
         ofLogVerbose("BaseCache::doOnChildUpdate") << "Not implmented.";
         return false;
     }
 
-    virtual bool doOnChildRemove(const KeyType&)
+    virtual bool doOnChildRemove(const ChildKeyType&)
     {
         ofLogVerbose("BaseCache::doOnChildRemove") << "Not implmented.";
         return false;
     }
 
-    virtual bool doOnChildHas(const KeyType&)
+    /// \brief Called for every lookup in the child, so it must be cheap.
+    virtual bool doOnChildHas(const ChildKeyType&)
     {
-        ofLogVerbose("BaseCache::doOnChidoOnChildHasldAdd") << "Not implmented.";
         return false;
     }
 
-    virtual bool doOnChildGet(const KeyType&)
+    /// \brief Called for every lookup in the child, so it must be cheap.
+    virtual bool doOnChildGet(const ChildKeyType&)
     {
-        ofLogVerbose("BaseCache::doOnChildGet") << "Not implmented.";
         return false;
     }
 
@@ -257,9 +845,45 @@ protected:
         return false;
     }
 
+    /// \brief Called after a value was written to the child.
+    ///
+    /// Stores may fail to write without throwing, so subclasses that track
+    /// what the child holds should confirm the write, e.g. with has().
+    ///
+    /// \param key The key of this node.
+    /// \param childKey The key the value was written to.
+    virtual void doOnChildWritten(const KeyType&, const ChildKeyType&)
+    {
+    }
+
 private:
+    void writeToChild(const KeyType& key, std::shared_ptr<ValueType> entry)
+    {
+        if (_childStore != nullptr)
+        {
+            auto childEntry = this->toChildValue(key, entry);
+
+            if (childEntry != nullptr)
+            {
+                ChildKeyType childKey = this->toChildKey(key);
+                _childStore->add(childKey, childEntry);
+                doOnChildWritten(key, childKey);
+            }
+        }
+    }
+
     std::unique_ptr<ChildStore> _childStore = nullptr;
 
+    std::shared_ptr<BasePromotionPolicy<KeyType>> _promotionPolicy = nullptr;
+    mutable std::mutex _promotionPolicyMutex;
+
+    WritePolicy _writePolicy = WritePolicy::LOCAL;
+    std::unique_ptr<WriteBehindQueue<KeyType, ValueType>> _writeBehind = nullptr;
+
+    std::unique_ptr<CacheLatency> _latency = nullptr;
+    std::atomic<bool> _latencyEnabled { false };
+    std::once_flag _latencyOnce;
+
 };
 
 
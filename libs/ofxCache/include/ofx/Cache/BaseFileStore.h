@@ -8,7 +8,11 @@
 #pragma once
 
 
+#include <fstream>
+#include <vector>
 #include "ofx/Cache/BaseURIStore.h"
+#include "ofx/Cache/CancellationToken.h"
+#include "ofx/Cache/FileIOService.h"
 #include "ofx/HTTP/ClientSessionSettings.h"
 #include "ofx/HTTP/GetRequest.h"
 #include "ofx/HTTP/Client.h"
@@ -19,6 +23,18 @@ namespace Cache {
 
 
 /// \brief A simple File cache.
+///
+/// Files are read in chunks. If the request loading the file is cancelled,
+/// see CancellationToken, the read stops and throws.
+///
+/// With a membership filter, see BaseURIStore::setMembershipFilter(), keys
+/// that are certainly absent miss without touching the file system.
+///
+/// get() reads on the calling thread. readAsync() reads with the shared
+/// FileIOService instead and calls back when done, so the calling thread
+/// never waits, e.g. in BasePipelinedResourceCache::fetchAsync(). When
+/// compiled with OFX_CACHE_USE_IO_URING on Linux, the service batches the
+/// reads of all callers with io_uring.
 template <typename KeyType, typename ValueType>
 class BaseReadableFileStore: public virtual BaseReadableURIStore<KeyType, ValueType, ofBuffer>
 {
@@ -26,6 +42,25 @@ public:
     /// \brief Destroy the BaseReadableFileStore.
     virtual ~BaseReadableFileStore() { }
 
+    /// \brief Read the raw file for a key without waiting.
+    ///
+    /// Keys ruled out by the membership filter call back immediately. The
+    /// read can't be cancelled, a cancelled request ignores its result.
+    ///
+    /// \param key The key to read.
+    /// \param callback Called once with the file contents, or with nullptr
+    ///        and an error.
+    void readAsync(const KeyType& key, FileIOService::ReadCallback callback)
+    {
+        if (!this->mightContain(key))
+        {
+            callback(nullptr, "No file for key.");
+            return;
+        }
+
+        FileIOService::instance().read(ofToDataPath(this->keyToURI(key), true), callback);
+    }
+
 protected:
 
 //    virtual bool doHas(const KeyType& key) const = 0;
@@ -33,18 +68,46 @@ protected:
 
     bool doHas(const KeyType& key) const override
     {
-        return ofFile(this->keyToURI(key)).exists();
+        return this->mightContain(key) && ofFile(this->keyToURI(key)).exists();
     }
 
     std::shared_ptr<ValueType> doGet(const KeyType& key) override
     {
-        return this->rawToValue(ofLoadBufferFromFile(this->keyToURI(key)));
+        if (!this->mightContain(key))
+        {
+            return nullptr;
+        }
+
+        std::ifstream stream(ofToDataPath(this->keyToURI(key), true), std::ios::binary);
+        ofBuffer buffer;
+
+        if (stream)
+        {
+            std::vector<char> chunk(READ_CHUNK_SIZE);
+
+            // Read in chunks so a cancelled request stops promptly.
+            while (stream.read(chunk.data(), chunk.size()) || stream.gcount() > 0)
+            {
+                CancellationToken::throwIfCurrentCancelled();
+                buffer.append(chunk.data(), static_cast<std::size_t>(stream.gcount()));
+            }
+        }
+
+        return this->rawToValue(buffer);
     }
 
+    enum
+    {
+        /// \brief The number of bytes read between cancellation checks.
+        READ_CHUNK_SIZE = 64 * 1024
+    };
+
 };
 
 
 /// \brief A simple File cache.
+///
+/// Added and removed keys are recorded in the membership filter, if any.
 template <typename KeyType, typename ValueType>
 class BaseWritableFileStore: public virtual BaseWritableURIStore<KeyType, ValueType, ofBuffer>
 {
@@ -58,15 +121,29 @@ protected:
         std::string uri = this->keyToURI(key);
         std::shared_ptr<ofBuffer> buffer = this->valueToRaw(*entry.get());
 
-        if (!ofBufferToFile(uri, *buffer))
+        // Keys already in the filter are not inserted again, which also
+        // skips a file system lookup. Cuckoo filters must not hold a key
+        // twice, or a removed key would remain a member.
+        bool isNew = !this->mightContain(key);
+
+        bool isWritten = ofBufferToFile(uri, *buffer);
+
+        if (!isWritten)
         {
             ofLogError("BaseWritableFileStore::doAdd") << "Failed to add " << uri;
         }
+        else if (isNew)
+        {
+            this->insertMember(key);
+        }
     }
 
     void doRemove(const KeyType& key) override
     {
-        ofFile(this->keyToURI(key)).remove();
+        if (ofFile(this->keyToURI(key)).remove())
+        {
+            this->removeMember(key);
+        }
     }
 
 };
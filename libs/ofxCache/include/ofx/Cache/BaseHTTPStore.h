@@ -8,7 +8,15 @@
 #pragma once
 
 
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "Poco/Net/HTTPClientSession.h"
+#include "ofFileUtils.h"
+#include "ofJson.h"
 #include "ofx/Cache/BaseURIStore.h"
+#include "ofx/Cache/CancellationToken.h"
+#include "ofx/Cache/HashedKey.h"
 #include "ofx/HTTP/ClientSessionSettings.h"
 #include "ofx/HTTP/GetRequest.h"
 #include "ofx/HTTP/HeadRequest.h"
@@ -20,6 +28,20 @@ namespace Cache {
 
 
 /// \brief A simple HTTP cache.
+///
+/// If the request loading a value is cancelled, see CancellationToken, the
+/// socket of the connection is shut down, so the transfer of the body stops
+/// immediately.
+///
+/// With setPartialDownloadPath(), bodies are downloaded into a partial file
+/// next to their validators (ETag or Last-Modified). If a download is
+/// cancelled or fails, the next request resumes it with a Range request and
+/// only transfers the missing bytes. If the resource changed in the
+/// meantime, the server ignores the If-Range validator and the download
+/// starts over. Completed downloads are converted with bufferToValue().
+///
+/// With a membership filter, see BaseURIStore::setMembershipFilter(), keys
+/// that are certainly absent miss without sending a request.
 template <typename KeyType, typename ValueType>
 class BaseReadableHTTPStore: public BaseReadableURIStore<KeyType, ValueType, HTTP::ClientExchange>
 {
@@ -29,13 +51,149 @@ public:
     /// \brief Destroy the BaseReadableHTTPStore.
     virtual ~BaseReadableHTTPStore();
 
+    /// \brief Enable resumable downloads.
+    ///
+    /// This should be set before the store is used, usually to a directory
+    /// of the file tier.
+    ///
+    /// \param path The directory of partial downloads, or empty to disable.
+    void setPartialDownloadPath(const std::string& path);
+
+    /// \returns the directory of partial downloads, or empty if disabled.
+    std::string partialDownloadPath() const;
+
+    enum
+    {
+        /// \brief The number of bytes written to a partial file at once.
+        DOWNLOAD_CHUNK_SIZE = 64 * 1024
+    };
+
 protected:
     virtual bool doHas(const KeyType& key) const override;
     std::shared_ptr<ValueType> doGet(const KeyType& key) override;
 
+    /// \brief Convert a completed resumable download to a value.
+    ///
+    /// Subclasses that enable resumable downloads must override this. The
+    /// default logs an error and returns nullptr.
+    ///
+    /// \param buffer The downloaded body.
+    /// \returns the value or nullptr if the body is invalid.
+    virtual std::shared_ptr<ValueType> bufferToValue(ofBuffer& buffer);
+
+    /// \brief Download a body into a partial file, resuming if possible.
+    /// \param uri The URI to download.
+    /// \returns the value.
+    /// \throws Poco::IOException if the download failed or was cancelled.
+    /// The partial file is kept, so the download can be resumed.
+    std::shared_ptr<ValueType> doGetResumable(const std::string& uri);
+
 private:
+    /// \brief A partial download saved by a previous request.
+    struct PartialDownload
+    {
+        std::string path;
+        std::string metadataPath;
+        std::uint64_t bytes = 0;
+        std::string entityTag;
+        std::string lastModified;
+
+        /// \returns the validator sent with If-Range, or empty if the
+        /// download can't be resumed safely.
+        std::string validator() const
+        {
+            // Weak entity tags can't be used for range requests.
+            if (!entityTag.empty() && entityTag.compare(0, 2, "W/") != 0)
+            {
+                return entityTag;
+            }
+
+            return lastModified;
+        }
+    };
+
+    /// \returns the partial download of the uri, if any.
+    PartialDownload loadPartialDownload(const std::string& uri) const;
+
+    /// \brief Delete a partial download and its validators.
+    static void removePartialDownload(PartialDownload& partial);
+
+    /// \brief Aborts the transfer of a request if it is cancelled, see
+    /// CancellationToken.
+    ///
+    /// Create it before executing the request and watch the session once the
+    /// response arrived. Cancelling shuts the socket of the session down,
+    /// which unblocks reads of the body with an error. Unlike closing it,
+    /// shutting the socket down is safe while the request thread reads it.
+    /// A cancellation while the request executes is noticed by the check
+    /// that follows watch().
+    class SessionAborter
+    {
+    public:
+        /// \brief Register with the current token, if any.
+        SessionAborter()
+        {
+            const CancellationToken* token = CancellationToken::current();
+
+            if (token != nullptr)
+            {
+                _callback = std::make_unique<CancellationToken::Callback>(*token, [this]() {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    shutdown();
+                });
+            }
+        }
+
+        SessionAborter(const SessionAborter&) = delete;
+        SessionAborter& operator = (const SessionAborter&) = delete;
+
+        /// \brief Watch the session of the request.
+        ///
+        /// If the request was cancelled before, the caller must check the
+        /// token afterwards, see CancellationToken::throwIfCurrentCancelled().
+        ///
+        /// \param session The session, which must outlive the SessionAborter.
+        void watch(Poco::Net::HTTPClientSession* session)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _session = session;
+        }
+
+    private:
+        /// \brief Shut the socket of the session down. Requires the mutex.
+        void shutdown()
+        {
+            if (_session == nullptr)
+            {
+                return;
+            }
+
+            try
+            {
+                _session->socket().shutdown();
+            }
+            catch (const Poco::Exception&)
+            {
+                // The connection is already closed.
+            }
+        }
+
+        std::mutex _mutex;
+        Poco::Net::HTTPClientSession* _session = nullptr;
+
+        /// \brief Destroyed first, which waits for a running callback.
+        std::unique_ptr<CancellationToken::Callback> _callback;
+
+    };
+
+    /// \returns the first byte of a Content-Range header, or -1.
+    static std::int64_t parseContentRangeStart(const std::string& contentRange);
+
     HTTP::ClientSessionSettings _settings;
 
+    /// \brief The directory of partial downloads, or empty.
+    std::string _partialDownloadPath;
+
 };
 
 
@@ -52,9 +210,35 @@ BaseReadableHTTPStore<KeyType, ValueType>::~BaseReadableHTTPStore()
 }
 
 
+template<typename KeyType, typename ValueType>
+void BaseReadableHTTPStore<KeyType, ValueType>::setPartialDownloadPath(const std::string& path)
+{
+    _partialDownloadPath = path.empty() ? path : ofToDataPath(path, true);
+
+    if (!_partialDownloadPath.empty())
+    {
+        ofDirectory::createDirectory(_partialDownloadPath, false, true);
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+std::string BaseReadableHTTPStore<KeyType, ValueType>::partialDownloadPath() const
+{
+    return _partialDownloadPath;
+}
+
+
 template<typename KeyType, typename ValueType>
 bool BaseReadableHTTPStore<KeyType, ValueType>::doHas(const KeyType& key) const
 {
+    if (!this->mightContain(key))
+    {
+        return false;
+    }
+
+    CancellationToken::throwIfCurrentCancelled();
+
     HTTP::Client client;
     HTTP::Context context(_settings);
     HTTP::HeadRequest request(this->keyToURI(key));
@@ -67,13 +251,223 @@ bool BaseReadableHTTPStore<KeyType, ValueType>::doHas(const KeyType& key) const
 template<typename KeyType, typename ValueType>
 std::shared_ptr<ValueType> BaseReadableHTTPStore<KeyType, ValueType>::doGet(const KeyType& key)
 {
+    if (!this->mightContain(key))
+    {
+        return nullptr;
+    }
+
+    if (!_partialDownloadPath.empty())
+    {
+        return doGetResumable(this->keyToURI(key));
+    }
+
     HTTP::Client client;
     HTTP::Context context(_settings);
     HTTP::GetRequest request(this->keyToURI(key));
+    SessionAborter aborter;
     auto response = client.execute(context, request);
+
+    aborter.watch(context.clientSession());
+    CancellationToken::throwIfCurrentCancelled();
+
     HTTP::ClientExchange transaction(context, request, *response.get());
     return this->rawToValue(transaction);
 }
 
 
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> BaseReadableHTTPStore<KeyType, ValueType>::bufferToValue(ofBuffer&)
+{
+    ofLogError("BaseReadableHTTPStore::bufferToValue") << "Resumable downloads require bufferToValue().";
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> BaseReadableHTTPStore<KeyType, ValueType>::doGetResumable(const std::string& uri)
+{
+    PartialDownload partial = loadPartialDownload(uri);
+
+    // A second attempt starts over if the partial file can't be resumed.
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        CancellationToken::throwIfCurrentCancelled();
+
+        std::string validator = partial.validator();
+        bool isResuming = partial.bytes > 0 && !validator.empty();
+
+        HTTP::Client client;
+        HTTP::Context context(_settings);
+        HTTP::GetRequest request(uri);
+
+        if (isResuming)
+        {
+            request.set("Range", "bytes=" + ofToString(partial.bytes) + "-");
+            request.set("If-Range", validator);
+        }
+
+        SessionAborter aborter;
+        auto response = client.execute(context, request);
+
+        aborter.watch(context.clientSession());
+        CancellationToken::throwIfCurrentCancelled();
+
+        bool isAppending = false;
+
+        if (response->getStatus() == HTTP::Response::HTTP_PARTIAL_CONTENT
+         && isResuming
+         && parseContentRangeStart(response->get("Content-Range", "")) == static_cast<std::int64_t>(partial.bytes))
+        {
+            isAppending = true;
+        }
+        else if (response->getStatus() != HTTP::Response::HTTP_OK)
+        {
+            HTTP::HTTPUtils::consume(response->stream());
+
+            if (isResuming)
+            {
+                removePartialDownload(partial);
+                continue;
+            }
+
+            throw Poco::IOException("Unexpected HTTP status " + ofToString(response->getStatus()) + " for " + uri);
+        }
+
+        // A full response replaces the validators, a partial one keeps them.
+        if (!isAppending)
+        {
+            partial.bytes = 0;
+            partial.entityTag = response->get("ETag", "");
+            partial.lastModified = response->get("Last-Modified", "");
+        }
+
+        ofJson metadata;
+        metadata["uri"] = uri;
+        metadata["entityTag"] = partial.entityTag;
+        metadata["lastModified"] = partial.lastModified;
+
+        if (!ofSaveJson(partial.metadataPath, metadata))
+        {
+            ofLogError("BaseReadableHTTPStore::doGetResumable") << "Unable to save " << partial.metadataPath;
+        }
+
+        std::istream& body = response->stream();
+        std::uint64_t received = 0;
+
+        {
+            std::ofstream stream(partial.path, std::ios::binary | (isAppending ? std::ios::app : std::ios::trunc));
+            std::vector<char> chunk(DOWNLOAD_CHUNK_SIZE);
+
+            // Every received byte is written, so an interrupted download
+            // keeps its progress.
+            while (body.read(chunk.data(), chunk.size()) || body.gcount() > 0)
+            {
+                stream.write(chunk.data(), body.gcount());
+                received += static_cast<std::uint64_t>(body.gcount());
+            }
+
+            if (!stream)
+            {
+                throw Poco::IOException("Unable to write " + partial.path);
+            }
+        }
+
+        partial.bytes += received;
+
+        CancellationToken::throwIfCurrentCancelled();
+
+        std::int64_t contentLength = response->getContentLength64();
+
+        if (body.bad()
+         || (contentLength != HTTP::Response::UNKNOWN_CONTENT_LENGTH
+          && received != static_cast<std::uint64_t>(contentLength)))
+        {
+            throw Poco::IOException("Download of " + uri + " was interrupted.");
+        }
+
+        ofBuffer buffer = ofBufferFromFile(partial.path, true);
+        removePartialDownload(partial);
+        return bufferToValue(buffer);
+    }
+
+    throw Poco::IOException("Unable to resume the download of " + uri);
+}
+
+
+template<typename KeyType, typename ValueType>
+typename BaseReadableHTTPStore<KeyType, ValueType>::PartialDownload BaseReadableHTTPStore<KeyType, ValueType>::loadPartialDownload(const std::string& uri) const
+{
+    PartialDownload partial;
+
+    std::string name = hashToString(KeyHash<std::string>::hash(uri));
+    partial.path = ofFilePath::join(_partialDownloadPath, name + ".part");
+    partial.metadataPath = partial.path + ".json";
+
+    ofFile file(partial.path);
+
+    if (!file.exists())
+    {
+        return partial;
+    }
+
+    ofJson metadata = ofLoadJson(partial.metadataPath);
+
+    // Without validators the partial file can't be trusted.
+    if (!metadata.is_object() || metadata.value("uri", "") != uri)
+    {
+        return partial;
+    }
+
+    partial.bytes = file.getSize();
+    partial.entityTag = metadata.value("entityTag", "");
+    partial.lastModified = metadata.value("lastModified", "");
+    return partial;
+}
+
+
+template<typename KeyType, typename ValueType>
+void BaseReadableHTTPStore<KeyType, ValueType>::removePartialDownload(PartialDownload& partial)
+{
+    ofFile::removeFile(partial.path, false);
+    ofFile::removeFile(partial.metadataPath, false);
+    partial.bytes = 0;
+    partial.entityTag.clear();
+    partial.lastModified.clear();
+}
+
+
+template<typename KeyType, typename ValueType>
+std::int64_t BaseReadableHTTPStore<KeyType, ValueType>::parseContentRangeStart(const std::string& contentRange)
+{
+    // e.g. "bytes 1000-4999/5000"
+    const std::string prefix = "bytes ";
+
+    if (contentRange.compare(0, prefix.size(), prefix) != 0)
+    {
+        return -1;
+    }
+
+    std::size_t end = contentRange.find('-', prefix.size());
+
+    if (end == std::string::npos || end == prefix.size())
+    {
+        return -1;
+    }
+
+    std::int64_t start = 0;
+
+    for (std::size_t i = prefix.size(); i < end; ++i)
+    {
+        if (contentRange[i] < '0' || contentRange[i] > '9')
+        {
+            return -1;
+        }
+
+        start = start * 10 + (contentRange[i] - '0');
+    }
+
+    return start;
+}
+
+
 } } // namespace ofx::Cache
@@ -9,6 +9,7 @@
 
 
 #include "ofEvents.h"
+#include "ofx/Cache/KeyTraits.h"
 
 
 namespace ofx {
@@ -26,6 +27,9 @@ template<typename KeyType, typename ValueType>
 class BaseReadableStore
 {
 public:
+    /// \brief The type used to look up keys without constructing them.
+    typedef typename KeyTraits<KeyType>::LookupType LookupType;
+
     /// \brief Destroy the BaseStore.
     virtual ~BaseReadableStore()
     {
@@ -46,6 +50,32 @@ public:
     /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
     virtual std::shared_ptr<ValueType> get(const KeyType& key);
 
+    /// \brief Determine if the given value is available without
+    /// constructing a key.
+    ///
+    /// Only available if KeyTraits<KeyType> defines a lookup type, e.g. for
+    /// std::string keys checked with a string literal or std::string_view.
+    ///
+    /// \param key The key to check.
+    /// \returns true if this cache node has the requested value.
+    template<typename LookupKey, typename std::enable_if<IsLookupKey<KeyType, LookupKey>::value, int>::type = 0>
+    bool has(const LookupKey& key) const
+    {
+        return lookupHas(LookupType(key));
+    }
+
+    /// \brief Get a value without constructing a key.
+    ///
+    /// Only available if KeyTraits<KeyType> defines a lookup type.
+    ///
+    /// \param key The key to get.
+    /// \returns std::shared_ptr<ValueType> or nullptr if the cache missed.
+    template<typename LookupKey, typename std::enable_if<IsLookupKey<KeyType, LookupKey>::value, int>::type = 0>
+    std::shared_ptr<ValueType> get(const LookupKey& key)
+    {
+        return lookupGet(LookupType(key));
+    }
+
     /// \brief Event called when has is called.
     mutable ofEvent<const KeyType> onHas;
 
@@ -56,6 +86,23 @@ protected:
     virtual bool doHas(const KeyType& key) const = 0;
     virtual std::shared_ptr<ValueType> doGet(const KeyType& key) = 0;
 
+    /// \brief Implements has() for lookup keys.
+    ///
+    /// The default constructs a key. Stores that can search by LookupType
+    /// override this to avoid the allocation.
+    virtual bool lookupHas(LookupType key) const
+    {
+        return has(KeyTraits<KeyType>::toKey(key));
+    }
+
+    /// \brief Implements get() for lookup keys.
+    ///
+    /// The default constructs a key.
+    virtual std::shared_ptr<ValueType> lookupGet(LookupType key)
+    {
+        return get(KeyTraits<KeyType>::toKey(key));
+    }
+
 };
 
 
@@ -100,7 +147,7 @@ public:
     ///
     /// \param key The key to cache.
     /// \param entry The value to cache.
-    void add(const KeyType& key, std::shared_ptr<ValueType> entry);
+    virtual void add(const KeyType& key, std::shared_ptr<ValueType> entry);
 
     /// \copydoc add()
     void add(const KeyType& key, const ValueType& entry);
@@ -114,7 +161,7 @@ public:
     ///
     /// \param key The key to cache.
     /// \param entry The value to cache.
-    void update(const KeyType& key, std::shared_ptr<ValueType> entry);
+    virtual void update(const KeyType& key, std::shared_ptr<ValueType> entry);
 
     /// \copydoc update()
     void update(const KeyType& key, const ValueType& entry);
@@ -129,7 +176,7 @@ public:
     /// By default the put operation is synchronous.
     ///
     /// \param key The key to remove.
-    void remove(const KeyType& key);
+    virtual void remove(const KeyType& key);
 
     /// \brief Event called when an value is added.
     ofEvent<const std::pair<KeyType, std::shared_ptr<ValueType>>> onAdd;
@@ -150,6 +197,14 @@ protected:
 
     virtual void doRemove(const KeyType& key) = 0;
 
+    /// \brief Copy a value added by const reference.
+    ///
+    /// Stores with their own allocator override this.
+    virtual std::shared_ptr<ValueType> makeEntry(const ValueType& entry) const
+    {
+        return std::make_shared<ValueType>(entry);
+    }
+
 };
 
 
@@ -167,7 +222,7 @@ template<typename KeyType, typename ValueType>
 void BaseWritableStore<KeyType, ValueType>::add(const KeyType& key,
                                                 const ValueType& entry)
 {
-    add(key, std::make_shared<ValueType>(entry));
+    add(key, makeEntry(entry));
 }
 
 
@@ -194,7 +249,7 @@ template<typename KeyType, typename ValueType>
 void BaseWritableStore<KeyType, ValueType>::update(const KeyType& key,
                                                    const ValueType& entry)
 {
-    update(key, std::make_shared<ValueType>(entry));
+    update(key, makeEntry(entry));
 }
 
 
@@ -8,13 +8,22 @@
 #pragma once
 
 
+#include <memory>
+#include <vector>
 #include "ofx/Cache/BaseStore.h"
+#include "ofx/Cache/HashedKey.h"
+#include "ofx/Cache/MembershipFilter.h"
 
 
 namespace ofx {
 namespace Cache {
 
 
+/// \brief A store whose values are accessed by URI.
+///
+/// URI stores are usually slow, so they can be given a membership filter,
+/// see BaseMembershipFilter. Keys the filter rules out are answered as
+/// misses without any I/O.
 template<typename KeyType>
 class BaseURIStore
 {
@@ -28,6 +37,87 @@ public:
     /// \returns a URI to access the value.
     virtual std::string keyToURI(const KeyType& key) const = 0;
 
+    /// \brief Set the membership filter of the store.
+    ///
+    /// The filter must contain every key present in the store, see
+    /// buildMembershipFilter(). The store keeps it up to date as values are
+    /// added and, if the filter supports it, removed. The filter should be
+    /// set before the store is shared between threads.
+    ///
+    /// \param filter The filter, or nullptr to always check the URI.
+    void setMembershipFilter(std::shared_ptr<BaseMembershipFilter> filter)
+    {
+        _membershipFilter = filter;
+    }
+
+    /// \brief Fill a filter with the keys present in the store and set it.
+    /// \param filter The filter, which is cleared first.
+    /// \param keys The keys present in the store, e.g. from a manifest.
+    void buildMembershipFilter(std::shared_ptr<BaseMembershipFilter> filter,
+                               const std::vector<KeyType>& keys)
+    {
+        filter->clear();
+
+        for (const auto& key: keys)
+        {
+            filter->insert(memberHash(key));
+        }
+
+        setMembershipFilter(filter);
+    }
+
+    /// \returns the membership filter or nullptr if there is none.
+    std::shared_ptr<BaseMembershipFilter> membershipFilter() const
+    {
+        return _membershipFilter;
+    }
+
+protected:
+    /// \returns false if the filter rules the key out.
+    bool mightContain(const KeyType& key) const
+    {
+        return _membershipFilter == nullptr
+            || _membershipFilter->mightContain(memberHash(key));
+    }
+
+    /// \brief Record a key that was added to the store.
+    void insertMember(const KeyType& key)
+    {
+        if (_membershipFilter != nullptr)
+        {
+            _membershipFilter->insert(memberHash(key));
+        }
+    }
+
+    /// \brief Record a key that was removed from the store.
+    void removeMember(const KeyType& key)
+    {
+        if (_membershipFilter != nullptr)
+        {
+            _membershipFilter->remove(memberHash(key));
+        }
+    }
+
+    /// \returns the hash a key is recorded by in the filter. Keys that
+    /// KeyHash doesn't support are recorded by the hash of their URI.
+    std::uint64_t memberHash(const KeyType& key) const
+    {
+        return memberHash(key, IsKeyHashable<KeyType>());
+    }
+
+private:
+    std::uint64_t memberHash(const KeyType& key, std::true_type) const
+    {
+        return KeyHash<KeyType>::hash(key);
+    }
+
+    std::uint64_t memberHash(const KeyType& key, std::false_type) const
+    {
+        return KeyHash<std::string>::hash(keyToURI(key));
+    }
+
+    std::shared_ptr<BaseMembershipFilter> _membershipFilter = nullptr;
+
 };
 
 
@@ -0,0 +1,135 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include "ofJson.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A snapshot of the counters of one or more cache nodes.
+class CacheStatistics
+{
+public:
+    /// \brief The number of gets answered by the node.
+    uint64_t hits = 0;
+
+    /// \brief The number of gets the node could not answer itself.
+    uint64_t misses = 0;
+
+    /// \brief The number of values loaded from a resource.
+    uint64_t loads = 0;
+
+    /// \brief The number of loads that failed.
+    uint64_t loadFailures = 0;
+
+    /// \brief The number of values evicted to make room for others.
+    uint64_t evictions = 0;
+
+    /// \brief The number of value bytes currently held.
+    uint64_t bytes = 0;
+
+    /// \brief The number of child values copied into the node.
+    uint64_t promotions = 0;
+
+    /// \returns the fraction of gets that hit.
+    double hitRatio() const
+    {
+        return (hits + misses) > 0 ? double(hits) / double(hits + misses) : 0;
+    }
+
+    /// \brief Add the counters of another snapshot to this one.
+    /// \param other The snapshot to add.
+    /// \returns this snapshot.
+    CacheStatistics& operator += (const CacheStatistics& other)
+    {
+        hits += other.hits;
+        misses += other.misses;
+        loads += other.loads;
+        loadFailures += other.loadFailures;
+        evictions += other.evictions;
+        bytes += other.bytes;
+        promotions += other.promotions;
+        return *this;
+    }
+
+    /// \returns the snapshot as JSON.
+    ofJson toJson() const
+    {
+        ofJson json;
+        json["hits"] = hits;
+        json["misses"] = misses;
+        json["loads"] = loads;
+        json["loadFailures"] = loadFailures;
+        json["evictions"] = evictions;
+        json["bytes"] = bytes;
+        json["promotions"] = promotions;
+        json["hitRatio"] = hitRatio();
+        return json;
+    }
+
+};
+
+
+/// \brief The live counters of a cache node.
+///
+/// Counters are relaxed atomics. They are cheap enough to update on every
+/// operation, but a snapshot taken while other threads are running is not
+/// guaranteed to be consistent across counters.
+class CacheCounters
+{
+public:
+    /// \returns a snapshot of the counters.
+    CacheStatistics snapshot() const
+    {
+        CacheStatistics statistics;
+        statistics.hits = hits.load(std::memory_order_relaxed);
+        statistics.misses = misses.load(std::memory_order_relaxed);
+        statistics.loads = loads.load(std::memory_order_relaxed);
+        statistics.loadFailures = loadFailures.load(std::memory_order_relaxed);
+        statistics.evictions = evictions.load(std::memory_order_relaxed);
+        statistics.bytes = bytes.load(std::memory_order_relaxed);
+        statistics.promotions = promotions.load(std::memory_order_relaxed);
+        return statistics;
+    }
+
+    /// \brief Reset all counters except bytes, which tracks live data.
+    void reset()
+    {
+        hits.store(0, std::memory_order_relaxed);
+        misses.store(0, std::memory_order_relaxed);
+        loads.store(0, std::memory_order_relaxed);
+        loadFailures.store(0, std::memory_order_relaxed);
+        evictions.store(0, std::memory_order_relaxed);
+        promotions.store(0, std::memory_order_relaxed);
+    }
+
+    /// \brief Increment a counter.
+    /// \param counter The counter to increment.
+    static void increment(std::atomic<uint64_t>& counter)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> hits { 0 };
+    std::atomic<uint64_t> misses { 0 };
+    std::atomic<uint64_t> loads { 0 };
+    std::atomic<uint64_t> loadFailures { 0 };
+    std::atomic<uint64_t> evictions { 0 };
+    std::atomic<uint64_t> bytes { 0 };
+    std::atomic<uint64_t> promotions { 0 };
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,194 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "Poco/Exception.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Signals that a running request should stop.
+///
+/// Copies share their state, so a token can be handed to the code doing the
+/// work while its owner keeps a copy to cancel it. Long reads poll
+/// isCancelled() between chunks. Reads that block, e.g. on a socket, register
+/// a callback that unblocks them, e.g. by aborting the connection.
+///
+/// CacheRequestTask makes its token current() on the worker thread while
+/// loading, so stores can check it without changing their interface.
+class CancellationToken
+{
+    struct State;
+
+public:
+    /// \brief Makes a token current() on this thread while in scope.
+    class Scope
+    {
+    public:
+        /// \brief Make the token current.
+        /// \param token The token, which must outlive the Scope.
+        explicit Scope(const CancellationToken& token): _previous(currentPointer())
+        {
+            currentPointer() = &token;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+
+        /// \brief Restore the previously current token.
+        ~Scope()
+        {
+            currentPointer() = _previous;
+        }
+
+    private:
+        const CancellationToken* _previous = nullptr;
+
+    };
+
+    /// \brief Unregisters a callback when destroyed.
+    class Callback
+    {
+    public:
+        /// \brief Register a callback.
+        ///
+        /// If the token is already cancelled the callback is called now.
+        ///
+        /// \param token The token to watch.
+        /// \param callback The function called when the token is cancelled.
+        Callback(const CancellationToken& token, std::function<void()> callback):
+            _state(token._state)
+        {
+            std::unique_lock<std::mutex> lock(_state->mutex);
+
+            if (_state->isCancelled)
+            {
+                lock.unlock();
+                callback();
+            }
+            else
+            {
+                _id = _state->nextCallbackId++;
+                _state->callbacks[_id] = callback;
+            }
+        }
+
+        Callback(const Callback&) = delete;
+        Callback& operator = (const Callback&) = delete;
+
+        /// \brief Unregister the callback.
+        ///
+        /// If the callback is running on another thread, this waits for it
+        /// to return, so anything it uses may be destroyed afterwards.
+        ~Callback()
+        {
+            std::unique_lock<std::mutex> lock(_state->mutex);
+            _state->callbacks.erase(_id);
+        }
+
+    private:
+        std::shared_ptr<State> _state;
+        std::size_t _id = 0;
+
+    };
+
+    /// \brief Create a token that is not cancelled.
+    CancellationToken(): _state(std::make_shared<State>())
+    {
+    }
+
+    /// \brief Cancel the token and call the registered callbacks.
+    ///
+    /// Callbacks are called on this thread and must not use the token.
+    void cancel()
+    {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+
+        if (_state->isCancelled)
+        {
+            return;
+        }
+
+        _state->isCancelled = true;
+
+        for (auto& callback: _state->callbacks)
+        {
+            callback.second();
+        }
+
+        _state->callbacks.clear();
+    }
+
+    /// \returns true if the token was cancelled.
+    bool isCancelled() const
+    {
+        return _state->isCancelled;
+    }
+
+    /// \throws Poco::IOException if the token was cancelled.
+    void throwIfCancelled() const
+    {
+        if (isCancelled())
+        {
+            throw Poco::IOException("Request cancelled.");
+        }
+    }
+
+    /// \returns the token of the request running on this thread, or nullptr.
+    static const CancellationToken* current()
+    {
+        return currentPointer();
+    }
+
+    /// \returns true if the request running on this thread was cancelled.
+    static bool isCurrentCancelled()
+    {
+        const CancellationToken* token = current();
+        return token != nullptr && token->isCancelled();
+    }
+
+    /// \throws Poco::IOException if the request running on this thread was
+    /// cancelled.
+    static void throwIfCurrentCancelled()
+    {
+        if (isCurrentCancelled())
+        {
+            throw Poco::IOException("Request cancelled.");
+        }
+    }
+
+private:
+    struct State
+    {
+        std::atomic<bool> isCancelled { false };
+        std::map<std::size_t, std::function<void()>> callbacks;
+        std::size_t nextCallbackId = 1;
+        std::mutex mutex;
+    };
+
+    static const CancellationToken*& currentPointer()
+    {
+        static thread_local const CancellationToken* token = nullptr;
+        return token;
+    }
+
+    std::shared_ptr<State> _state;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,321 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <tuple>
+#include <type_traits>
+#include "ofx/Cache/BaseCache.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Deduces the key and value types of a store.
+/// \tparam StoreType A type derived from BaseReadableStore.
+template<typename StoreType>
+struct StoreTraits
+{
+    template<typename K, typename V>
+    static K key(const BaseReadableStore<K, V>*);
+
+    template<typename K, typename V>
+    static V value(const BaseReadableStore<K, V>*);
+
+    /// \brief The key type of the store.
+    typedef decltype(key(static_cast<const StoreType*>(nullptr))) KeyType;
+
+    /// \brief The value type of the store.
+    typedef decltype(value(static_cast<const StoreType*>(nullptr))) ValueType;
+};
+
+
+/// \brief A tier of a Cascade.
+///
+/// Exposes the protected operations of a store as qualified, non-virtual
+/// calls. The class is final, so calls made through it can be inlined.
+///
+/// \tparam Tier The store type.
+template<typename Tier>
+class CascadeTier final: public Tier
+{
+public:
+    typedef typename StoreTraits<Tier>::KeyType TierKeyType;
+    typedef typename StoreTraits<Tier>::ValueType TierValueType;
+
+    using Tier::Tier;
+
+    std::shared_ptr<TierValueType> tierGet(const TierKeyType& key)
+    {
+        return Tier::doGet(key);
+    }
+
+    bool tierHas(const TierKeyType& key) const
+    {
+        return Tier::doHas(key);
+    }
+
+    void tierAdd(const TierKeyType& key, std::shared_ptr<TierValueType> entry)
+    {
+        Tier::doAdd(key, entry);
+    }
+
+    void tierRemove(const TierKeyType& key)
+    {
+        Tier::doRemove(key);
+    }
+
+    std::size_t tierSize()
+    {
+        return Tier::doSize();
+    }
+
+    void tierClear()
+    {
+        Tier::doClear();
+    }
+
+};
+
+
+/// \brief A cascade of cache tiers composed at compile time.
+///
+/// Unlike cache nodes chained with BaseCache::setChild(), the tiers of a
+/// Cascade are stored by value and looked up with direct calls, without
+/// events, listeners or virtual dispatch between tiers, e.g.
+///
+///     Cascade<LRUMemoryCache<std::string, ofBuffer>, MyDiskCache> cache;
+///
+/// A value found in a lower tier is added to all tiers above it, subject to
+/// the promotion policy of the cascade. Adds go to the first tier, removes
+/// and clears affect every tier.
+///
+/// The cascade is itself a BaseCache, so it can be used anywhere a cache
+/// node is expected, including as the child of another node. Its events,
+/// counters and latency histograms describe the cascade as a whole.
+///
+/// \tparam Tiers The tier types, fastest first. All tiers must share the
+/// same key and value types and have protected or public do* methods.
+template<typename... Tiers>
+class Cascade: public BaseCache<typename StoreTraits<typename std::tuple_element<0, std::tuple<Tiers...>>::type>::KeyType,
+                                typename StoreTraits<typename std::tuple_element<0, std::tuple<Tiers...>>::type>::ValueType>
+{
+public:
+    typedef typename StoreTraits<typename std::tuple_element<0, std::tuple<Tiers...>>::type>::KeyType KeyType;
+    typedef typename StoreTraits<typename std::tuple_element<0, std::tuple<Tiers...>>::type>::ValueType ValueType;
+
+    /// \brief Create a Cascade with default constructed tiers.
+    Cascade()
+    {
+    }
+
+    /// \brief Create a Cascade, constructing each tier from one argument.
+    /// \param args One constructor argument per tier.
+    template<typename... Args,
+             typename std::enable_if<sizeof...(Args) == sizeof...(Tiers) && (sizeof...(Args) > 0), int>::type = 0>
+    Cascade(Args&&... args): _tiers(std::forward<Args>(args)...)
+    {
+    }
+
+    /// \brief Destroy the Cascade.
+    virtual ~Cascade()
+    {
+        this->stopWriteBehind();
+    }
+
+    /// \returns the tier at the given index.
+    template<std::size_t Index>
+    typename std::tuple_element<Index, std::tuple<Tiers...>>::type& tier()
+    {
+        return std::get<Index>(_tiers);
+    }
+
+    /// \returns the number of tiers.
+    static constexpr std::size_t tierCount()
+    {
+        return sizeof...(Tiers);
+    }
+
+    /// \returns the counters of the cascade, including the bytes and
+    /// evictions of its tiers.
+    CacheStatistics statistics() const override
+    {
+        auto result = BaseCache<KeyType, ValueType>::statistics();
+        addTierStatistics<0>(result);
+        return result;
+    }
+
+protected:
+    bool doHas(const KeyType& key) const override
+    {
+        return hasIn<0>(key);
+    }
+
+    std::shared_ptr<ValueType> doGet(const KeyType& key) override
+    {
+        return doGetLocal(key, true);
+    }
+
+    std::shared_ptr<ValueType> doGetLocal(const KeyType& key, bool promote) override
+    {
+        std::size_t foundTier = 0;
+        auto result = getFrom<0>(key, foundTier);
+
+        if (result != nullptr && foundTier > 0 && promote && this->shouldPromote(key))
+        {
+            CacheCounters::increment(this->_counters.promotions);
+            promoteTo<0>(key, result, foundTier);
+        }
+
+        return result;
+    }
+
+    void doAdd(const KeyType& key, std::shared_ptr<ValueType> entry) override
+    {
+        std::get<0>(_tiers).tierAdd(key, entry);
+    }
+
+    void doRemove(const KeyType& key) override
+    {
+        removeFrom<0>(key);
+    }
+
+    /// \returns the number of values in the first tier.
+    std::size_t doSize() override
+    {
+        return std::get<0>(_tiers).tierSize();
+    }
+
+    void doClear() override
+    {
+        clearFrom<0>();
+    }
+
+private:
+    template<typename... Rest>
+    struct AreCompatible: std::true_type
+    {
+    };
+
+    template<typename Tier, typename... Rest>
+    struct AreCompatible<Tier, Rest...>: std::integral_constant<bool,
+        std::is_same<typename StoreTraits<Tier>::KeyType, KeyType>::value
+     && std::is_same<typename StoreTraits<Tier>::ValueType, ValueType>::value
+     && AreCompatible<Rest...>::value>
+    {
+    };
+
+    static_assert(AreCompatible<Tiers...>::value, "All tiers must have the same KeyType and ValueType.");
+
+    template<std::size_t Index>
+    using IsTier = std::integral_constant<bool, (Index < sizeof...(Tiers))>;
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value, std::shared_ptr<ValueType>>::type
+    getFrom(const KeyType& key, std::size_t& foundTier)
+    {
+        auto result = std::get<Index>(_tiers).tierGet(key);
+
+        if (result != nullptr)
+        {
+            foundTier = Index;
+            return result;
+        }
+
+        return getFrom<Index + 1>(key, foundTier);
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value, std::shared_ptr<ValueType>>::type
+    getFrom(const KeyType&, std::size_t&)
+    {
+        return nullptr;
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value, bool>::type
+    hasIn(const KeyType& key) const
+    {
+        return std::get<Index>(_tiers).tierHas(key) || hasIn<Index + 1>(key);
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value, bool>::type
+    hasIn(const KeyType&) const
+    {
+        return false;
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value>::type
+    promoteTo(const KeyType& key, std::shared_ptr<ValueType> entry, std::size_t foundTier)
+    {
+        if (Index < foundTier)
+        {
+            std::get<Index>(_tiers).tierAdd(key, entry);
+            promoteTo<Index + 1>(key, entry, foundTier);
+        }
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value>::type
+    promoteTo(const KeyType&, std::shared_ptr<ValueType>, std::size_t)
+    {
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value>::type
+    removeFrom(const KeyType& key)
+    {
+        std::get<Index>(_tiers).tierRemove(key);
+        removeFrom<Index + 1>(key);
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value>::type
+    removeFrom(const KeyType&)
+    {
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value>::type
+    clearFrom()
+    {
+        std::get<Index>(_tiers).tierClear();
+        clearFrom<Index + 1>();
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value>::type
+    clearFrom()
+    {
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<IsTier<Index>::value>::type
+    addTierStatistics(CacheStatistics& result) const
+    {
+        auto tierStatistics = std::get<Index>(_tiers).statistics();
+        result.evictions += tierStatistics.evictions;
+        result.bytes += tierStatistics.bytes;
+        addTierStatistics<Index + 1>(result);
+    }
+
+    template<std::size_t Index>
+    typename std::enable_if<!IsTier<Index>::value>::type
+    addTierStatistics(CacheStatistics&) const
+    {
+    }
+
+    std::tuple<CascadeTier<Tiers>...> _tiers;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,831 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ofFileUtils.h"
+#include "ofLog.h"
+#include "ofx/Cache/BaseCache.h"
+#include "ofx/Cache/ContentHash.h"
+#include "ofx/Cache/HashedKey.h"
+#include "ofx/Cache/KeySerializer.h"
+#include "ofx/Cache/ValueSize.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A cache node that stores identical values once.
+///
+/// Keys map to content hashes and each distinct value (a "blob") is stored
+/// once, no matter how many keys resolve to it, e.g. several URLs of the same
+/// image. Blobs are reference counted by their keys and dropped when their
+/// last key is removed. Contents are hashed and compared with
+/// ContentHash<ValueType>, sizes are estimated with ValueSize<ValueType>.
+///
+/// The optional child node stores the blobs, keyed by the string form of
+/// their hash (see hashToString()), so a file store below this node keeps one
+/// file per distinct value. With WritePolicy::WRITE_THROUGH or
+/// WritePolicy::WRITE_BEHIND each blob is written to the child once, and
+/// removed from it with its last key. A blob counts as stored once the child
+/// has it after the write, so blobs whose write failed stay in memory and are
+/// written again with their next add.
+///
+/// Blobs are held in memory until they are written to the child. After that
+/// the node only keeps a weak reference: a blob is shared by all of its keys
+/// while in use and reloaded from the child otherwise. Place an
+/// LRUMemoryCache above this node to keep values resident; because gets
+/// return the shared blob, its entries share memory too.
+///
+/// The index of keys can be saved with saveIndex() and restored with
+/// loadIndex(), e.g. after a restart, so blobs in the child stay reachable.
+///
+/// Values are matched by their contents, not only by their hash. Blobs that
+/// are not in memory are read from the child to compare them.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+template<typename KeyType, typename ValueType>
+class ContentAddressedCache: public BaseCache<KeyType, ValueType, std::string, ValueType>
+{
+public:
+    typedef typename BaseCache<KeyType, ValueType, std::string, ValueType>::ChildStore ChildStore;
+
+    /// \brief Create a ContentAddressedCache.
+    /// \param childStore The node storing the blobs, or nullptr.
+    ContentAddressedCache(std::unique_ptr<ChildStore> childStore = nullptr);
+
+    /// \brief Destroy the ContentAddressedCache.
+    virtual ~ContentAddressedCache();
+
+    using BaseCache<KeyType, ValueType, std::string, ValueType>::get;
+
+    /// \brief Get a value by its key.
+    ///
+    /// Keys that are not in the index miss without asking the child.
+    ///
+    /// \param key The key to get.
+    /// \param promote False to leave child values in the child nodes.
+    /// \returns the shared value or nullptr if the cache missed.
+    std::shared_ptr<ValueType> get(const KeyType& key, bool promote) override;
+
+    /// \returns the number of distinct values.
+    std::size_t uniqueCount() const;
+
+    /// \returns the estimated bytes of the distinct values.
+    uint64_t uniqueBytes() const;
+
+    /// \returns the estimated bytes of the values of all keys, as they would
+    /// be stored without deduplication.
+    uint64_t logicalBytes() const;
+
+    /// \returns the estimated bytes saved by deduplication.
+    uint64_t deduplicatedBytes() const;
+
+    /// \brief Save the index of the blobs in the child node.
+    ///
+    /// Keys are written with KeySerializer<KeyType>. Keys of blobs that were
+    /// not written to the child are skipped.
+    ///
+    /// \param path The path of the index file.
+    /// \returns true if the file was written.
+    bool saveIndex(const std::string& path) const;
+
+    /// \brief Replace the index with one saved by saveIndex().
+    ///
+    /// Values are not read, they are loaded from the child when requested.
+    /// Blobs of the replaced index are not removed from the child.
+    ///
+    /// \param path The path of the index file.
+    /// \returns true if the index was loaded.
+    bool loadIndex(const std::string& path);
+
+protected:
+    bool doHas(const KeyType& key) const override;
+    std::shared_ptr<ValueType> doGet(const KeyType& key) override;
+    void doAdd(const KeyType& key, std::shared_ptr<ValueType> entry) override;
+    void doRemove(const KeyType& key) override;
+    std::size_t doSize() override;
+    void doClear() override;
+
+    std::string toChildKey(const KeyType& key) const override;
+
+    std::shared_ptr<ValueType> fromChildValue(const KeyType& key,
+                                              std::shared_ptr<ValueType> value) const override;
+
+    std::shared_ptr<ValueType> toChildValue(const KeyType& key,
+                                            std::shared_ptr<ValueType> value) const override;
+
+    void doOnChildWritten(const KeyType& key, const std::string& childKey) override;
+
+    /// \brief A distinct value and the keys referring to it.
+    struct Blob
+    {
+        /// \brief The content hash, which is also the id unless it collided.
+        std::uint64_t hash = 0;
+        /// \brief The estimated size of the value.
+        std::size_t bytes = 0;
+        /// \brief The number of keys referring to the blob.
+        std::size_t references = 0;
+        /// \brief True once the child confirmed the write of the blob.
+        bool isStored = false;
+        /// \brief The value, held until it is written to the child.
+        std::shared_ptr<ValueType> value;
+        /// \brief The value, while it is in use after being stored.
+        std::weak_ptr<ValueType> weakValue;
+    };
+
+    typedef std::unordered_map<std::uint64_t, Blob> BlobMap;
+
+    /// \returns the value of the blob if it is in memory, or nullptr.
+    static std::shared_ptr<ValueType> residentValue(const Blob& blob);
+
+    /// \brief Keep a value of a blob in memory according to its state.
+    static void setResidentValue(Blob& blob, std::shared_ptr<ValueType> value);
+
+    /// \brief Find the blob with the same contents as a value.
+    ///
+    /// Blobs in memory are compared with the value. Blobs of the same hash
+    /// and size that are only in the child can't be compared yet and are
+    /// returned as unverified, see readFromChild().
+    ///
+    /// The mutex must be held by the caller.
+    ///
+    /// \param hash The content hash of the value.
+    /// \param bytes The estimated size of the value.
+    /// \param value The value.
+    /// \param unreadable The ids of blobs the child couldn't return.
+    /// \param unverified The ids of blobs to read from the child.
+    /// \returns the blob or end().
+    typename BlobMap::iterator findBlobLocked(std::uint64_t hash,
+                                              std::size_t bytes,
+                                              const ValueType& value,
+                                              const std::set<std::uint64_t>& unreadable,
+                                              std::vector<std::uint64_t>& unverified);
+
+    /// \brief Read blobs from the child node.
+    ///
+    /// The mutex must not be held, reads may be slow.
+    ///
+    /// \param ids The ids of the blobs.
+    /// \returns the values, or nullptr for blobs the child doesn't have.
+    std::vector<std::shared_ptr<ValueType>> readFromChild(const std::vector<std::uint64_t>& ids) const;
+
+    /// \brief Drop a reference to a blob, erasing it with its last key.
+    ///
+    /// The mutex must be held by the caller.
+    ///
+    /// \returns the child key to remove, or an empty string.
+    std::string releaseLocked(std::uint64_t id);
+
+    /// \brief Remove blobs from the child node.
+    void removeFromChild(const std::vector<std::string>& childKeys);
+
+    /// \brief The blob id of each key.
+    std::map<KeyType, std::uint64_t> _index;
+
+    /// \brief The blobs by id.
+    mutable BlobMap _blobs;
+
+    /// \brief The blob ids by content hash.
+    std::unordered_multimap<std::uint64_t, std::uint64_t> _blobsByHash;
+
+    /// \brief The estimated bytes of the values of all keys.
+    uint64_t _logicalBytes = 0;
+
+    mutable std::mutex _mutex;
+
+private:
+    static const char* indexSignature()
+    {
+        return "OFXCAIDX";
+    }
+
+};
+
+
+template<typename KeyType, typename ValueType>
+ContentAddressedCache<KeyType, ValueType>::ContentAddressedCache(std::unique_ptr<ChildStore> childStore):
+    BaseCache<KeyType, ValueType, std::string, ValueType>(std::move(childStore))
+{
+}
+
+
+template<typename KeyType, typename ValueType>
+ContentAddressedCache<KeyType, ValueType>::~ContentAddressedCache()
+{
+    // Queued writes look up their blobs in the index.
+    this->stopWriteBehind();
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> ContentAddressedCache<KeyType, ValueType>::get(const KeyType& key,
+                                                                         bool promote)
+{
+    if (!doHas(key))
+    {
+        this->onGet.notify(this, key);
+        CacheCounters::increment(this->_counters.misses);
+        return nullptr;
+    }
+
+    return BaseCache<KeyType, ValueType, std::string, ValueType>::get(key, promote);
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t ContentAddressedCache<KeyType, ValueType>::uniqueCount() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _blobs.size();
+}
+
+
+template<typename KeyType, typename ValueType>
+uint64_t ContentAddressedCache<KeyType, ValueType>::uniqueBytes() const
+{
+    return this->_counters.bytes;
+}
+
+
+template<typename KeyType, typename ValueType>
+uint64_t ContentAddressedCache<KeyType, ValueType>::logicalBytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _logicalBytes;
+}
+
+
+template<typename KeyType, typename ValueType>
+uint64_t ContentAddressedCache<KeyType, ValueType>::deduplicatedBytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _logicalBytes - this->_counters.bytes;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool ContentAddressedCache<KeyType, ValueType>::saveIndex(const std::string& path) const
+{
+    // Write to a temporary file so an interrupted save keeps the old index.
+    std::string finalPath = ofToDataPath(path, true);
+    std::string temporaryPath = finalPath + ".tmp";
+
+    {
+        std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!stream)
+        {
+            ofLogError("ContentAddressedCache::saveIndex") << "Unable to open " << temporaryPath;
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        uint64_t count = 0;
+
+        for (const auto& entry: _index)
+        {
+            count += _blobs.at(entry.second).isStored ? 1 : 0;
+        }
+
+        stream.write(indexSignature(), 8);
+        stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const auto& entry: _index)
+        {
+            const Blob& blob = _blobs.at(entry.second);
+
+            if (blob.isStored)
+            {
+                uint64_t bytes = blob.bytes;
+                KeySerializer<KeyType>::write(stream, entry.first);
+                stream.write(reinterpret_cast<const char*>(&entry.second), sizeof(entry.second));
+                stream.write(reinterpret_cast<const char*>(&blob.hash), sizeof(blob.hash));
+                stream.write(reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+            }
+        }
+
+        if (!stream)
+        {
+            ofLogError("ContentAddressedCache::saveIndex") << "Unable to write " << temporaryPath;
+            return false;
+        }
+    }
+
+    return ofFile::moveFromTo(temporaryPath, finalPath, false, true);
+}
+
+
+template<typename KeyType, typename ValueType>
+bool ContentAddressedCache<KeyType, ValueType>::loadIndex(const std::string& path)
+{
+    std::ifstream stream(ofToDataPath(path, true), std::ios::binary);
+
+    if (!stream)
+    {
+        return false;
+    }
+
+    char signature[8];
+    uint64_t count = 0;
+
+    if (!stream.read(signature, 8)
+     || !std::equal(signature, signature + 8, indexSignature())
+     || !stream.read(reinterpret_cast<char*>(&count), sizeof(count)))
+    {
+        ofLogError("ContentAddressedCache::loadIndex") << "Invalid index file " << path;
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _index.clear();
+    _blobs.clear();
+    _blobsByHash.clear();
+    _logicalBytes = 0;
+    this->_counters.bytes = 0;
+
+    KeyType key;
+    std::uint64_t id = 0;
+    std::uint64_t hash = 0;
+    uint64_t bytes = 0;
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (!KeySerializer<KeyType>::read(stream, key)
+         || !stream.read(reinterpret_cast<char*>(&id), sizeof(id))
+         || !stream.read(reinterpret_cast<char*>(&hash), sizeof(hash))
+         || !stream.read(reinterpret_cast<char*>(&bytes), sizeof(bytes)))
+        {
+            ofLogError("ContentAddressedCache::loadIndex") << "Truncated index file " << path;
+            break;
+        }
+
+        auto result = _blobs.emplace(id, Blob());
+        Blob& blob = result.first->second;
+
+        if (result.second)
+        {
+            blob.hash = hash;
+            blob.bytes = static_cast<std::size_t>(bytes);
+            blob.isStored = true;
+            _blobsByHash.emplace(hash, id);
+            this->_counters.bytes += blob.bytes;
+        }
+
+        if (_index.emplace(key, id).second)
+        {
+            ++blob.references;
+            _logicalBytes += blob.bytes;
+        }
+    }
+
+    return true;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool ContentAddressedCache<KeyType, ValueType>::doHas(const KeyType& key) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _index.find(key) != _index.end();
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> ContentAddressedCache<KeyType, ValueType>::doGet(const KeyType& key)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _index.find(key);
+
+    if (iter == _index.end())
+    {
+        return nullptr;
+    }
+
+    return residentValue(_blobs.at(iter->second));
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::doAdd(const KeyType& key, std::shared_ptr<ValueType> entry)
+{
+    if (entry == nullptr)
+    {
+        doRemove(key);
+        return;
+    }
+
+    {
+        // Promoted values are already the shared blob.
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto iter = _index.find(key);
+
+        if (iter != _index.end() && residentValue(_blobs.at(iter->second)) == entry)
+        {
+            return;
+        }
+    }
+
+    // Hash outside of the lock, values may be large.
+    std::uint64_t hash = ContentHash<ValueType>::hash(*entry);
+    std::size_t bytes = ValueSize<ValueType>::size(*entry);
+
+    std::string orphan;
+
+    // Keeps blobs read from the child in memory until they are compared.
+    std::vector<std::shared_ptr<ValueType>> readValues;
+    std::set<std::uint64_t> unreadable;
+    std::vector<std::uint64_t> unverified;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto blobIter = findBlobLocked(hash, bytes, *entry, unreadable, unverified);
+
+        // Blobs only in the child are read outside of the lock, then
+        // compared like blobs in memory.
+        while (blobIter == _blobs.end() && !unverified.empty())
+        {
+            lock.unlock();
+            auto values = readFromChild(unverified);
+            lock.lock();
+
+            for (std::size_t i = 0; i < unverified.size(); ++i)
+            {
+                auto storedIter = _blobs.find(unverified[i]);
+
+                if (values[i] == nullptr)
+                {
+                    unreadable.insert(unverified[i]);
+                }
+                else if (storedIter != _blobs.end() && residentValue(storedIter->second) == nullptr)
+                {
+                    setResidentValue(storedIter->second, values[i]);
+                    readValues.push_back(values[i]);
+                }
+            }
+
+            unverified.clear();
+            blobIter = findBlobLocked(hash, bytes, *entry, unreadable, unverified);
+        }
+
+        if (blobIter == _blobs.end())
+        {
+            // A new value. Its id is its hash, unless another value has it.
+            std::uint64_t id = hash;
+
+            while (_blobs.find(id) != _blobs.end())
+            {
+                ++id;
+            }
+
+            blobIter = _blobs.emplace(id, Blob()).first;
+            blobIter->second.hash = hash;
+            blobIter->second.bytes = bytes;
+            _blobsByHash.emplace(hash, id);
+            this->_counters.bytes += bytes;
+        }
+
+        std::uint64_t id = blobIter->first;
+        Blob& blob = blobIter->second;
+
+        if (residentValue(blob) == nullptr)
+        {
+            setResidentValue(blob, entry);
+        }
+
+        auto iter = _index.find(key);
+
+        if (iter == _index.end())
+        {
+            _index.emplace(key, id);
+        }
+        else if (iter->second != id)
+        {
+            orphan = releaseLocked(iter->second);
+            iter->second = id;
+        }
+        else
+        {
+            // The key already refers to this value.
+            return;
+        }
+
+        ++blob.references;
+        _logicalBytes += blob.bytes;
+    }
+
+    if (!orphan.empty())
+    {
+        removeFromChild({ orphan });
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::doRemove(const KeyType& key)
+{
+    std::string orphan;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto iter = _index.find(key);
+
+        if (iter == _index.end())
+        {
+            return;
+        }
+
+        orphan = releaseLocked(iter->second);
+        _index.erase(iter);
+    }
+
+    if (!orphan.empty())
+    {
+        removeFromChild({ orphan });
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t ContentAddressedCache<KeyType, ValueType>::doSize()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _index.size();
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::doClear()
+{
+    std::vector<std::string> orphans;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (const auto& blob: _blobs)
+        {
+            if (blob.second.isStored)
+            {
+                orphans.push_back(hashToString(blob.first));
+            }
+        }
+
+        _index.clear();
+        _blobs.clear();
+        _blobsByHash.clear();
+        _logicalBytes = 0;
+        this->_counters.bytes = 0;
+    }
+
+    removeFromChild(orphans);
+}
+
+
+template<typename KeyType, typename ValueType>
+std::string ContentAddressedCache<KeyType, ValueType>::toChildKey(const KeyType& key) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _index.find(key);
+
+    if (iter == _index.end())
+    {
+        return std::string();
+    }
+
+    return hashToString(iter->second);
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> ContentAddressedCache<KeyType, ValueType>::fromChildValue(const KeyType& key,
+                                                                                    std::shared_ptr<ValueType> value) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _index.find(key);
+
+    if (iter == _index.end())
+    {
+        return value;
+    }
+
+    Blob& blob = _blobs.at(iter->second);
+    auto resident = residentValue(blob);
+
+    // Another key may have loaded the same blob in the meantime.
+    if (resident != nullptr)
+    {
+        return resident;
+    }
+
+    setResidentValue(blob, value);
+    return value;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> ContentAddressedCache<KeyType, ValueType>::toChildValue(const KeyType& key,
+                                                                                  std::shared_ptr<ValueType> value) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _index.find(key);
+
+    // Removed keys and blobs already in the child are skipped.
+    if (iter == _index.end() || _blobs.at(iter->second).isStored)
+    {
+        return nullptr;
+    }
+
+    // The blob stays in memory until doOnChildWritten() confirms the write.
+    auto resident = residentValue(_blobs.at(iter->second));
+    return resident != nullptr ? resident : value;
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::doOnChildWritten(const KeyType&,
+                                                                 const std::string& childKey)
+{
+    auto child = this->childStore();
+
+    // Stores may fail without throwing, e.g. a file store that can't write.
+    if (child == nullptr || !child->has(childKey))
+    {
+        ofLogError("ContentAddressedCache::doOnChildWritten") << "Unable to write blob " << childKey;
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // The key may have been removed or changed while the blob was
+        // written, so the blob is found by the child key.
+        std::uint64_t id = 0;
+        auto blobIter = stringToHash(childKey, id) ? _blobs.find(id) : _blobs.end();
+
+        if (blobIter != _blobs.end())
+        {
+            Blob& blob = blobIter->second;
+
+            if (!blob.isStored)
+            {
+                auto resident = residentValue(blob);
+                blob.isStored = true;
+                setResidentValue(blob, resident);
+            }
+
+            return;
+        }
+    }
+
+    // The blob lost its last key before it was stored.
+    removeFromChild({ childKey });
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> ContentAddressedCache<KeyType, ValueType>::residentValue(const Blob& blob)
+{
+    return blob.value != nullptr ? blob.value : blob.weakValue.lock();
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::setResidentValue(Blob& blob, std::shared_ptr<ValueType> value)
+{
+    if (blob.isStored)
+    {
+        blob.value = nullptr;
+        blob.weakValue = value;
+    }
+    else
+    {
+        blob.value = value;
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+typename ContentAddressedCache<KeyType, ValueType>::BlobMap::iterator
+ContentAddressedCache<KeyType, ValueType>::findBlobLocked(std::uint64_t hash,
+                                                          std::size_t bytes,
+                                                          const ValueType& value,
+                                                          const std::set<std::uint64_t>& unreadable,
+                                                          std::vector<std::uint64_t>& unverified)
+{
+    auto range = _blobsByHash.equal_range(hash);
+
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        auto blobIter = _blobs.find(iter->second);
+        auto resident = residentValue(blobIter->second);
+
+        if (resident != nullptr)
+        {
+            if (ContentHash<ValueType>::equal(*resident, value))
+            {
+                return blobIter;
+            }
+        }
+        else if (blobIter->second.bytes == bytes
+              && unreadable.find(blobIter->first) == unreadable.end())
+        {
+            unverified.push_back(blobIter->first);
+        }
+    }
+
+    return _blobs.end();
+}
+
+
+template<typename KeyType, typename ValueType>
+std::vector<std::shared_ptr<ValueType>> ContentAddressedCache<KeyType, ValueType>::readFromChild(const std::vector<std::uint64_t>& ids) const
+{
+    std::vector<std::shared_ptr<ValueType>> values(ids.size());
+    auto child = this->childStore();
+
+    for (std::size_t i = 0; child != nullptr && i < ids.size(); ++i)
+    {
+        values[i] = child->get(hashToString(ids[i]), false);
+    }
+
+    return values;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::string ContentAddressedCache<KeyType, ValueType>::releaseLocked(std::uint64_t id)
+{
+    auto blobIter = _blobs.find(id);
+    Blob& blob = blobIter->second;
+
+    _logicalBytes -= blob.bytes;
+
+    if (--blob.references > 0)
+    {
+        return std::string();
+    }
+
+    auto range = _blobsByHash.equal_range(blob.hash);
+
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        if (iter->second == id)
+        {
+            _blobsByHash.erase(iter);
+            break;
+        }
+    }
+
+    std::string childKey = blob.isStored ? hashToString(id) : std::string();
+
+    this->_counters.bytes -= blob.bytes;
+    _blobs.erase(blobIter);
+
+    return childKey;
+}
+
+
+template<typename KeyType, typename ValueType>
+void ContentAddressedCache<KeyType, ValueType>::removeFromChild(const std::vector<std::string>& childKeys)
+{
+    auto child = this->childStore();
+
+    if (child == nullptr)
+    {
+        return;
+    }
+
+    for (const auto& childKey: childKeys)
+    {
+        child->remove(childKey);
+    }
+}
+
+
+} } // namespace ofx::Cache
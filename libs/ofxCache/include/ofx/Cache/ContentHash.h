@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "ofFileUtils.h"
+#include "ofPixels.h"
+#include "ofx/Cache/HashedKey.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Hashes and compares the contents of a cached value.
+///
+/// Used by ContentAddressedCache to find values that are byte-identical.
+/// Strings, vectors of trivially copyable elements, buffers and pixels are
+/// supported out of the box. Other value types can be supported by
+/// specializing this template.
+///
+/// \tparam ValueType The value type.
+template<typename ValueType, typename Enable = void>
+struct ContentHash;
+
+
+/// \brief A ContentHash for strings.
+template<>
+struct ContentHash<std::string>
+{
+    /// \param value The value to hash.
+    /// \returns a 64-bit hash of the contents of the value.
+    static std::uint64_t hash(const std::string& value)
+    {
+        return hashBytes(value.data(), value.size());
+    }
+
+    /// \returns true if both values have the same contents.
+    static bool equal(const std::string& a, const std::string& b)
+    {
+        return a == b;
+    }
+};
+
+
+/// \brief A ContentHash for vectors of trivially copyable elements.
+template<typename T>
+struct ContentHash<std::vector<T>, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+    static std::uint64_t hash(const std::vector<T>& value)
+    {
+        return hashBytes(value.data(), value.size() * sizeof(T));
+    }
+
+    static bool equal(const std::vector<T>& a, const std::vector<T>& b)
+    {
+        return a.size() == b.size()
+            && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+};
+
+
+/// \brief A ContentHash for buffers.
+template<>
+struct ContentHash<ofBuffer>
+{
+    static std::uint64_t hash(const ofBuffer& value)
+    {
+        return hashBytes(value.getData(), value.size());
+    }
+
+    static bool equal(const ofBuffer& a, const ofBuffer& b)
+    {
+        return a.size() == b.size()
+            && (a.size() == 0 || std::memcmp(a.getData(), b.getData(), a.size()) == 0);
+    }
+};
+
+
+/// \brief A ContentHash for pixels.
+///
+/// Pixels with the same bytes but a different shape are different.
+template<typename PixelType>
+struct ContentHash<ofPixels_<PixelType>>
+{
+    static std::uint64_t hash(const ofPixels_<PixelType>& value)
+    {
+        std::uint64_t shape = mixHash(value.getWidth() ^ mixHash(value.getHeight() ^ mixHash(value.getNumChannels())));
+        return hashBytes(value.getData(), value.getTotalBytes()) ^ shape;
+    }
+
+    static bool equal(const ofPixels_<PixelType>& a, const ofPixels_<PixelType>& b)
+    {
+        return a.getWidth() == b.getWidth()
+            && a.getHeight() == b.getHeight()
+            && a.getNumChannels() == b.getNumChannels()
+            && a.getTotalBytes() == b.getTotalBytes()
+            && (a.getTotalBytes() == 0 || std::memcmp(a.getData(), b.getData(), a.getTotalBytes()) == 0);
+    }
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,445 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define OFX_CACHE_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifndef OFX_CACHE_HAS_COROUTINES
+#define OFX_CACHE_HAS_COROUTINES 0
+#endif
+
+
+#if OFX_CACHE_HAS_COROUTINES
+
+
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Poco/Exception.h"
+#include "ofEvents.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+template<typename KeyType, typename ValueType>
+class BaseAsyncCache;
+
+enum class RequestPriority;
+
+
+/// \brief A function that runs work somewhere else, e.g. on a thread pool.
+///
+/// Awaiters pass the resumption of a coroutine to the executor. The executor
+/// must be safe to call from any thread.
+typedef std::function<void(std::function<void()>)> Executor;
+
+
+/// \brief An executor that runs work on the main thread during update().
+///
+/// Work posted from any thread runs in the next ofEvents().update, in the
+/// order it was posted. Use the shared instance, e.g.
+///
+///     auto value = co_await cache.asyncGet(key,
+///                                          RequestPriority::NORMAL,
+///                                          MainThreadExecutor::instance().executor());
+///
+/// The instance registers for update events when it is first used, so it
+/// should first be used from the main thread, e.g. in setup().
+class MainThreadExecutor
+{
+public:
+    MainThreadExecutor()
+    {
+        _updateListener = ofEvents().update.newListener(this, &MainThreadExecutor::onUpdate);
+    }
+
+    MainThreadExecutor(const MainThreadExecutor&) = delete;
+    MainThreadExecutor& operator = (const MainThreadExecutor&) = delete;
+
+    /// \brief Run work during the next update.
+    /// \param work The work to run.
+    void post(std::function<void()> work)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _work.push_back(std::move(work));
+    }
+
+    /// \brief Run all posted work now.
+    ///
+    /// This is called automatically during update. Work posted while
+    /// running is deferred to the next call.
+    void update()
+    {
+        std::vector<std::function<void()>> work;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::swap(work, _work);
+        }
+
+        for (auto& item: work)
+        {
+            item();
+        }
+    }
+
+    /// \returns an Executor that posts to this executor.
+    Executor executor()
+    {
+        return [this](std::function<void()> work)
+        {
+            post(std::move(work));
+        };
+    }
+
+    /// \returns the shared instance.
+    static MainThreadExecutor& instance()
+    {
+        static MainThreadExecutor executor;
+        return executor;
+    }
+
+private:
+    void onUpdate(ofEventArgs&)
+    {
+        update();
+    }
+
+    std::vector<std::function<void()>> _work;
+    mutable std::mutex _mutex;
+    ofEventListener _updateListener;
+
+};
+
+
+/// \brief The return type of a fire-and-forget coroutine.
+///
+/// The coroutine starts immediately and runs until its first suspension. It
+/// owns its own state and frees it when it finishes. Uncaught exceptions are
+/// logged, e.g.
+///
+///     AsyncTask loadTiles(ResourceCache& cache)
+///     {
+///         auto manifest = co_await cache.asyncGet("manifest.json");
+///         auto tiles = co_await cache.asyncGetAll(tileKeys(*manifest));
+///         ...
+///     }
+class AsyncTask
+{
+public:
+    struct promise_type
+    {
+        AsyncTask get_return_object() noexcept
+        {
+            return AsyncTask();
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            try
+            {
+                throw;
+            }
+            catch (const Poco::Exception& exc)
+            {
+                ofLogError("AsyncTask::unhandled_exception") << exc.displayText();
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("AsyncTask::unhandled_exception") << exc.what();
+            }
+            catch (...)
+            {
+                ofLogError("AsyncTask::unhandled_exception") << "Unknown exception.";
+            }
+        }
+    };
+
+};
+
+
+/// \brief Awaits a single request of a BaseAsyncCache.
+///
+/// Created by BaseAsyncCache::asyncGet(). The awaiting coroutine resumes with
+/// the value when the request completes. If the request fails or is
+/// cancelled, e.g. with BaseAsyncCache::cancelRequest(), the co_await
+/// expression throws a Poco::IOException describing the error.
+///
+/// Without an executor the coroutine resumes on the thread that completes the
+/// request (usually the main thread, during update), or immediately if the
+/// value is cached. With an executor it always resumes through the executor.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+template<typename KeyType, typename ValueType>
+class RequestAwaiter
+{
+public:
+    /// \brief Create a RequestAwaiter.
+    /// \param cache The cache to request from.
+    /// \param key The key to request.
+    /// \param priority The priority of the request.
+    /// \param executor The executor to resume on, or nullptr.
+    RequestAwaiter(BaseAsyncCache<KeyType, ValueType>& cache,
+                   const KeyType& key,
+                   RequestPriority priority,
+                   Executor executor):
+        _cache(cache),
+        _key(key),
+        _priority(priority),
+        _state(std::make_shared<State>())
+    {
+        _state->executor = executor;
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        _state->handle = handle;
+
+        std::shared_ptr<State> state = _state;
+
+        _cache.request(_key,
+                       [state](const auto& args)
+                       {
+                           state->value = args.value();
+                           state->complete();
+                       },
+                       [state](const auto& args)
+                       {
+                           state->error = args.error();
+                           state->isFailed = true;
+                           state->complete();
+                       },
+                       _priority);
+
+        return state->suspend();
+    }
+
+    std::shared_ptr<ValueType> await_resume()
+    {
+        if (_state->isFailed)
+        {
+            throw Poco::IOException(_state->error);
+        }
+
+        return _state->value;
+    }
+
+private:
+    /// \brief The result, shared with the request callbacks.
+    struct State
+    {
+        std::coroutine_handle<> handle;
+        Executor executor;
+        std::shared_ptr<ValueType> value;
+        std::string error;
+        bool isFailed = false;
+
+        /// \brief Set by whichever of complete() and suspend() runs first.
+        std::atomic<bool> isClaimed { false };
+
+        void complete()
+        {
+            // The second to arrive resumes the coroutine.
+            if (isClaimed.exchange(true))
+            {
+                resume(handle, executor);
+            }
+        }
+
+        /// \returns true if the coroutine should stay suspended.
+        bool suspend()
+        {
+            if (!isClaimed.exchange(true))
+            {
+                return true;
+            }
+
+            // The request completed before the coroutine suspended.
+            if (executor)
+            {
+                resume(handle, executor);
+                return true;
+            }
+
+            return false;
+        }
+    };
+
+    static void resume(std::coroutine_handle<> handle, const Executor& executor)
+    {
+        if (executor)
+        {
+            executor([handle]() { handle.resume(); });
+        }
+        else
+        {
+            handle.resume();
+        }
+    }
+
+    BaseAsyncCache<KeyType, ValueType>& _cache;
+    KeyType _key;
+    RequestPriority _priority;
+    std::shared_ptr<State> _state;
+
+};
+
+
+/// \brief Awaits a batch of requests of a BaseAsyncCache.
+///
+/// Created by BaseAsyncCache::asyncGetAll(). All requests are issued at once
+/// and the awaiting coroutine resumes once, when the last one finishes, with
+/// the values in the order of the keys. Values of failed or cancelled requests
+/// are nullptr.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+template<typename KeyType, typename ValueType>
+class BatchRequestAwaiter
+{
+public:
+    /// \brief Create a BatchRequestAwaiter.
+    /// \param cache The cache to request from.
+    /// \param keys The keys to request.
+    /// \param priority The priority of the requests.
+    /// \param executor The executor to resume on, or nullptr.
+    BatchRequestAwaiter(BaseAsyncCache<KeyType, ValueType>& cache,
+                        const std::vector<KeyType>& keys,
+                        RequestPriority priority,
+                        Executor executor):
+        _cache(cache),
+        _keys(keys),
+        _priority(priority),
+        _state(std::make_shared<State>())
+    {
+        _state->executor = executor;
+        _state->values.resize(_keys.size());
+        // One extra count is released by await_suspend().
+        _state->remaining = _keys.size() + 1;
+    }
+
+    bool await_ready() const noexcept
+    {
+        return _keys.empty();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        _state->handle = handle;
+
+        std::shared_ptr<State> state = _state;
+
+        for (std::size_t i = 0; i < _keys.size(); ++i)
+        {
+            _cache.request(_keys[i],
+                           [state, i](const auto& args)
+                           {
+                               state->values[i] = args.value();
+                               state->complete();
+                           },
+                           [state](const auto&)
+                           {
+                               state->complete();
+                           },
+                           _priority);
+        }
+
+        if (state->remaining.fetch_sub(1) != 1)
+        {
+            return true;
+        }
+
+        // Every request completed before the coroutine suspended.
+        if (state->executor)
+        {
+            state->resume();
+            return true;
+        }
+
+        return false;
+    }
+
+    std::vector<std::shared_ptr<ValueType>> await_resume()
+    {
+        return std::move(_state->values);
+    }
+
+private:
+    struct State
+    {
+        std::coroutine_handle<> handle;
+        Executor executor;
+        std::vector<std::shared_ptr<ValueType>> values;
+        std::atomic<std::size_t> remaining { 0 };
+
+        void complete()
+        {
+            if (remaining.fetch_sub(1) == 1)
+            {
+                resume();
+            }
+        }
+
+        void resume()
+        {
+            if (executor)
+            {
+                std::coroutine_handle<> coroutine = handle;
+                executor([coroutine]() { coroutine.resume(); });
+            }
+            else
+            {
+                handle.resume();
+            }
+        }
+    };
+
+    BaseAsyncCache<KeyType, ValueType>& _cache;
+    std::vector<KeyType> _keys;
+    RequestPriority _priority;
+    std::shared_ptr<State> _state;
+
+};
+
+
+} } // namespace ofx::Cache
+
+
+#endif
@@ -0,0 +1,800 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#if defined(__linux__) && defined(OFX_CACHE_USE_IO_URING)
+#define OFX_CACHE_HAS_IO_URING 1
+#else
+#define OFX_CACHE_HAS_IO_URING 0
+#endif
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Poco/Exception.h"
+#include "ofFileUtils.h"
+#include "ofLog.h"
+
+#if OFX_CACHE_HAS_IO_URING
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Reads and writes whole files on a single I/O thread.
+///
+/// Requests from any thread are queued and handed to the I/O thread in
+/// batches. On Linux, when compiled with OFX_CACHE_USE_IO_URING, the I/O
+/// thread submits each batch to an io_uring and completes the requests as
+/// the kernel finishes them, keeping up to queueDepth() requests in flight
+/// without a thread per request. Otherwise, or if the kernel does not
+/// support io_uring, the I/O thread performs the requests one at a time with
+/// blocking calls.
+///
+/// Callbacks are called on the I/O thread and should return quickly, e.g. by
+/// handing the buffer to a decode queue.
+///
+/// BaseReadableFileStore::readAsync() reads with the shared instance().
+class FileIOService
+{
+public:
+    /// \brief Called with the contents of a file, or an error.
+    typedef std::function<void(std::shared_ptr<ofBuffer> buffer, const std::string& error)> ReadCallback;
+
+    /// \brief Called when a file was written, with an empty error on success.
+    typedef std::function<void(const std::string& error)> WriteCallback;
+
+    /// \brief Create a FileIOService and start its I/O thread.
+    /// \param queueDepth The maximum number of requests in flight.
+    FileIOService(std::size_t queueDepth = DEFAULT_QUEUE_DEPTH);
+
+    FileIOService(const FileIOService&) = delete;
+    FileIOService& operator = (const FileIOService&) = delete;
+
+    /// \brief Finish the queued requests and stop the I/O thread.
+    ~FileIOService();
+
+    /// \brief Read a file.
+    /// \param path The absolute path of the file.
+    /// \param callback The function called on the I/O thread with the result.
+    void read(const std::string& path, ReadCallback callback);
+
+    /// \brief Read a file.
+    /// \param path The absolute path of the file.
+    /// \returns a future of the contents, which throws a Poco::IOException if
+    /// the file can't be read.
+    std::future<std::shared_ptr<ofBuffer>> read(const std::string& path);
+
+    /// \brief Write a file, replacing its contents.
+    /// \param path The absolute path of the file.
+    /// \param buffer The contents to write.
+    /// \param callback The function called on the I/O thread with the result.
+    void write(const std::string& path,
+               std::shared_ptr<ofBuffer> buffer,
+               WriteCallback callback);
+
+    /// \brief Write a file, replacing its contents.
+    /// \param path The absolute path of the file.
+    /// \param buffer The contents to write.
+    /// \returns a future that throws a Poco::IOException if the file can't
+    /// be written.
+    std::future<void> write(const std::string& path, std::shared_ptr<ofBuffer> buffer);
+
+    /// \returns true if requests are submitted to an io_uring.
+    bool isUsingIOURing() const;
+
+    /// \returns the maximum number of requests in flight.
+    std::size_t queueDepth() const;
+
+    /// \returns the shared instance.
+    static FileIOService& instance();
+
+    enum
+    {
+        /// \brief The default maximum number of requests in flight.
+        DEFAULT_QUEUE_DEPTH = 64
+    };
+
+private:
+    struct Request
+    {
+        bool isWrite = false;
+        std::string path;
+        std::shared_ptr<ofBuffer> buffer;
+        ReadCallback onRead;
+        WriteCallback onWrite;
+    };
+
+    void post(Request request);
+
+    void run();
+
+    /// \brief Perform a request with blocking calls.
+    static void runBlocking(Request& request);
+
+    /// \brief Call the callback of a finished request.
+    static void complete(Request& request, const std::string& error);
+
+#if OFX_CACHE_HAS_IO_URING
+    /// \brief The submission and completion queues shared with the kernel.
+    class Ring
+    {
+    public:
+        explicit Ring(unsigned entries);
+        ~Ring();
+
+        /// \returns true if the ring was set up.
+        bool isValid() const;
+
+        /// \returns the next free submission queue entry, cleared.
+        io_uring_sqe* nextEntry();
+
+        /// \brief Submit prepared entries and wait for completions.
+        ///
+        /// The kernel may take fewer entries than given, e.g. while its
+        /// completion queue is full. It then returns without waiting and the
+        /// rest stay prepared for the next call.
+        ///
+        /// \param count The number of prepared entries to submit.
+        /// \param minimumCompletions The number of completions to wait for.
+        /// \returns the number of entries submitted, or -1 if the kernel
+        /// returned an error.
+        int submitAndWait(unsigned count, unsigned minimumCompletions);
+
+        /// \brief Call a function for each completion.
+        template<typename Function>
+        void reap(Function function);
+
+    private:
+        int _fd = -1;
+        io_uring_params _params;
+        void* _sqRing = MAP_FAILED;
+        void* _cqRing = MAP_FAILED;
+        std::size_t _sqRingSize = 0;
+        std::size_t _cqRingSize = 0;
+        io_uring_sqe* _sqes = nullptr;
+        std::size_t _sqesSize = 0;
+        unsigned* _sqTail = nullptr;
+        unsigned* _sqMask = nullptr;
+        unsigned* _sqArray = nullptr;
+        unsigned* _cqHead = nullptr;
+        unsigned* _cqTail = nullptr;
+        unsigned* _cqMask = nullptr;
+        io_uring_cqe* _cqes = nullptr;
+        unsigned _localTail = 0;
+
+    };
+
+    /// \brief A request in flight.
+    struct Operation
+    {
+        Request request;
+        int fd = -1;
+        std::size_t offset = 0;
+        std::size_t size = 0;
+        iovec vector;
+    };
+
+    void runRing();
+
+    /// \brief Open the file of a request.
+    /// \returns the operation, or nullptr if the request already completed.
+    static Operation* startOperation(Request& request);
+
+    /// \brief Queue the next transfer of an operation.
+    void prepare(Operation& operation);
+
+    /// \brief Account for a completed transfer.
+    /// \returns true if the operation finished and was deleted.
+    static bool finishTransfer(Operation* operation, int result);
+
+    /// \brief Close the file of an operation, call its callback and delete it.
+    static void finishOperation(Operation* operation, const std::string& error);
+
+    std::unique_ptr<Ring> _ring;
+#endif
+
+    std::size_t _queueDepth = DEFAULT_QUEUE_DEPTH;
+    std::deque<Request> _requests;
+    bool _isRunning = true;
+    mutable std::mutex _mutex;
+    std::condition_variable _condition;
+    std::thread _thread;
+
+};
+
+
+inline FileIOService::FileIOService(std::size_t queueDepth):
+    _queueDepth(std::max(queueDepth, std::size_t(1)))
+{
+#if OFX_CACHE_HAS_IO_URING
+    _ring = std::make_unique<Ring>(static_cast<unsigned>(_queueDepth));
+
+    if (!_ring->isValid())
+    {
+        ofLogWarning("FileIOService::FileIOService") << "io_uring is not available, using blocking I/O.";
+        _ring.reset();
+    }
+#endif
+
+    _thread = std::thread([this]() { run(); });
+}
+
+
+inline FileIOService::~FileIOService()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _isRunning = false;
+    }
+
+    _condition.notify_all();
+    _thread.join();
+}
+
+
+inline void FileIOService::read(const std::string& path, ReadCallback callback)
+{
+    Request request;
+    request.path = path;
+    request.onRead = callback;
+    post(std::move(request));
+}
+
+
+inline std::future<std::shared_ptr<ofBuffer>> FileIOService::read(const std::string& path)
+{
+    auto promise = std::make_shared<std::promise<std::shared_ptr<ofBuffer>>>();
+
+    read(path, [promise](std::shared_ptr<ofBuffer> buffer, const std::string& error)
+    {
+        if (error.empty())
+        {
+            promise->set_value(buffer);
+        }
+        else
+        {
+            promise->set_exception(std::make_exception_ptr(Poco::IOException(error)));
+        }
+    });
+
+    return promise->get_future();
+}
+
+
+inline void FileIOService::write(const std::string& path,
+                                 std::shared_ptr<ofBuffer> buffer,
+                                 WriteCallback callback)
+{
+    Request request;
+    request.isWrite = true;
+    request.path = path;
+    request.buffer = buffer;
+    request.onWrite = callback;
+    post(std::move(request));
+}
+
+
+inline std::future<void> FileIOService::write(const std::string& path, std::shared_ptr<ofBuffer> buffer)
+{
+    auto promise = std::make_shared<std::promise<void>>();
+
+    write(path, buffer, [promise](const std::string& error)
+    {
+        if (error.empty())
+        {
+            promise->set_value();
+        }
+        else
+        {
+            promise->set_exception(std::make_exception_ptr(Poco::IOException(error)));
+        }
+    });
+
+    return promise->get_future();
+}
+
+
+inline bool FileIOService::isUsingIOURing() const
+{
+#if OFX_CACHE_HAS_IO_URING
+    return _ring != nullptr;
+#else
+    return false;
+#endif
+}
+
+
+inline std::size_t FileIOService::queueDepth() const
+{
+    return _queueDepth;
+}
+
+
+inline FileIOService& FileIOService::instance()
+{
+    static FileIOService service;
+    return service;
+}
+
+
+inline void FileIOService::post(Request request)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _requests.push_back(std::move(request));
+    }
+
+    _condition.notify_one();
+}
+
+
+inline void FileIOService::run()
+{
+#if OFX_CACHE_HAS_IO_URING
+    if (_ring != nullptr)
+    {
+        runRing();
+        return;
+    }
+#endif
+
+    while (true)
+    {
+        std::deque<Request> batch;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]() { return !_requests.empty() || !_isRunning; });
+
+            if (_requests.empty())
+            {
+                return;
+            }
+
+            std::swap(batch, _requests);
+        }
+
+        for (auto& request: batch)
+        {
+            runBlocking(request);
+        }
+    }
+}
+
+
+inline void FileIOService::runBlocking(Request& request)
+{
+    if (request.isWrite)
+    {
+        std::ofstream stream(request.path, std::ios::binary | std::ios::trunc);
+
+        if (stream)
+        {
+            stream.write(request.buffer->getData(), static_cast<std::streamsize>(request.buffer->size()));
+        }
+
+        complete(request, stream ? "" : "Unable to write " + request.path);
+        return;
+    }
+
+    std::ifstream stream(request.path, std::ios::binary);
+
+    if (!stream)
+    {
+        complete(request, "Unable to open " + request.path);
+        return;
+    }
+
+    request.buffer = std::make_shared<ofBuffer>();
+
+    std::vector<char> chunk(64 * 1024);
+
+    while (stream.read(chunk.data(), chunk.size()) || stream.gcount() > 0)
+    {
+        request.buffer->append(chunk.data(), static_cast<std::size_t>(stream.gcount()));
+    }
+
+    complete(request, stream.bad() ? "Unable to read " + request.path : "");
+}
+
+
+inline void FileIOService::complete(Request& request, const std::string& error)
+{
+    try
+    {
+        if (request.isWrite)
+        {
+            if (request.onWrite)
+            {
+                request.onWrite(error);
+            }
+        }
+        else if (request.onRead)
+        {
+            request.onRead(error.empty() ? request.buffer : nullptr, error);
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("FileIOService::complete") << exc.what();
+    }
+}
+
+
+#if OFX_CACHE_HAS_IO_URING
+
+
+inline FileIOService::Ring::Ring(unsigned entries)
+{
+    std::memset(&_params, 0, sizeof(_params));
+
+    _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &_params));
+
+    if (_fd < 0)
+    {
+        return;
+    }
+
+    _sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+    _cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+
+    // Newer kernels map both rings with a single mapping.
+    if (_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _sqRingSize = std::max(_sqRingSize, _cqRingSize);
+    }
+
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+
+    if (_sqRing == MAP_FAILED)
+    {
+        return;
+    }
+
+    if (_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _cqRingSize = 0;
+    }
+    else
+    {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+
+        if (_cqRing == MAP_FAILED)
+        {
+            return;
+        }
+    }
+
+    _sqesSize = _params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED)
+    {
+        return;
+    }
+
+    char* sq = static_cast<char*>(_sqRing);
+    char* cq = _cqRingSize > 0 ? static_cast<char*>(_cqRing) : sq;
+
+    _sqes = static_cast<io_uring_sqe*>(sqes);
+    _sqTail = reinterpret_cast<unsigned*>(sq + _params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned*>(sq + _params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned*>(sq + _params.sq_off.array);
+    _cqHead = reinterpret_cast<unsigned*>(cq + _params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned*>(cq + _params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned*>(cq + _params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*>(cq + _params.cq_off.cqes);
+    _localTail = *_sqTail;
+}
+
+
+inline FileIOService::Ring::~Ring()
+{
+    if (_sqes != nullptr)
+    {
+        munmap(_sqes, _sqesSize);
+    }
+
+    if (_cqRing != MAP_FAILED)
+    {
+        munmap(_cqRing, _cqRingSize);
+    }
+
+    if (_sqRing != MAP_FAILED)
+    {
+        munmap(_sqRing, _sqRingSize);
+    }
+
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+
+inline bool FileIOService::Ring::isValid() const
+{
+    return _sqes != nullptr;
+}
+
+
+inline io_uring_sqe* FileIOService::Ring::nextEntry()
+{
+    unsigned index = _localTail++ & *_sqMask;
+    _sqArray[index] = index;
+    io_uring_sqe* entry = &_sqes[index];
+    std::memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+
+inline int FileIOService::Ring::submitAndWait(unsigned count, unsigned minimumCompletions)
+{
+    // Publish the prepared entries to the kernel.
+    __atomic_store_n(_sqTail, _localTail, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+        long result = syscall(__NR_io_uring_enter,
+                              _fd,
+                              count,
+                              minimumCompletions,
+                              IORING_ENTER_GETEVENTS,
+                              nullptr,
+                              0);
+
+        if (result >= 0)
+        {
+            return static_cast<int>(result);
+        }
+
+        // An interrupted call only fails if it submitted nothing.
+        if (errno != EINTR)
+        {
+            ofLogError("FileIOService::Ring::submitAndWait") << std::strerror(errno);
+            return -1;
+        }
+    }
+}
+
+
+template<typename Function>
+void FileIOService::Ring::reap(Function function)
+{
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        const io_uring_cqe& completion = _cqes[head & *_cqMask];
+        function(reinterpret_cast<Operation*>(completion.user_data), completion.res);
+        ++head;
+    }
+
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
+
+
+inline void FileIOService::runRing()
+{
+    std::size_t inFlight = 0;
+    unsigned prepared = 0;
+
+    while (true)
+    {
+        std::deque<Request> batch;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            if (inFlight == 0)
+            {
+                _condition.wait(lock, [this]() { return !_requests.empty() || !_isRunning; });
+
+                if (_requests.empty())
+                {
+                    return;
+                }
+            }
+
+            // Requests posted while waiting for completions join the next batch.
+            while (!_requests.empty() && inFlight + batch.size() < _queueDepth)
+            {
+                batch.push_back(std::move(_requests.front()));
+                _requests.pop_front();
+            }
+        }
+
+        for (auto& request: batch)
+        {
+            Operation* operation = startOperation(request);
+
+            if (operation != nullptr)
+            {
+                prepare(*operation);
+                ++prepared;
+                ++inFlight;
+            }
+        }
+
+        if (inFlight == 0)
+        {
+            continue;
+        }
+
+        int submitted = _ring->submitAndWait(prepared, 1);
+
+        if (submitted < 0)
+        {
+            // The kernel is short of resources. Completions are still
+            // reaped, which may free some, before submitting again.
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else
+        {
+            // Entries the kernel didn't take are submitted with the next call.
+            prepared -= static_cast<unsigned>(submitted);
+        }
+
+        _ring->reap([&](Operation* operation, int result)
+        {
+            if (finishTransfer(operation, result))
+            {
+                --inFlight;
+            }
+            else
+            {
+                prepare(*operation);
+                ++prepared;
+            }
+        });
+    }
+}
+
+
+inline FileIOService::Operation* FileIOService::startOperation(Request& request)
+{
+    std::unique_ptr<Operation> operation = std::make_unique<Operation>();
+    operation->request = std::move(request);
+
+    Request& current = operation->request;
+
+    if (current.isWrite)
+    {
+        operation->fd = open(current.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        operation->size = current.buffer->size();
+    }
+    else
+    {
+        operation->fd = open(current.path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        struct stat status;
+
+        if (operation->fd >= 0 && fstat(operation->fd, &status) == 0)
+        {
+            operation->size = static_cast<std::size_t>(status.st_size);
+            current.buffer = std::make_shared<ofBuffer>();
+            current.buffer->allocate(operation->size);
+        }
+    }
+
+    if (operation->fd < 0 || current.buffer == nullptr)
+    {
+        finishOperation(operation.release(), "Unable to open " + current.path + ": " + std::strerror(errno));
+        return nullptr;
+    }
+
+    if (operation->size == 0)
+    {
+        finishOperation(operation.release(), "");
+        return nullptr;
+    }
+
+    return operation.release();
+}
+
+
+inline void FileIOService::prepare(Operation& operation)
+{
+    operation.vector.iov_base = operation.request.buffer->getData() + operation.offset;
+    operation.vector.iov_len = operation.size - operation.offset;
+
+    io_uring_sqe* entry = _ring->nextEntry();
+    entry->opcode = operation.request.isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+    entry->fd = operation.fd;
+    entry->off = operation.offset;
+    entry->addr = reinterpret_cast<std::uint64_t>(&operation.vector);
+    entry->len = 1;
+    entry->user_data = reinterpret_cast<std::uint64_t>(&operation);
+}
+
+
+inline bool FileIOService::finishTransfer(Operation* operation, int result)
+{
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        return false;
+    }
+
+    if (result < 0)
+    {
+        finishOperation(operation, "Unable to transfer " + operation->request.path + ": " + std::strerror(-result));
+        return true;
+    }
+
+    if (result == 0)
+    {
+        if (operation->request.isWrite)
+        {
+            finishOperation(operation, "Unable to write " + operation->request.path);
+        }
+        else
+        {
+            // The file was truncated while reading.
+            operation->request.buffer->resize(operation->offset);
+            finishOperation(operation, "");
+        }
+
+        return true;
+    }
+
+    operation->offset += static_cast<std::size_t>(result);
+
+    if (operation->offset < operation->size)
+    {
+        // Continue a short transfer where it stopped.
+        return false;
+    }
+
+    finishOperation(operation, "");
+    return true;
+}
+
+
+inline void FileIOService::finishOperation(Operation* operation, const std::string& error)
+{
+    std::unique_ptr<Operation> finished(operation);
+
+    if (finished->fd >= 0)
+    {
+        close(finished->fd);
+    }
+
+    complete(finished->request, error);
+}
+
+
+#endif
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,358 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "ofx/Cache/KeySerializer.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Mix the bits of a 64-bit value.
+///
+/// This is the finalizer of splitmix64. Every input bit affects every output
+/// bit, so weak hashes such as std::hash of an integer become usable as
+/// 64-bit identifiers.
+///
+/// \param value The value to mix.
+/// \returns the mixed value.
+inline std::uint64_t mixHash(std::uint64_t value)
+{
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+
+/// \brief Hash a sequence of bytes with 64-bit FNV-1a.
+/// \param data The bytes to hash.
+/// \param size The number of bytes.
+/// \returns the mixed hash.
+inline std::uint64_t hashBytes(const void* data, std::size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return mixHash(hash ^ size);
+}
+
+
+/// \brief Convert a hash to a short string, e.g. for use as a task id.
+///
+/// The string has 13 characters, short enough to avoid a heap allocation in
+/// common std::string implementations.
+///
+/// \param hash The hash to convert.
+/// \returns the hash in base 32.
+inline std::string hashToString(std::uint64_t hash)
+{
+    static const char DIGITS[] = "0123456789abcdefghijklmnopqrstuv";
+
+    std::string result(13, '0');
+
+    for (std::size_t i = result.size(); i-- > 0;)
+    {
+        result[i] = DIGITS[hash & 31];
+        hash >>= 5;
+    }
+
+    return result;
+}
+
+
+/// \brief Convert a string made by hashToString() back to its hash.
+/// \param text The string to convert.
+/// \param hash The hash to convert into.
+/// \returns true if the string is the form of a hash.
+inline bool stringToHash(const std::string& text, std::uint64_t& hash)
+{
+    if (text.size() != 13)
+    {
+        return false;
+    }
+
+    std::uint64_t result = 0;
+
+    for (char c: text)
+    {
+        // 13 digits hold 65 bits, so the first digit is at most 15.
+        if (result >> 59 != 0)
+        {
+            return false;
+        }
+
+        std::uint64_t digit = 0;
+
+        if (c >= '0' && c <= '9')
+        {
+            digit = std::uint64_t(c - '0');
+        }
+        else if (c >= 'a' && c <= 'v')
+        {
+            digit = std::uint64_t(c - 'a' + 10);
+        }
+        else
+        {
+            return false;
+        }
+
+        result = (result << 5) | digit;
+    }
+
+    hash = result;
+    return true;
+}
+
+
+/// \brief Hashes keys with std::hash.
+///
+/// Has no hash() if std::hash doesn't support the key type, so KeyHash can
+/// be detected with IsKeyHashable.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType, typename Enable = void>
+struct StdKeyHash
+{
+};
+
+
+/// \brief StdKeyHash for keys supported by std::hash.
+template<typename KeyType>
+struct StdKeyHash<KeyType, typename std::enable_if<std::is_convertible<decltype(std::hash<KeyType>()(std::declval<const KeyType&>())), std::size_t>::value>::type>
+{
+    static std::uint64_t hash(const KeyType& key)
+    {
+        return mixHash(static_cast<std::uint64_t>(std::hash<KeyType>()(key)));
+    }
+};
+
+
+/// \brief Computes a 64-bit hash of a key.
+///
+/// Arithmetic keys and strings are supported. Other key types are hashed
+/// with std::hash and mixed if std::hash supports them. Custom key types can
+/// be supported by specializing this template.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType, typename Enable = void>
+struct KeyHash: public StdKeyHash<KeyType>
+{
+};
+
+
+/// \brief KeyHash for integral keys.
+template<typename KeyType>
+struct KeyHash<KeyType, typename std::enable_if<std::is_integral<KeyType>::value>::type>
+{
+    static std::uint64_t hash(const KeyType& key)
+    {
+        return hashBytes(&key, sizeof(KeyType));
+    }
+};
+
+
+/// \brief KeyHash for floating point keys.
+///
+/// Keys that compare equal hash equally, so -0.0 and 0.0 share a hash. The
+/// bytes are not hashed directly, as long double has padding bytes with
+/// unspecified values, so the key goes through std::hash.
+template<typename KeyType>
+struct KeyHash<KeyType, typename std::enable_if<std::is_floating_point<KeyType>::value>::type>
+{
+    static std::uint64_t hash(const KeyType& key)
+    {
+        return StdKeyHash<KeyType>::hash(key == 0 ? KeyType(0) : key);
+    }
+};
+
+
+/// \brief KeyHash for string keys.
+template<>
+struct KeyHash<std::string>
+{
+    static std::uint64_t hash(const std::string& key)
+    {
+        return hashBytes(key.data(), key.size());
+    }
+};
+
+
+/// \brief Detects whether KeyHash supports a key type.
+///
+/// Code with a fallback for other key types can dispatch on this trait, so
+/// keys without a hash still compile.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType, typename Enable = void>
+struct IsKeyHashable: public std::false_type
+{
+};
+
+
+/// \brief IsKeyHashable for key types supported by KeyHash.
+template<typename KeyType>
+struct IsKeyHashable<KeyType, typename std::enable_if<std::is_same<decltype(KeyHash<KeyType>::hash(std::declval<const KeyType&>())), std::uint64_t>::value>::type>: public std::true_type
+{
+};
+
+
+/// \brief A key that carries its precomputed 64-bit hash.
+///
+/// The hash is computed once, when the key is created. Caches keyed by a
+/// HashedKey compare hashes before keys, and resource caches use the hash to
+/// track requests, so polling the progress or state of a request does no
+/// hashing or string building at all, e.g.
+///
+///     BaseResourceCache<HashedKey<std::string>, ofBuffer>* cache;
+///     HashedKey<std::string> key("images/tile_0_0.png");
+///     cache->request(key);
+///     float progress = cache->requestProgress(key);
+///
+/// \tparam KeyType The wrapped key type.
+template<typename KeyType>
+class HashedKey
+{
+public:
+    /// \brief Create a HashedKey with a default constructed key.
+    HashedKey(): _hash(KeyHash<KeyType>::hash(_key))
+    {
+    }
+
+    /// \brief Create a HashedKey.
+    /// \param key The key to wrap.
+    HashedKey(const KeyType& key): _key(key), _hash(KeyHash<KeyType>::hash(_key))
+    {
+    }
+
+    /// \brief Create a HashedKey.
+    /// \param key The key to wrap.
+    HashedKey(KeyType&& key): _key(std::move(key)), _hash(KeyHash<KeyType>::hash(_key))
+    {
+    }
+
+    /// \brief Create a HashedKey from anything the key can be made from.
+    /// \param key The key to wrap, e.g. a string literal.
+    template<typename T,
+             typename std::enable_if<std::is_constructible<KeyType, const T&>::value
+                                  && !std::is_same<typename std::decay<T>::type, KeyType>::value
+                                  && !std::is_same<typename std::decay<T>::type, HashedKey>::value, int>::type = 0>
+    HashedKey(const T& key): HashedKey(KeyType(key))
+    {
+    }
+
+    /// \returns the wrapped key.
+    const KeyType& key() const
+    {
+        return _key;
+    }
+
+    /// \returns the precomputed hash of the key.
+    std::uint64_t hash() const
+    {
+        return _hash;
+    }
+
+    /// \returns the wrapped key.
+    operator const KeyType&() const
+    {
+        return _key;
+    }
+
+    bool operator == (const HashedKey& other) const
+    {
+        return _hash == other._hash && _key == other._key;
+    }
+
+    bool operator != (const HashedKey& other) const
+    {
+        return !(*this == other);
+    }
+
+    /// \brief Order by hash, then by key.
+    bool operator < (const HashedKey& other) const
+    {
+        return _hash != other._hash ? _hash < other._hash : _key < other._key;
+    }
+
+private:
+    KeyType _key;
+    std::uint64_t _hash = 0;
+
+};
+
+
+/// \brief KeyHash for keys that carry their hash.
+template<typename KeyType>
+struct KeyHash<HashedKey<KeyType>>
+{
+    static std::uint64_t hash(const HashedKey<KeyType>& key)
+    {
+        return key.hash();
+    }
+};
+
+
+/// \brief KeySerializer for keys that carry their hash.
+///
+/// Only the wrapped key is written. The hash is recomputed on read.
+template<typename KeyType>
+struct KeySerializer<HashedKey<KeyType>>
+{
+    static void write(std::ostream& stream, const HashedKey<KeyType>& key)
+    {
+        KeySerializer<KeyType>::write(stream, key.key());
+    }
+
+    static bool read(std::istream& stream, HashedKey<KeyType>& key)
+    {
+        KeyType value;
+
+        if (!KeySerializer<KeyType>::read(stream, value))
+        {
+            return false;
+        }
+
+        key = HashedKey<KeyType>(std::move(value));
+        return true;
+    }
+};
+
+
+} } // namespace ofx::Cache
+
+
+namespace std {
+
+
+template<typename KeyType>
+struct hash<ofx::Cache::HashedKey<KeyType>>
+{
+    std::size_t operator()(const ofx::Cache::HashedKey<KeyType>& key) const
+    {
+        return static_cast<std::size_t>(key.hash());
+    }
+};
+
+
+} // namespace std
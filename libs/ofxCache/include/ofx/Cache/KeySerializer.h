@@ -0,0 +1,128 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Writes and reads keys in a compact binary form.
+///
+/// Arithmetic types and std::string are supported out of the box. Other key
+/// types can be supported by specializing this template.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType, typename Enable = void>
+struct KeySerializer;
+
+
+/// \brief A KeySerializer for arithmetic keys.
+///
+/// Keys are written in host byte order.
+template<typename KeyType>
+struct KeySerializer<KeyType, typename std::enable_if<std::is_arithmetic<KeyType>::value>::type>
+{
+    /// \brief Write a key to a stream.
+    /// \param stream The stream to write to.
+    /// \param key The key to write.
+    static void write(std::ostream& stream, const KeyType& key)
+    {
+        stream.write(reinterpret_cast<const char*>(&key), sizeof(KeyType));
+    }
+
+    /// \brief Read a key from a stream.
+    /// \param stream The stream to read from.
+    /// \param key The key to read into.
+    /// \returns true if a complete key was read.
+    static bool read(std::istream& stream, KeyType& key)
+    {
+        return static_cast<bool>(stream.read(reinterpret_cast<char*>(&key), sizeof(KeyType)));
+    }
+};
+
+
+/// \brief A KeySerializer for string keys.
+///
+/// Keys are written as a 32-bit length followed by the characters. Lengths
+/// beyond the end of the stream or MAXIMUM_SIZE fail the read, so a corrupt
+/// length never allocates.
+template<>
+struct KeySerializer<std::string>
+{
+    enum
+    {
+        /// \brief The maximum number of characters read for a key.
+        MAXIMUM_SIZE = 1024 * 1024
+    };
+
+    /// \brief Write a key to a stream.
+    /// \param stream The stream to write to.
+    /// \param key The key to write.
+    static void write(std::ostream& stream, const std::string& key)
+    {
+        uint32_t size = static_cast<uint32_t>(key.size());
+        stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        stream.write(key.data(), size);
+    }
+
+    /// \brief Read a key from a stream.
+    /// \param stream The stream to read from.
+    /// \param key The key to read into.
+    /// \returns true if a complete key was read.
+    static bool read(std::istream& stream, std::string& key)
+    {
+        uint32_t size = 0;
+
+        if (!stream.read(reinterpret_cast<char*>(&size), sizeof(size)))
+        {
+            return false;
+        }
+
+        if (size > remaining(stream))
+        {
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+
+        key.resize(size);
+        return size == 0 || static_cast<bool>(stream.read(&key[0], size));
+    }
+
+private:
+    /// \returns the number of characters left in the stream, at most
+    /// MAXIMUM_SIZE.
+    static uint32_t remaining(std::istream& stream)
+    {
+        std::istream::pos_type position = stream.tellg();
+
+        // Streams that can't seek are only bounded by the maximum.
+        if (position == std::istream::pos_type(-1) || !stream.seekg(0, std::ios::end))
+        {
+            stream.clear();
+            return MAXIMUM_SIZE;
+        }
+
+        std::istream::pos_type end = stream.tellg();
+        stream.seekg(position);
+
+        std::streamoff size = end - position;
+        return static_cast<uint32_t>(std::max<std::streamoff>(0, std::min<std::streamoff>(size, MAXIMUM_SIZE)));
+    }
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <string>
+#include <type_traits>
+
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define OFX_CACHE_HAS_STRING_VIEW 1
+#else
+#define OFX_CACHE_HAS_STRING_VIEW 0
+#endif
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Describes how keys can be looked up without constructing them.
+///
+/// LookupType is a cheap view of a key that stores can search with directly.
+/// When it differs from KeyType, stores accept any type convertible to
+/// LookupType in has() and get(), so that e.g. string literals don't create
+/// a temporary std::string on the hit path.
+///
+/// By default LookupType is a reference to the key. With C++17, std::string
+/// keys are looked up with std::string_view.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+struct KeyTraits
+{
+    /// \brief The type used to look up keys.
+    typedef const KeyType& LookupType;
+
+    /// \brief Convert a lookup key to a key.
+    static const KeyType& toKey(LookupType key)
+    {
+        return key;
+    }
+};
+
+
+#if OFX_CACHE_HAS_STRING_VIEW
+
+/// \brief KeyTraits for string keys.
+template<>
+struct KeyTraits<std::string>
+{
+    typedef std::string_view LookupType;
+
+    static std::string toKey(LookupType key)
+    {
+        return std::string(key);
+    }
+};
+
+#endif
+
+
+/// \brief True if LookupKey can be used for a heterogeneous lookup of KeyType.
+template<typename KeyType, typename LookupKey>
+struct IsLookupKey: std::integral_constant<bool,
+    !std::is_same<typename KeyTraits<KeyType>::LookupType, const KeyType&>::value
+ && !std::is_same<typename std::decay<LookupKey>::type, KeyType>::value
+ && std::is_convertible<const LookupKey&, typename KeyTraits<KeyType>::LookupType>::value>
+{
+};
+
+
+} } // namespace ofx::Cache
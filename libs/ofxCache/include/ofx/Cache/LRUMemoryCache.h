@@ -8,9 +8,25 @@
 #pragma once
 
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "Poco/Exception.h"
 #include "ofEvents.h"
-#include "ofx/LRUCache.h"
+#include "ofFileUtils.h"
 #include "ofx/Cache/BaseCache.h"
+#include "ofx/Cache/KeySerializer.h"
+#include "ofx/Cache/PoolAllocator.h"
+#include "ofx/Cache/ReadBuffer.h"
+#include "ofx/Cache/ValueSize.h"
 
 
 namespace ofx {
@@ -22,24 +38,226 @@ namespace Cache {
 /// An LRU (Least Recently Used) cache discards the least recently used elements
 /// first. Elements that are accessed frequently are kept in the cache.
 ///
+/// The keys of the cache (its "hot set") can be saved in recency order and
+/// used to warm a new cache from its child cache nodes, e.g. after a restart.
+/// Only keys are saved, values are reloaded from the child nodes.
+///
+/// The bytes held by the cache are estimated with ValueSize<ValueType>. In
+/// addition to the number of entries, the cache can be limited to a number
+/// of bytes.
+///
+/// Values in use elsewhere can be pinned with pin(). Pinned values are never
+/// evicted and their bytes are reported by pinnedBytes(), so eviction only
+/// considers memory that can actually be freed.
+///
+/// The list and index nodes of the cache, and values created with emplace()
+/// or added by const reference, are allocated with the Allocator. With a
+/// PoolAllocator, inserts reuse memory from a pool instead of the global heap.
+///
+/// Lookups only take a shared lock. Instead of reordering the entries, hits
+/// are recorded in a lossy ReadBuffer and replayed in batches under the
+/// exclusive lock, before every write or when a buffer fills up. Concurrent
+/// readers don't serialize, at the cost of a slightly approximate recency
+/// order when reads are dropped under contention.
+///
 /// \sa https://en.wikipedia.org/wiki/Cache_algorithms#Overview
 /// \tparam KeyType The key type.
 /// \tparam ValueType The value type (e.g. a std::shared_ptr<ValueType>).
-template<typename KeyType, typename ValueType>
+/// \tparam Allocator The allocator, rebound for each node type.
+template<typename KeyType, typename ValueType, typename Allocator = std::allocator<ValueType>>
 class LRUMemoryCache: public BaseCache<KeyType, ValueType>
 {
 public:
+    /// \brief A handle that keeps a cached value from being evicted.
+    ///
+    /// The value stays in the cache until every pin on it is released.
+    /// Removing the key or clearing the cache still drops it. Pins are
+    /// released when destroyed and must not outlive their cache.
+    class Pin
+    {
+    public:
+        /// \brief Create an empty Pin.
+        Pin()
+        {
+        }
+
+        Pin(Pin&& other) noexcept:
+            _cache(other._cache),
+            _key(std::move(other._key)),
+            _id(other._id),
+            _value(std::move(other._value))
+        {
+            other._cache = nullptr;
+        }
+
+        Pin& operator = (Pin&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                _cache = other._cache;
+                _key = std::move(other._key);
+                _id = other._id;
+                _value = std::move(other._value);
+                other._cache = nullptr;
+            }
+
+            return *this;
+        }
+
+        Pin(const Pin&) = delete;
+        Pin& operator = (const Pin&) = delete;
+
+        /// \brief Release the Pin.
+        ~Pin()
+        {
+            release();
+        }
+
+        /// \returns the value or nullptr if the key was not found.
+        std::shared_ptr<ValueType> value() const
+        {
+            return _value;
+        }
+
+        /// \returns true if the Pin holds a value.
+        explicit operator bool() const
+        {
+            return _value != nullptr;
+        }
+
+        /// \returns true if the value is protected from eviction.
+        ///
+        /// A value found in a child node but not promoted is returned
+        /// without being pinned.
+        bool isPinned() const
+        {
+            return _cache != nullptr;
+        }
+
+        /// \brief Unpin the value and drop the reference to it.
+        void release()
+        {
+            if (_cache != nullptr)
+            {
+                _cache->unpin(_key, _id);
+                _cache = nullptr;
+            }
+
+            _value.reset();
+        }
+
+    private:
+        Pin(LRUMemoryCache* cache,
+            const KeyType& key,
+            std::uint64_t id,
+            std::shared_ptr<ValueType> value):
+            _cache(cache),
+            _key(key),
+            _id(id),
+            _value(value)
+        {
+        }
+
+        LRUMemoryCache* _cache = nullptr;
+        KeyType _key;
+        std::uint64_t _id = 0;
+        std::shared_ptr<ValueType> _value = nullptr;
+
+        friend class LRUMemoryCache;
+
+    };
+
     /// \brief Create an LRUCache with the given size.
     /// \param size The size of the LRU cache.
-    LRUMemoryCache(std::size_t size = DEFAULT_CACHE_SIZE);
+    /// \param allocator The allocator.
+    /// \throws Poco::InvalidArgumentException if size is 0.
+    LRUMemoryCache(std::size_t size = DEFAULT_CACHE_SIZE,
+                   const Allocator& allocator = Allocator());
 
     /// \brief Destroy the memory cache.
     virtual ~LRUMemoryCache();
 
+    /// \returns the maximum number of elements stored in the cache.
+    std::size_t capacity() const;
+
+    /// \brief Limit the estimated bytes held by the cache.
+    ///
+    /// Pinned values count toward the limit but are not evicted, so the
+    /// cache may exceed it while values are pinned.
+    ///
+    /// \param maximumBytes The maximum number of bytes, or 0 for no limit.
+    void setMaximumBytes(std::size_t maximumBytes);
+
+    /// \returns the maximum number of bytes, or 0 if there is no limit.
+    std::size_t maximumBytes() const;
+
+    /// \brief Get a value and protect it from eviction.
+    ///
+    /// The value is looked up like get(), including child nodes.
+    ///
+    /// \param key The key to get.
+    /// \returns a Pin holding the value, or an empty Pin if the key missed.
+    Pin pin(const KeyType& key);
+
+    /// \returns the estimated bytes of the pinned values.
+    std::size_t pinnedBytes() const;
+
+    /// \returns the number of pinned values.
+    std::size_t pinnedCount() const;
+
+    /// \brief Construct a value with the allocator and cache it.
+    /// \param key The key to cache.
+    /// \param args The constructor arguments of the value.
+    /// \returns the cached value.
+    template<typename... Args>
+    std::shared_ptr<ValueType> emplace(const KeyType& key, Args&&... args);
+
+    /// \returns the allocator.
+    Allocator allocator() const;
+
+    /// \returns the keys in the cache, most recently used first.
+    std::vector<KeyType> keys() const;
+
+    /// \brief Save the keys in the cache, most recently used first.
+    ///
+    /// Keys are written with KeySerializer<KeyType>.
+    ///
+    /// \param path The path of the hot set file.
+    /// \param maximumKeys The maximum number of keys to save, or 0 for all.
+    /// \returns true if the file was written.
+    bool saveHotSet(const std::string& path, std::size_t maximumKeys = 0) const;
+
+    /// \brief Load the keys saved with saveHotSet().
+    /// \param path The path of the hot set file.
+    /// \returns the keys, most recently used first, or an empty list.
+    static std::vector<KeyType> loadHotSet(const std::string& path);
+
+    /// \brief Warm the cache from its child with a saved hot set.
+    /// \param path The path of the hot set file.
+    /// \param numThreads The number of threads used to query the child.
+    /// \returns the number of values loaded.
+    std::size_t warmFromHotSet(const std::string& path,
+                               std::size_t numThreads = DEFAULT_WARM_THREADS);
+
+    /// \brief Warm the cache from its child with the given keys.
+    ///
+    /// Values are loaded from the child cache node in parallel and added so
+    /// that the most recently used key ends up at the front of the cache. Keys
+    /// already present in this cache are left untouched.
+    ///
+    /// \param keys The keys to load, most recently used first.
+    /// \param numThreads The number of threads used to query the child.
+    /// \returns the number of values loaded.
+    std::size_t warm(const std::vector<KeyType>& keys,
+                     std::size_t numThreads = DEFAULT_WARM_THREADS);
+
     enum
     {
         /// \brief The default number of elements stored in the LRU cache.
-        DEFAULT_CACHE_SIZE = 2048
+        DEFAULT_CACHE_SIZE = 2048,
+        /// \brief The default number of threads used to warm the cache.
+        DEFAULT_WARM_THREADS = 8
     };
 
 protected:
@@ -51,71 +269,602 @@ protected:
     std::size_t doSize() override;
     void doClear() override;
 
-    /// \brief The underlying LRU cache implementation.
-    LRUCache<KeyType, ValueType> _LRUCache;
+    bool doHasLookup(typename BaseCache<KeyType, ValueType>::LookupType key) const override;
+    std::shared_ptr<ValueType> doGetLookup(typename BaseCache<KeyType, ValueType>::LookupType key) override;
+
+    std::shared_ptr<ValueType> makeEntry(const ValueType& entry) const override;
+
+    /// \brief A cached value and its estimated size.
+    struct Entry
+    {
+        KeyType key;
+        std::shared_ptr<ValueType> value;
+        std::size_t bytes;
+        /// \brief Identifies the entry to its pins.
+        std::uint64_t id;
+        /// \brief The number of pins on the entry.
+        std::size_t pins;
+    };
+
+    typedef std::allocator_traits<Allocator> AllocatorTraits;
+    typedef typename AllocatorTraits::template rebind_alloc<ValueType> ValueAllocator;
+    typedef std::list<Entry, typename AllocatorTraits::template rebind_alloc<Entry>> EntryList;
+    typedef std::map<KeyType,
+                     typename EntryList::iterator,
+                     std::less<>,
+                     typename AllocatorTraits::template rebind_alloc<std::pair<const KeyType, typename EntryList::iterator>>> EntryIndex;
+
+    /// \brief Replay the reads recorded since the last drain.
+    ///
+    /// The mutex must be held exclusively by the caller.
+    void drainReadsLocked() const;
+
+    /// \brief Remove the least recently used unpinned entries until under
+    /// capacity and under the byte limit.
+    ///
+    /// The mutex must be held by the caller.
+    void evictLocked();
+
+    /// \brief Release a pin taken with pin().
+    void unpin(const KeyType& key, std::uint64_t id);
+
+    /// \returns the list holding the given entry.
+    EntryList& listOf(const Entry& entry);
+
+    /// \param value The value to measure.
+    /// \returns the estimated size of the value.
+    static std::size_t sizeOf(const std::shared_ptr<ValueType>& value);
+
+    /// \brief The allocator.
+    Allocator _allocator;
+
+    /// \brief The unpinned entries, most recently used first.
+    ///
+    /// Mutable because draining buffered reads reorders it.
+    mutable EntryList _entries;
+
+    /// \brief The pinned entries, most recently pinned first.
+    EntryList _pinnedEntries;
+
+    /// \brief The entries indexed by key.
+    ///
+    /// The comparator is transparent, so lookups don't construct keys.
+    EntryIndex _index;
+
+    /// \brief The maximum number of entries.
+    std::size_t _capacity = DEFAULT_CACHE_SIZE;
+
+    /// \brief The maximum number of bytes, or 0.
+    std::size_t _maximumBytes = 0;
+
+    /// \brief The estimated bytes of the pinned entries.
+    std::size_t _pinnedBytes = 0;
+
+    /// \brief The id of the next entry.
+    std::uint64_t _nextEntryId = 0;
+
+    /// \brief Hits recorded under the shared lock, not yet applied to the
+    /// recency order.
+    mutable ReadBuffer<typename EntryList::iterator> _reads;
+
+    /// \brief The mutex protecting the entries.
+    ///
+    /// Lookups hold it shared, everything else exclusively.
+    mutable std::shared_timed_mutex _mutex;
+
+    /// \brief The hot set file signature.
+    static const char* hotSetSignature()
+    {
+        return "OFXCHOT1";
+    }
 
 };
 
 
-template<typename KeyType, typename ValueType>
-LRUMemoryCache<KeyType, ValueType>::LRUMemoryCache(std::size_t size):
-    _LRUCache(size)
+template<typename KeyType, typename ValueType, typename Allocator>
+LRUMemoryCache<KeyType, ValueType, Allocator>::LRUMemoryCache(std::size_t size,
+                                                               const Allocator& allocator):
+    _allocator(allocator),
+    _entries(typename EntryList::allocator_type(allocator)),
+    _pinnedEntries(typename EntryList::allocator_type(allocator)),
+    _index(typename EntryIndex::allocator_type(allocator)),
+    _capacity(size)
+{
+    if (_capacity == 0)
+    {
+        throw Poco::InvalidArgumentException("Size must be > 0");
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+LRUMemoryCache<KeyType, ValueType, Allocator>::~LRUMemoryCache()
+{
+    this->stopWriteBehind();
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::capacity() const
+{
+    return _capacity;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::setMaximumBytes(std::size_t maximumBytes)
 {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    _maximumBytes = maximumBytes;
+    evictLocked();
 }
 
 
-template<typename KeyType, typename ValueType>
-LRUMemoryCache<KeyType, ValueType>::~LRUMemoryCache()
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::maximumBytes() const
 {
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    return _maximumBytes;
 }
 
 
-template<typename KeyType, typename ValueType>
-bool LRUMemoryCache<KeyType, ValueType>::doHas(const KeyType& key) const
+template<typename KeyType, typename ValueType, typename Allocator>
+typename LRUMemoryCache<KeyType, ValueType, Allocator>::Pin LRUMemoryCache<KeyType, ValueType, Allocator>::pin(const KeyType& key)
 {
-    return _LRUCache.has(key);
+    auto value = this->get(key);
+
+    if (value == nullptr)
+    {
+        return Pin();
+    }
+
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    auto iter = _index.find(key);
+
+    // The value may come from a child or may have been replaced since.
+    if (iter == _index.end() || iter->second->value != value)
+    {
+        return Pin(nullptr, key, 0, value);
+    }
+
+    Entry& entry = *iter->second;
+
+    if (entry.pins++ == 0)
+    {
+        _pinnedEntries.splice(_pinnedEntries.begin(), _entries, iter->second);
+        _pinnedBytes += entry.bytes;
+    }
+
+    return Pin(this, key, entry.id, value);
 }
 
 
-template<typename KeyType, typename ValueType>
-std::shared_ptr<ValueType> LRUMemoryCache<KeyType, ValueType>::doGet(const KeyType& key)
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::pinnedBytes() const
 {
-    return _LRUCache.get(key);
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    return _pinnedBytes;
 }
 
 
-template<typename KeyType, typename ValueType>
-void LRUMemoryCache<KeyType, ValueType>::doAdd(const KeyType& key, std::shared_ptr<ValueType> entry)
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::pinnedCount() const
 {
-    _LRUCache.add(key, entry);
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    return _pinnedEntries.size();
 }
 
 
-template<typename KeyType, typename ValueType>
-void LRUMemoryCache<KeyType, ValueType>::doUpdate(const KeyType& key, std::shared_ptr<ValueType> entry)
+template<typename KeyType, typename ValueType, typename Allocator>
+template<typename... Args>
+std::shared_ptr<ValueType> LRUMemoryCache<KeyType, ValueType, Allocator>::emplace(const KeyType& key, Args&&... args)
 {
-    _LRUCache.update(key, entry);
+    auto entry = std::allocate_shared<ValueType>(ValueAllocator(_allocator), std::forward<Args>(args)...);
+    this->add(key, entry);
+    return entry;
 }
 
 
-template<typename KeyType, typename ValueType>
-void LRUMemoryCache<KeyType, ValueType>::doRemove(const KeyType& key)
+template<typename KeyType, typename ValueType, typename Allocator>
+Allocator LRUMemoryCache<KeyType, ValueType, Allocator>::allocator() const
 {
-    _LRUCache.remove(key);
+    return _allocator;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::vector<KeyType> LRUMemoryCache<KeyType, ValueType, Allocator>::keys() const
+{
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    std::vector<KeyType> result;
+    result.reserve(_pinnedEntries.size() + _entries.size());
+
+    // Pinned values are in use, so they are the most recently used.
+    for (const auto& entry: _pinnedEntries)
+    {
+        result.push_back(entry.key);
+    }
+
+    for (const auto& entry: _entries)
+    {
+        result.push_back(entry.key);
+    }
+
+    return result;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+bool LRUMemoryCache<KeyType, ValueType, Allocator>::saveHotSet(const std::string& path,
+                                                    std::size_t maximumKeys) const
+{
+    auto hotSet = keys();
+
+    if (maximumKeys > 0 && hotSet.size() > maximumKeys)
+    {
+        hotSet.resize(maximumKeys);
+    }
+
+    // Write to a temporary file so an interrupted save keeps the old hot set.
+    std::string finalPath = ofToDataPath(path, true);
+    std::string temporaryPath = finalPath + ".tmp";
+
+    {
+        std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!stream)
+        {
+            ofLogError("LRUMemoryCache::saveHotSet") << "Unable to open " << temporaryPath;
+            return false;
+        }
+
+        uint64_t count = hotSet.size();
+        stream.write(hotSetSignature(), 8);
+        stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const auto& key: hotSet)
+        {
+            KeySerializer<KeyType>::write(stream, key);
+        }
+
+        if (!stream)
+        {
+            ofLogError("LRUMemoryCache::saveHotSet") << "Unable to write " << temporaryPath;
+            return false;
+        }
+    }
+
+    return ofFile::moveFromTo(temporaryPath, finalPath, false, true);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::vector<KeyType> LRUMemoryCache<KeyType, ValueType, Allocator>::loadHotSet(const std::string& path)
+{
+    std::vector<KeyType> hotSet;
+    std::ifstream stream(ofToDataPath(path, true), std::ios::binary);
+
+    if (!stream)
+    {
+        return hotSet;
+    }
+
+    char signature[8];
+    uint64_t count = 0;
+
+    if (!stream.read(signature, 8)
+     || !std::equal(signature, signature + 8, hotSetSignature())
+     || !stream.read(reinterpret_cast<char*>(&count), sizeof(count)))
+    {
+        ofLogError("LRUMemoryCache::loadHotSet") << "Invalid hot set file " << path;
+        return hotSet;
+    }
+
+    KeyType key;
+
+    while (hotSet.size() < count && KeySerializer<KeyType>::read(stream, key))
+    {
+        hotSet.push_back(key);
+    }
+
+    return hotSet;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::warmFromHotSet(const std::string& path,
+                                                               std::size_t numThreads)
+{
+    return warm(loadHotSet(path), numThreads);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::warm(const std::vector<KeyType>& keys,
+                                                     std::size_t numThreads)
+{
+    auto child = this->childStore();
+
+    if (child == nullptr || keys.empty())
+    {
+        return 0;
+    }
+
+    // Values past the capacity would be evicted immediately.
+    std::size_t count = std::min(keys.size(), _capacity);
+    std::vector<std::shared_ptr<ValueType>> values(count);
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&]() {
+        std::size_t i = 0;
+
+        while ((i = next.fetch_add(1)) < count)
+        {
+            try
+            {
+                values[i] = child->get(keys[i]);
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("LRUMemoryCache::warm") << "Unable to load key: " << exc.what();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    numThreads = std::max(std::min(numThreads, count), std::size_t(1));
+
+    for (std::size_t i = 1; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread(worker));
+    }
+
+    worker();
+
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    std::size_t loaded = 0;
+
+    // Add the least recently used key first so the most recent ends up first.
+    for (std::size_t i = count; i-- > 0;)
+    {
+        if (values[i] != nullptr && !doHas(keys[i]))
+        {
+            this->onAdd.notify(this, std::make_pair(keys[i], values[i]));
+            doAdd(keys[i], values[i]);
+            ++loaded;
+        }
+    }
+
+    return loaded;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+bool LRUMemoryCache<KeyType, ValueType, Allocator>::doHas(const KeyType& key) const
+{
+    return doHasLookup(key);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::shared_ptr<ValueType> LRUMemoryCache<KeyType, ValueType, Allocator>::doGet(const KeyType& key)
+{
+    return doGetLookup(key);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+bool LRUMemoryCache<KeyType, ValueType, Allocator>::doHasLookup(typename BaseCache<KeyType, ValueType>::LookupType key) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    return _index.find(key) != _index.end();
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::shared_ptr<ValueType> LRUMemoryCache<KeyType, ValueType, Allocator>::doGetLookup(typename BaseCache<KeyType, ValueType>::LookupType key)
+{
+    std::shared_ptr<ValueType> value;
+    bool isBufferFull = false;
+
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+        auto iter = _index.find(key);
+
+        if (iter == _index.end())
+        {
+            return nullptr;
+        }
+
+        // Pinned entries are not in the recency order.
+        if (iter->second->pins == 0)
+        {
+            isBufferFull = _reads.record(iter->second);
+        }
+
+        value = iter->second->value;
+    }
+
+    if (isBufferFull)
+    {
+        // If a writer holds the lock, it drains the reads itself.
+        std::unique_lock<std::shared_timed_mutex> lock(_mutex, std::try_to_lock);
+
+        if (lock.owns_lock())
+        {
+            drainReadsLocked();
+        }
+    }
+
+    return value;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::shared_ptr<ValueType> LRUMemoryCache<KeyType, ValueType, Allocator>::makeEntry(const ValueType& entry) const
+{
+    return std::allocate_shared<ValueType>(ValueAllocator(_allocator), entry);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::doAdd(const KeyType& key, std::shared_ptr<ValueType> entry)
+{
+    std::size_t bytes = sizeOf(entry);
+
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    auto iter = _index.find(key);
+
+    if (iter != _index.end())
+    {
+        Entry& existing = *iter->second;
+        this->_counters.bytes -= existing.bytes;
+        this->_counters.bytes += bytes;
+
+        if (existing.pins > 0)
+        {
+            _pinnedBytes = _pinnedBytes - existing.bytes + bytes;
+        }
+        else
+        {
+            _entries.splice(_entries.begin(), _entries, iter->second);
+        }
+
+        existing.value = entry;
+        existing.bytes = bytes;
+        evictLocked();
+        return;
+    }
+
+    _entries.push_front(Entry { key, entry, bytes, _nextEntryId++, 0 });
+    _index[key] = _entries.begin();
+    this->_counters.bytes += bytes;
+
+    evictLocked();
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::doUpdate(const KeyType& key, std::shared_ptr<ValueType> entry)
+{
+    doAdd(key, entry);
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::doRemove(const KeyType& key)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    auto iter = _index.find(key);
+
+    if (iter != _index.end())
+    {
+        this->_counters.bytes -= iter->second->bytes;
+
+        if (iter->second->pins > 0)
+        {
+            _pinnedBytes -= iter->second->bytes;
+        }
+
+        listOf(*iter->second).erase(iter->second);
+        _index.erase(iter);
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::doSize()
+{
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    return _pinnedEntries.size() + _entries.size();
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::doClear()
+{
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    _reads.clear();
+    _index.clear();
+    _entries.clear();
+    _pinnedEntries.clear();
+    _pinnedBytes = 0;
+    this->_counters.bytes = 0;
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::drainReadsLocked() const
+{
+    // Entries are only erased under the exclusive lock, after a drain, so
+    // every buffered iterator is still valid.
+    _reads.drain([this](const typename EntryList::iterator& entry)
+    {
+        if (entry->pins == 0)
+        {
+            _entries.splice(_entries.begin(), _entries, entry);
+        }
+    });
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::evictLocked()
+{
+    while (!_entries.empty()
+        && (_pinnedEntries.size() + _entries.size() > _capacity
+         || (_maximumBytes > 0 && this->_counters.bytes > _maximumBytes)))
+    {
+        this->_counters.bytes -= _entries.back().bytes;
+        CacheCounters::increment(this->_counters.evictions);
+        _index.erase(_entries.back().key);
+        _entries.pop_back();
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename Allocator>
+void LRUMemoryCache<KeyType, ValueType, Allocator>::unpin(const KeyType& key, std::uint64_t id)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    drainReadsLocked();
+    auto iter = _index.find(key);
+
+    // The pinned entry may have been removed, and the key added again.
+    if (iter == _index.end() || iter->second->id != id || iter->second->pins == 0)
+    {
+        return;
+    }
+
+    if (--iter->second->pins == 0)
+    {
+        _pinnedBytes -= iter->second->bytes;
+        _entries.splice(_entries.begin(), _pinnedEntries, iter->second);
+        evictLocked();
+    }
 }
 
 
-template<typename KeyType, typename ValueType>
-std::size_t LRUMemoryCache<KeyType, ValueType>::doSize()
+template<typename KeyType, typename ValueType, typename Allocator>
+typename LRUMemoryCache<KeyType, ValueType, Allocator>::EntryList& LRUMemoryCache<KeyType, ValueType, Allocator>::listOf(const Entry& entry)
 {
-    return _LRUCache.size();
+    return entry.pins > 0 ? _pinnedEntries : _entries;
 }
 
 
-template<typename KeyType, typename ValueType>
-void LRUMemoryCache<KeyType, ValueType>::doClear()
+template<typename KeyType, typename ValueType, typename Allocator>
+std::size_t LRUMemoryCache<KeyType, ValueType, Allocator>::sizeOf(const std::shared_ptr<ValueType>& value)
 {
-    _LRUCache.clear();
+    return value != nullptr ? ValueSize<ValueType>::size(*value) : 0;
 }
 
 
@@ -0,0 +1,262 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "ofJson.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A lock-free log-linear latency histogram.
+///
+/// Values are recorded in nanoseconds. Like an HDR histogram, each power of
+/// two range is split into SUB_BUCKET_COUNT linear buckets, so percentiles
+/// are reported with a relative error below 1 / SUB_BUCKET_COUNT across the
+/// full 64 bit range while using a fixed amount of memory.
+///
+/// Recording is a handful of relaxed atomic operations and may be done from
+/// any number of threads. Queries read the buckets without locking and may
+/// miss values recorded concurrently.
+class LatencyHistogram
+{
+public:
+    /// \brief Record a value.
+    /// \param nanoseconds The value to record.
+    void record(uint64_t nanoseconds)
+    {
+        _buckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        uint64_t maximum = _maximum.load(std::memory_order_relaxed);
+
+        while (nanoseconds > maximum
+           && !_maximum.compare_exchange_weak(maximum, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /// \returns the number of recorded values.
+    uint64_t count() const
+    {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+    /// \returns the mean of the recorded values in nanoseconds.
+    double mean() const
+    {
+        auto n = count();
+        return n > 0 ? double(_sum.load(std::memory_order_relaxed)) / double(n) : 0;
+    }
+
+    /// \returns the largest recorded value in nanoseconds.
+    uint64_t maximum() const
+    {
+        return _maximum.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Get the value at a percentile.
+    /// \param percentile The percentile in the range [0, 1].
+    /// \returns the upper bound of the bucket holding the percentile, in
+    /// nanoseconds, or 0 if nothing was recorded.
+    uint64_t percentile(double percentile) const
+    {
+        uint64_t total = 0;
+
+        for (const auto& bucket: _buckets)
+        {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        uint64_t target = std::max<uint64_t>(1, uint64_t(percentile * total + 0.5));
+        uint64_t seen = 0;
+
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            seen += _buckets[i].load(std::memory_order_relaxed);
+
+            if (seen >= target)
+            {
+                return std::min(bucketUpperBound(i), maximum());
+            }
+        }
+
+        return maximum();
+    }
+
+    /// \brief Clear all recorded values.
+    void reset()
+    {
+        for (auto& bucket: _buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+
+        _count.store(0, std::memory_order_relaxed);
+        _sum.store(0, std::memory_order_relaxed);
+        _maximum.store(0, std::memory_order_relaxed);
+    }
+
+    /// \returns a summary of the histogram as JSON.
+    ofJson toJson() const
+    {
+        ofJson json;
+        json["count"] = count();
+        json["mean"] = mean();
+        json["p50"] = percentile(0.5);
+        json["p90"] = percentile(0.9);
+        json["p99"] = percentile(0.99);
+        json["p999"] = percentile(0.999);
+        json["max"] = maximum();
+        return json;
+    }
+
+    enum
+    {
+        /// \brief The number of bits used for the linear sub-buckets.
+        SUB_BUCKET_BITS = 4,
+        /// \brief The number of linear buckets in each power of two range.
+        SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+        /// \brief The total number of buckets needed for 64 bit values.
+        BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT
+    };
+
+private:
+    static std::size_t bucketIndex(uint64_t value)
+    {
+        // Values below 2 * SUB_BUCKET_COUNT are stored exactly.
+        if (value < 2 * SUB_BUCKET_COUNT)
+        {
+            return std::size_t(value);
+        }
+
+        std::size_t shift = mostSignificantBit(value) - SUB_BUCKET_BITS;
+        return shift * SUB_BUCKET_COUNT + std::size_t(value >> shift);
+    }
+
+    static uint64_t bucketUpperBound(std::size_t index)
+    {
+        if (index < 2 * SUB_BUCKET_COUNT)
+        {
+            return index;
+        }
+
+        std::size_t shift = index / SUB_BUCKET_COUNT - 1;
+        uint64_t top = index - shift * SUB_BUCKET_COUNT;
+        return ((top + 1) << shift) - 1;
+    }
+
+    static std::size_t mostSignificantBit(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        std::size_t bit = 0;
+
+        for (std::size_t step = 32; step > 0; step /= 2)
+        {
+            if (value >> step)
+            {
+                value >>= step;
+                bit += step;
+            }
+        }
+
+        return bit;
+#endif
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> _buckets {};
+    std::atomic<uint64_t> _count { 0 };
+    std::atomic<uint64_t> _sum { 0 };
+    std::atomic<uint64_t> _maximum { 0 };
+
+};
+
+
+/// \brief The latency histograms of one cache node.
+class CacheLatency
+{
+public:
+    /// \brief The latency of doGet() on this node, excluding child nodes.
+    LatencyHistogram get;
+
+    /// \brief The latency of doHas() on this node.
+    LatencyHistogram has;
+
+    /// \brief The latency of doAdd() on this node.
+    LatencyHistogram add;
+
+    /// \brief Clear all histograms.
+    void reset()
+    {
+        get.reset();
+        has.reset();
+        add.reset();
+    }
+
+    /// \returns the histograms as JSON.
+    ofJson toJson() const
+    {
+        ofJson json;
+        json["get"] = get.toJson();
+        json["has"] = has.toJson();
+        json["add"] = add.toJson();
+        return json;
+    }
+
+};
+
+
+/// \brief Records the lifetime of a scope into a LatencyHistogram.
+///
+/// Nothing is measured if the histogram is nullptr.
+class ScopedLatency
+{
+public:
+    /// \brief Start timing.
+    /// \param histogram The histogram to record into, or nullptr.
+    ScopedLatency(LatencyHistogram* histogram): _histogram(histogram)
+    {
+        if (_histogram != nullptr)
+        {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    /// \brief Stop timing and record.
+    ~ScopedLatency()
+    {
+        if (_histogram != nullptr)
+        {
+            auto elapsed = std::chrono::steady_clock::now() - _start;
+            _histogram->record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+    }
+
+private:
+    LatencyHistogram* _histogram = nullptr;
+    std::chrono::steady_clock::time_point _start;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,371 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "ofLog.h"
+#include "ofx/Cache/HashedKey.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A compact, probabilistic set of key hashes.
+///
+/// A filter answers whether a key might be present. A negative answer is
+/// certain, so a slow store can answer misses without any I/O. A positive
+/// answer may be false and must be confirmed by the store.
+///
+/// Keys are inserted by their 64-bit hash, see KeyHash. Filters are
+/// thread-safe.
+class BaseMembershipFilter
+{
+public:
+    /// \brief Destroy the BaseMembershipFilter.
+    virtual ~BaseMembershipFilter()
+    {
+    }
+
+    /// \brief Insert a key hash.
+    /// \param hash The hash of the key.
+    virtual void insert(std::uint64_t hash) = 0;
+
+    /// \brief Remove a key hash that was inserted.
+    ///
+    /// Removing a hash that was never inserted may cause false negatives.
+    ///
+    /// \param hash The hash of the key.
+    /// \returns true if the hash was removed, false if the filter doesn't
+    /// support removal.
+    virtual bool remove(std::uint64_t hash) = 0;
+
+    /// \param hash The hash of the key.
+    /// \returns false if the key is certainly absent.
+    virtual bool mightContain(std::uint64_t hash) const = 0;
+
+    /// \brief Remove all key hashes.
+    virtual void clear() = 0;
+
+    /// \returns true if remove() is supported.
+    virtual bool canRemove() const = 0;
+
+};
+
+
+/// \brief A Bloom filter.
+///
+/// Inserts and lookups are lock-free. Keys can't be removed, so keys removed
+/// from the store remain false positives until the filter is rebuilt.
+///
+/// \sa https://en.wikipedia.org/wiki/Bloom_filter
+class BloomFilter: public BaseMembershipFilter
+{
+public:
+    /// \brief Create a BloomFilter.
+    /// \param expectedCount The number of keys the filter is sized for.
+    /// \param falsePositiveRate The false positive rate at expectedCount.
+    BloomFilter(std::size_t expectedCount,
+                double falsePositiveRate = DEFAULT_FALSE_POSITIVE_RATE)
+    {
+        double count = static_cast<double>(std::max<std::size_t>(expectedCount, 1));
+        double rate = std::min(std::max(falsePositiveRate, 1e-9), 0.5);
+        double ln2 = std::log(2.0);
+        double bits = std::ceil(-count * std::log(rate) / (ln2 * ln2));
+
+        _wordCount = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(bits / 64)));
+        _bitCount = _wordCount * 64;
+        _hashCount = std::min<std::size_t>(MAXIMUM_HASH_COUNT,
+                                           std::max<std::size_t>(1, static_cast<std::size_t>(std::round(_bitCount / count * ln2))));
+        _words.reset(new std::atomic<std::uint64_t>[_wordCount]);
+        clear();
+    }
+
+    void insert(std::uint64_t hash) override
+    {
+        std::uint64_t step = mixHash(hash) | 1;
+
+        for (std::size_t i = 0; i < _hashCount; ++i, hash += step)
+        {
+            std::uint64_t bit = hash % _bitCount;
+            _words[bit / 64].fetch_or(std::uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+    }
+
+    bool remove(std::uint64_t) override
+    {
+        return false;
+    }
+
+    bool mightContain(std::uint64_t hash) const override
+    {
+        std::uint64_t step = mixHash(hash) | 1;
+
+        for (std::size_t i = 0; i < _hashCount; ++i, hash += step)
+        {
+            std::uint64_t bit = hash % _bitCount;
+
+            if ((_words[bit / 64].load(std::memory_order_relaxed) & (std::uint64_t(1) << (bit % 64))) == 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void clear() override
+    {
+        for (std::size_t i = 0; i < _wordCount; ++i)
+        {
+            _words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    bool canRemove() const override
+    {
+        return false;
+    }
+
+    /// \returns the number of bits of the filter.
+    std::size_t bitCount() const
+    {
+        return _bitCount;
+    }
+
+    /// \returns the number of bits set per key.
+    std::size_t hashCount() const
+    {
+        return _hashCount;
+    }
+
+    enum
+    {
+        /// \brief The maximum number of bits set per key.
+        MAXIMUM_HASH_COUNT = 16
+    };
+
+    /// \brief The default false positive rate.
+    static constexpr double DEFAULT_FALSE_POSITIVE_RATE = 0.01;
+
+private:
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _words;
+    std::size_t _wordCount = 0;
+    std::size_t _bitCount = 0;
+    std::size_t _hashCount = 0;
+
+};
+
+
+/// \brief A cuckoo filter.
+///
+/// Stores a 16-bit fingerprint per key in buckets of four, for a false
+/// positive rate of about 0.01%. Unlike a BloomFilter, keys can be removed.
+///
+/// If the filter overflows, it answers that every key might be present
+/// until it is cleared, so it never gives false negatives.
+///
+/// \sa https://www.cs.cmu.edu/~dga/papers/cuckoo-conext2014.pdf
+class CuckooFilter: public BaseMembershipFilter
+{
+public:
+    /// \brief Create a CuckooFilter.
+    /// \param expectedCount The number of keys the filter is sized for.
+    CuckooFilter(std::size_t expectedCount)
+    {
+        // Buckets fill to about 95% before inserts start to fail.
+        std::size_t bucketCount = 1;
+
+        while (bucketCount * BUCKET_SIZE * 95 < expectedCount * 100)
+        {
+            bucketCount *= 2;
+        }
+
+        _buckets.resize(bucketCount);
+        _mask = bucketCount - 1;
+    }
+
+    void insert(std::uint64_t hash) override
+    {
+        std::uint16_t fingerprint = fingerprintOf(hash);
+        std::size_t index = hash & _mask;
+
+        std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+
+        if (_isOverflowed)
+        {
+            return;
+        }
+
+        if (_buckets[index].insert(fingerprint)
+         || _buckets[alternateIndex(index, fingerprint)].insert(fingerprint))
+        {
+            return;
+        }
+
+        // Relocate fingerprints to their alternate buckets to make room.
+        std::uint64_t random = mixHash(hash);
+
+        for (std::size_t kick = 0; kick < MAXIMUM_KICKS; ++kick)
+        {
+            random = mixHash(random);
+            std::swap(fingerprint, _buckets[index].fingerprints[random % BUCKET_SIZE]);
+            index = alternateIndex(index, fingerprint);
+
+            if (_buckets[index].insert(fingerprint))
+            {
+                return;
+            }
+        }
+
+        // The evicted fingerprint is lost, so every answer becomes "maybe".
+        ofLogWarning("CuckooFilter::insert") << "The filter is full, resize it and rebuild.";
+        _isOverflowed = true;
+    }
+
+    bool remove(std::uint64_t hash) override
+    {
+        std::uint16_t fingerprint = fingerprintOf(hash);
+        std::size_t index = hash & _mask;
+
+        std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+
+        if (!_isOverflowed)
+        {
+            if (!_buckets[index].remove(fingerprint))
+            {
+                _buckets[alternateIndex(index, fingerprint)].remove(fingerprint);
+            }
+        }
+
+        return true;
+    }
+
+    bool mightContain(std::uint64_t hash) const override
+    {
+        std::uint16_t fingerprint = fingerprintOf(hash);
+        std::size_t index = hash & _mask;
+
+        std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+
+        return _isOverflowed
+            || _buckets[index].contains(fingerprint)
+            || _buckets[alternateIndex(index, fingerprint)].contains(fingerprint);
+    }
+
+    void clear() override
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+        std::fill(_buckets.begin(), _buckets.end(), Bucket());
+        _isOverflowed = false;
+    }
+
+    bool canRemove() const override
+    {
+        return true;
+    }
+
+    /// \returns true if an insert failed and the filter must be rebuilt.
+    bool isOverflowed() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+        return _isOverflowed;
+    }
+
+    /// \returns the number of keys the filter can hold.
+    std::size_t capacity() const
+    {
+        return _buckets.size() * BUCKET_SIZE;
+    }
+
+    enum
+    {
+        /// \brief The number of fingerprints per bucket.
+        BUCKET_SIZE = 4,
+        /// \brief The number of relocations before an insert fails.
+        MAXIMUM_KICKS = 500
+    };
+
+private:
+    struct Bucket
+    {
+        /// \brief The fingerprints, 0 is an empty slot.
+        std::uint16_t fingerprints[BUCKET_SIZE] = { 0, 0, 0, 0 };
+
+        bool insert(std::uint16_t fingerprint)
+        {
+            for (auto& slot: fingerprints)
+            {
+                if (slot == 0)
+                {
+                    slot = fingerprint;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool remove(std::uint16_t fingerprint)
+        {
+            for (auto& slot: fingerprints)
+            {
+                if (slot == fingerprint)
+                {
+                    slot = 0;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool contains(std::uint16_t fingerprint) const
+        {
+            for (auto slot: fingerprints)
+            {
+                if (slot == fingerprint)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+    };
+
+    static std::uint16_t fingerprintOf(std::uint64_t hash)
+    {
+        // Use the high bits, the low bits select the bucket.
+        std::uint16_t fingerprint = static_cast<std::uint16_t>(hash >> 48);
+        return fingerprint != 0 ? fingerprint : 1;
+    }
+
+    /// \brief The other bucket of a fingerprint, in both directions.
+    std::size_t alternateIndex(std::size_t index, std::uint16_t fingerprint) const
+    {
+        return (index ^ static_cast<std::size_t>(mixHash(fingerprint))) & _mask;
+    }
+
+    std::vector<Bucket> _buckets;
+    std::size_t _mask = 0;
+    bool _isOverflowed = false;
+    mutable std::shared_timed_mutex _mutex;
+
+};
+
+
+} } // namespace ofx::Cache
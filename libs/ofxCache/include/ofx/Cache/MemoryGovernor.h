@@ -0,0 +1,552 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ofJson.h"
+#include "ofLog.h"
+#include "ofx/Cache/CacheStatistics.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Shares one memory budget between several caches.
+///
+/// Caches register with the governor, which splits a total byte budget
+/// between them and applies each share with setMaximumBytes(). The shares are
+/// rebalanced periodically: memory moves from the cache that gets the fewest
+/// hits per byte it holds to the full cache that misses the most per byte it
+/// is allowed, e.g.
+///
+///     auto& governor = MemoryGovernor::instance();
+///     governor.setTotalBytes(512 * 1024 * 1024);
+///     auto textures = governor.add("textures", textureCache);
+///     auto json = governor.add("json", jsonCache);
+///
+/// Caches are unregistered when their Registration is destroyed, which must
+/// happen before the cache is destroyed.
+///
+/// When the platform signals memory pressure, setMemoryPressure() shrinks
+/// every cache until the pressure is cleared.
+///
+/// The callbacks of the caches are never called under the governor's lock,
+/// so they may use the governor, and a slow cache doesn't stall the others.
+class MemoryGovernor
+{
+public:
+    /// \brief A cache as seen by the governor.
+    struct Consumer
+    {
+        /// \brief The name used in toJson().
+        std::string name;
+
+        /// \brief Returns the counters of the cache, including its bytes.
+        std::function<CacheStatistics()> statistics;
+
+        /// \brief Applies a byte limit to the cache.
+        std::function<void(std::size_t)> setMaximumBytes;
+
+        /// \brief The smallest budget the cache is shrunk to by rebalancing.
+        std::size_t minimumBytes = 0;
+    };
+
+    /// \brief Keeps a cache registered until destroyed.
+    class Registration
+    {
+    public:
+        Registration()
+        {
+        }
+
+        Registration(Registration&& other) noexcept:
+            _governor(other._governor),
+            _id(other._id)
+        {
+            other._governor = nullptr;
+        }
+
+        Registration& operator = (Registration&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                _governor = other._governor;
+                _id = other._id;
+                other._governor = nullptr;
+            }
+
+            return *this;
+        }
+
+        Registration(const Registration&) = delete;
+        Registration& operator = (const Registration&) = delete;
+
+        ~Registration()
+        {
+            reset();
+        }
+
+        /// \brief Unregister the cache. Its last byte limit stays in effect.
+        void reset()
+        {
+            if (_governor != nullptr)
+            {
+                _governor->remove(_id);
+                _governor = nullptr;
+            }
+        }
+
+    private:
+        Registration(MemoryGovernor* governor, std::uint64_t id):
+            _governor(governor),
+            _id(id)
+        {
+        }
+
+        MemoryGovernor* _governor = nullptr;
+        std::uint64_t _id = 0;
+
+        friend class MemoryGovernor;
+
+    };
+
+    /// \brief Create a MemoryGovernor.
+    /// \param totalBytes The budget shared by all caches.
+    /// \param rebalanceInterval The time between rebalances, or 0 to only
+    /// rebalance when rebalance() is called.
+    MemoryGovernor(std::size_t totalBytes = DEFAULT_TOTAL_BYTES,
+                   std::chrono::milliseconds rebalanceInterval = std::chrono::milliseconds(DEFAULT_REBALANCE_INTERVAL_MILLISECONDS)):
+        _totalBytes(totalBytes),
+        _rebalanceInterval(rebalanceInterval),
+        _thread(&MemoryGovernor::run, this)
+    {
+    }
+
+    MemoryGovernor(const MemoryGovernor&) = delete;
+    MemoryGovernor& operator = (const MemoryGovernor&) = delete;
+
+    /// \brief Destroy the MemoryGovernor.
+    ~MemoryGovernor()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _isRunning = false;
+        }
+
+        _condition.notify_all();
+        _thread.join();
+    }
+
+    /// \returns the process-wide governor.
+    static MemoryGovernor& instance()
+    {
+        static MemoryGovernor governor;
+        return governor;
+    }
+
+    /// \brief Register a cache.
+    ///
+    /// The new cache gets an equal share of the budget and the shares of the
+    /// other caches shrink proportionally.
+    ///
+    /// \param consumer The cache callbacks.
+    /// \returns the registration.
+    Registration add(Consumer consumer)
+    {
+        Entry entry;
+        entry.consumer = consumer;
+        entry.last = consumer.statistics();
+
+        std::uint64_t id = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            id = _nextId++;
+            std::size_t count = _consumers.size() + 1;
+
+            for (auto& iter: _consumers)
+            {
+                iter.second.budget = iter.second.budget / count * (count - 1);
+            }
+
+            entry.budget = _totalBytes / count;
+            _consumers.emplace(id, entry);
+        }
+
+        apply();
+        return Registration(this, id);
+    }
+
+    /// \brief Register a cache with setMaximumBytes() and statistics(),
+    /// e.g. an LRUMemoryCache.
+    /// \param name The name used in toJson().
+    /// \param cache The cache. It must outlive the registration.
+    /// \param minimumBytes The smallest budget of the cache.
+    /// \returns the registration.
+    template<typename CacheType>
+    Registration add(const std::string& name, CacheType& cache, std::size_t minimumBytes = 0)
+    {
+        Consumer consumer;
+        consumer.name = name;
+        consumer.statistics = [&cache]() { return cache.statistics(); };
+        consumer.setMaximumBytes = [&cache](std::size_t bytes) { cache.setMaximumBytes(bytes); };
+        consumer.minimumBytes = minimumBytes;
+        return add(consumer);
+    }
+
+    /// \brief Set the budget shared by all caches.
+    ///
+    /// The shares of the caches are scaled to the new total.
+    ///
+    /// \param totalBytes The total number of bytes.
+    void setTotalBytes(std::size_t totalBytes)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            for (auto& entry: _consumers)
+            {
+                entry.second.budget = _totalBytes > 0
+                                    ? static_cast<std::size_t>(entry.second.budget * (double(totalBytes) / double(_totalBytes)))
+                                    : totalBytes / _consumers.size();
+            }
+
+            _totalBytes = totalBytes;
+        }
+
+        apply();
+    }
+
+    /// \returns the budget shared by all caches.
+    std::size_t totalBytes() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _totalBytes;
+    }
+
+    /// \brief Shrink all caches in response to memory pressure.
+    ///
+    /// Call this from the platform's low memory notification, e.g. a memory
+    /// warning on iOS or onTrimMemory() on Android, and with 0 once the
+    /// pressure is gone.
+    ///
+    /// \param fraction The fraction of every cache's share to release, from
+    /// 0 for none to 1 for everything.
+    void setMemoryPressure(double fraction)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _memoryPressure = std::min(std::max(fraction, 0.0), 1.0);
+        }
+
+        apply();
+    }
+
+    /// \returns the fraction of the budget released due to memory pressure.
+    double memoryPressure() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _memoryPressure;
+    }
+
+    /// \brief Set the time between automatic rebalances.
+    /// \param rebalanceInterval The interval, or 0 to disable.
+    void setRebalanceInterval(std::chrono::milliseconds rebalanceInterval)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _rebalanceInterval = rebalanceInterval;
+        }
+
+        _condition.notify_all();
+    }
+
+    /// \brief Move part of the budget to the cache that benefits most.
+    ///
+    /// The benefit of growing a cache is estimated by its misses per byte of
+    /// budget since the last rebalance, and only if the cache has filled its
+    /// budget. The cost of shrinking a cache is estimated by its hits per
+    /// byte held. A step of the total budget moves from the cheapest cache
+    /// to the most beneficial one if the benefit exceeds the cost.
+    void rebalance()
+    {
+        std::unique_lock<std::mutex> callbackLock(_callbackMutex);
+
+        // Read the counters of the caches without holding the lock.
+        std::map<std::uint64_t, CacheStatistics> statistics;
+
+        for (const auto& consumer: consumers())
+        {
+            statistics[consumer.first] = consumer.second.statistics();
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        Entry* recipient = nullptr;
+        double highestBenefit = 0;
+
+        // Caches added since the counters were read wait for the next
+        // rebalance.
+        for (auto& iter: _consumers)
+        {
+            if (statistics.find(iter.first) == statistics.end())
+            {
+                continue;
+            }
+
+            Entry& entry = iter.second;
+            CacheStatistics current = statistics[iter.first];
+            double hits = double(current.hits - std::min(current.hits, entry.last.hits));
+            double misses = double(current.misses - std::min(current.misses, entry.last.misses));
+            entry.last = current;
+
+            entry.cost = hits / double(std::max<std::uint64_t>(current.bytes, 1));
+
+            bool isFull = current.bytes * 100 >= effectiveBudgetLocked(entry) * std::uint64_t(FULL_PERCENT);
+            double benefit = isFull ? misses / double(std::max<std::size_t>(entry.budget, 1)) : 0;
+
+            if (benefit > highestBenefit)
+            {
+                recipient = &entry;
+                highestBenefit = benefit;
+            }
+        }
+
+        Entry* donor = nullptr;
+
+        for (auto& iter: _consumers)
+        {
+            Entry& entry = iter.second;
+
+            if (&entry != recipient
+             && statistics.find(iter.first) != statistics.end()
+             && entry.budget > entry.consumer.minimumBytes
+             && (donor == nullptr || entry.cost < donor->cost))
+            {
+                donor = &entry;
+            }
+        }
+
+        if (donor == nullptr || recipient == nullptr || highestBenefit <= donor->cost)
+        {
+            return;
+        }
+
+        std::size_t step = std::min(_totalBytes * REBALANCE_STEP_PERCENT / 100,
+                                    donor->budget - donor->consumer.minimumBytes);
+        donor->budget -= step;
+        recipient->budget += step;
+
+        lock.unlock();
+        applyBudgets();
+    }
+
+    /// \returns the budget, bytes and counters of each cache.
+    ofJson toJson() const
+    {
+        std::unique_lock<std::mutex> callbackLock(_callbackMutex);
+
+        ofJson json;
+        std::vector<std::pair<Consumer, std::size_t>> budgets;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            json["totalBytes"] = _totalBytes;
+            json["memoryPressure"] = _memoryPressure;
+
+            for (const auto& iter: _consumers)
+            {
+                budgets.push_back(std::make_pair(iter.second.consumer, effectiveBudgetLocked(iter.second)));
+            }
+        }
+
+        json["caches"] = ofJson::array();
+
+        for (const auto& budget: budgets)
+        {
+            ofJson cache = budget.first.statistics().toJson();
+            cache["name"] = budget.first.name;
+            cache["budget"] = budget.second;
+            json["caches"].push_back(cache);
+        }
+
+        return json;
+    }
+
+    enum
+    {
+        /// \brief The default budget shared by all caches.
+        DEFAULT_TOTAL_BYTES = 256 * 1024 * 1024,
+        /// \brief The default time between rebalances.
+        DEFAULT_REBALANCE_INTERVAL_MILLISECONDS = 1000,
+        /// \brief The part of the total budget moved per rebalance.
+        REBALANCE_STEP_PERCENT = 5,
+        /// \brief A cache holding this part of its budget counts as full.
+        FULL_PERCENT = 90
+    };
+
+private:
+    struct Entry
+    {
+        Consumer consumer;
+        std::size_t budget = 0;
+        CacheStatistics last;
+        /// \brief The hits per byte held since the last rebalance.
+        double cost = 0;
+    };
+
+    void remove(std::uint64_t id)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            auto iter = _consumers.find(id);
+
+            if (iter == _consumers.end())
+            {
+                return;
+            }
+
+            _consumers.erase(iter);
+
+            // Give the freed share to the remaining caches.
+            std::size_t assigned = 0;
+
+            for (const auto& entry: _consumers)
+            {
+                assigned += entry.second.budget;
+            }
+
+            double scale = assigned > 0 ? double(_totalBytes) / double(assigned) : 0;
+
+            for (auto& entry: _consumers)
+            {
+                entry.second.budget = static_cast<std::size_t>(entry.second.budget * scale);
+            }
+        }
+
+        // Also waits for running callbacks, so the removed cache is never
+        // called once its registration is reset.
+        apply();
+    }
+
+    std::size_t effectiveBudgetLocked(const Entry& entry) const
+    {
+        return std::max<std::size_t>(static_cast<std::size_t>(entry.budget * (1.0 - _memoryPressure)), 1);
+    }
+
+    /// \returns a copy of the registered caches.
+    std::vector<std::pair<std::uint64_t, Consumer>> consumers() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<std::pair<std::uint64_t, Consumer>> result;
+
+        for (const auto& iter: _consumers)
+        {
+            result.push_back(std::make_pair(iter.first, iter.second.consumer));
+        }
+
+        return result;
+    }
+
+    /// \brief Apply the current budgets to the caches.
+    void apply()
+    {
+        std::unique_lock<std::mutex> callbackLock(_callbackMutex);
+        applyBudgets();
+    }
+
+    /// \brief Apply the current budgets to the caches.
+    ///
+    /// The callback mutex must be held by the caller. The budgets are read
+    /// while holding it, so the latest budgets are always applied last.
+    void applyBudgets()
+    {
+        std::vector<std::pair<Consumer, std::size_t>> budgets;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            for (const auto& iter: _consumers)
+            {
+                budgets.push_back(std::make_pair(iter.second.consumer, effectiveBudgetLocked(iter.second)));
+            }
+        }
+
+        for (const auto& budget: budgets)
+        {
+            try
+            {
+                budget.first.setMaximumBytes(budget.second);
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("MemoryGovernor::applyBudgets") << "Unable to set the budget of " << budget.first.name << ": " << exc.what();
+            }
+        }
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (_isRunning)
+        {
+            if (_rebalanceInterval.count() > 0)
+            {
+                _condition.wait_for(lock, _rebalanceInterval);
+            }
+            else
+            {
+                _condition.wait(lock);
+            }
+
+            if (_isRunning && _rebalanceInterval.count() > 0)
+            {
+                lock.unlock();
+                rebalance();
+                lock.lock();
+            }
+        }
+    }
+
+    std::map<std::uint64_t, Entry> _consumers;
+    std::uint64_t _nextId = 0;
+    std::size_t _totalBytes = DEFAULT_TOTAL_BYTES;
+    double _memoryPressure = 0;
+    std::chrono::milliseconds _rebalanceInterval;
+    bool _isRunning = true;
+
+    /// \brief Guards the caches and their budgets.
+    mutable std::mutex _mutex;
+
+    /// \brief Serializes the calls into the caches. Taken before the mutex.
+    mutable std::mutex _callbackMutex;
+
+    std::condition_variable _condition;
+    std::thread _thread;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,889 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include "ofx/Cache/ResourceLoader.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+class BasePipelinedResourceCache;
+
+
+/// \brief The first stage of a pipelined request.
+///
+/// The fetch task runs on the I/O queue, loads the raw value and hands it off
+/// to the decode queue. If the cache fetches asynchronously, see
+/// BasePipelinedResourceCache::fetchAsync(), the task only starts the fetch
+/// and the completion hands off the raw value.
+///
+/// The task takes a decode slot when it is created, so the slot bounds the
+/// raw value from the start of the fetch. The slot moves on with the raw
+/// value, or is returned if the fetch fails or is cancelled.
+template<typename KeyType, typename ValueType, typename RawType>
+class PipelineFetchTask: public CacheRequestTask<KeyType, ValueType>
+{
+public:
+    PipelineFetchTask(const KeyType& key,
+                      BasePipelinedResourceCache<KeyType, ValueType, RawType>& cache):
+        CacheRequestTask<KeyType, ValueType>(key, cache),
+        _cache(cache)
+    {
+        _cache.acquireDecodeSlot();
+    }
+
+    virtual ~PipelineFetchTask()
+    {
+        releaseSlot();
+    }
+
+    void runTask() override
+    {
+        if (_cache.startFetchAsync(*this))
+        {
+            return;
+        }
+
+        std::shared_ptr<RawType> raw = nullptr;
+
+        try
+        {
+            CancellationToken::Scope scope(this->_cancellationToken);
+            raw = _cache.fetch(*this);
+        }
+        catch (...)
+        {
+            // The slot is free before the failure finishes the request.
+            releaseSlot();
+
+            if (this->_cancellationToken.isCancelled())
+            {
+                return;
+            }
+
+            throw;
+        }
+
+        if (this->_cancellationToken.isCancelled())
+        {
+            releaseSlot();
+            return;
+        }
+
+        if (raw == nullptr)
+        {
+            releaseSlot();
+            throw Poco::IOException("Unable to fetch raw value for key.");
+        }
+
+        _cache.decodeLater(*this, raw);
+    }
+
+    void cancel() override
+    {
+        CacheRequestTask<KeyType, ValueType>::cancel();
+        releaseSlot();
+    }
+
+    /// \brief Take over the decode slot of the task.
+    /// \returns false if the slot was already taken or returned.
+    bool takeSlot()
+    {
+        return !_isSlotReleased.exchange(true);
+    }
+
+    /// \brief Give back a slot taken with takeSlot().
+    void returnSlot()
+    {
+        _isSlotReleased = false;
+
+        // A cancel in the meantime skipped the release.
+        if (this->_cancellationToken.isCancelled())
+        {
+            releaseSlot();
+        }
+    }
+
+private:
+    void releaseSlot()
+    {
+        if (takeSlot())
+        {
+            _cache.releaseDecodeSlot();
+        }
+    }
+
+    BasePipelinedResourceCache<KeyType, ValueType, RawType>& _cache;
+
+    /// \brief True once the decode slot was returned or taken over.
+    std::atomic<bool> _isSlotReleased { false };
+
+};
+
+
+/// \brief The second stage of a pipelined request.
+///
+/// The decode task runs on the decode queue and converts a raw value into a
+/// value. Each decode task takes over the decode slot of its fetch and holds
+/// it until it finishes or is cancelled.
+///
+/// A decode task of a failed asynchronous fetch fails with the fetch error.
+/// A decode task whose fetch was cancelled before it ran cancels itself.
+template<typename KeyType, typename ValueType, typename RawType>
+class PipelineDecodeTask: public Poco::Task
+{
+public:
+    typedef std::pair<KeyType, std::shared_ptr<ValueType>> KeyValuePair;
+
+    PipelineDecodeTask(const std::string& taskId,
+                       const KeyType& key,
+                       std::shared_ptr<RawType> raw,
+                       const CancellationToken& fetchToken,
+                       const std::string& fetchError,
+                       BasePipelinedResourceCache<KeyType, ValueType, RawType>& cache):
+        Poco::Task(taskId),
+        _key(key),
+        _raw(raw),
+        _fetchToken(fetchToken),
+        _fetchError(fetchError),
+        _cache(cache)
+    {
+    }
+
+    virtual ~PipelineDecodeTask()
+    {
+        releaseSlot();
+    }
+
+    void runTask() override
+    {
+        if (_fetchToken.isCancelled())
+        {
+            // Posts the cancellation that finishes the request.
+            _raw.reset();
+            cancel();
+            return;
+        }
+
+        if (_raw == nullptr)
+        {
+            releaseSlot();
+            throw Poco::IOException(_fetchError.empty() ? "Unable to fetch raw value for key." : _fetchError);
+        }
+
+        std::shared_ptr<ValueType> value = nullptr;
+
+        try
+        {
+            value = _cache.decode(_key, *_raw);
+        }
+        catch (...)
+        {
+            _raw.reset();
+            releaseSlot();
+            throw;
+        }
+
+        // Release the raw data and the slot as soon as possible. The slot is
+        // free before the result is posted, so finishing the request can
+        // start the next waiting one.
+        _raw.reset();
+        releaseSlot();
+
+        if (value != nullptr)
+        {
+            postNotification(new Poco::TaskCustomNotification<KeyValuePair>(this, std::make_pair(_key, value)));
+        }
+        else
+        {
+            throw Poco::IOException("Unable to decode value for key.");
+        }
+    }
+
+    void cancel() override
+    {
+        Poco::Task::cancel();
+        releaseSlot();
+    }
+
+private:
+    void releaseSlot()
+    {
+        if (!_isSlotReleased.exchange(true))
+        {
+            _cache.releaseDecodeSlot();
+        }
+    }
+
+    /// \brief The key to decode.
+    KeyType _key;
+
+    /// \brief The raw value to decode, nullptr if the fetch failed.
+    std::shared_ptr<RawType> _raw;
+
+    /// \brief The token of the fetch task.
+    CancellationToken _fetchToken;
+
+    /// \brief The error of a failed fetch.
+    std::string _fetchError;
+
+    BasePipelinedResourceCache<KeyType, ValueType, RawType>& _cache;
+
+    /// \brief True once the decode slot was returned.
+    std::atomic<bool> _isSlotReleased { false };
+
+};
+
+
+/// \brief A resource cache that splits loading into fetch and decode stages.
+///
+/// Fetching (e.g. disk or network I/O) runs on an I/O task queue and decoding
+/// (e.g. image decompression) runs on a separate decode task queue. Each queue
+/// can be sized independently so that slow I/O does not starve CPU-bound
+/// decoding and vice versa.
+///
+/// The number of requests between the start of their fetch and the end of
+/// their decode is bounded. Each request takes a decode slot when its fetch
+/// starts and returns it once its value is decoded, or when it fails or is
+/// cancelled. When all decode slots are in use, new requests wait in the
+/// request queue instead of fetching, so at most maximumPendingDecodes() raw
+/// values are held at once, including those of asynchronous fetches. Fetch
+/// workers never wait for the decode queue.
+///
+/// Subclasses must implement fetch(), decode() and toTaskId(). Subclasses
+/// with asynchronous I/O may also implement fetchAsync(), so fetch workers
+/// don't wait for the I/O at all.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type (e.g. a std::shared_ptr<ValueType>).
+/// \tparam RawType The raw type passed between the stages (e.g. ofBuffer).
+template<typename KeyType, typename ValueType, typename RawType>
+class BasePipelinedResourceCache: public BaseResourceCache<KeyType, ValueType>
+{
+public:
+    /// \brief Create a BasePipelinedResourceCache with the given parameters.
+    /// \param memoryCache The memory cache used to store decoded values.
+    /// \param ioQueue The task queue used to fetch raw values.
+    /// \param decodeQueue The task queue used to decode raw values.
+    /// \param maximumPendingDecodes The maximum number of requests fetching,
+    ///        waiting for or being decoded.
+    BasePipelinedResourceCache(std::unique_ptr<BaseCache<KeyType, ValueType>> memoryCache,
+                               TaskQueue& ioQueue,
+                               TaskQueue& decodeQueue,
+                               std::size_t maximumPendingDecodes = DEFAULT_MAXIMUM_PENDING_DECODES);
+
+    /// \brief Destroy the BasePipelinedResourceCache.
+    ///
+    /// Waits for asynchronous fetches to call back.
+    virtual ~BasePipelinedResourceCache();
+
+    /// \brief The callback of an asynchronous fetch.
+    ///
+    /// It is called with the raw value, or with nullptr and an error.
+    typedef std::function<void(std::shared_ptr<RawType>, const std::string&)> FetchCallback;
+
+    /// \brief Fetch the raw value for a request.
+    ///
+    /// This method is called from within tasks on the I/O queue.
+    ///
+    /// \param task The task requesting the value.
+    /// \returns the raw value or nullptr on failure.
+    virtual std::shared_ptr<RawType> fetch(CacheRequestTask<KeyType, ValueType>& task) = 0;
+
+    /// \brief Start fetching the raw value for a request without waiting.
+    ///
+    /// The fetch task returns as soon as the fetch started, and the callback
+    /// queues the raw value for decoding. Cancelled requests drop the raw
+    /// value. By default no fetch is started and fetch() is used.
+    ///
+    /// This method is called from within tasks on the I/O queue.
+    ///
+    /// \param task The task requesting the value.
+    /// \param callback Called exactly once, from any thread, if the fetch
+    ///        was started.
+    /// \returns true if the fetch was started.
+    virtual bool fetchAsync(CacheRequestTask<KeyType, ValueType>& task,
+                            FetchCallback callback);
+
+    /// \brief Decode a raw value.
+    ///
+    /// This method is called from within tasks on the decode queue.
+    ///
+    /// \param key The key being decoded.
+    /// \param raw The raw value returned by fetch().
+    /// \returns the decoded value or nullptr on failure.
+    virtual std::shared_ptr<ValueType> decode(const KeyType& key, RawType& raw) = 0;
+
+    /// \brief Fetch and decode a value synchronously on the calling thread.
+    std::shared_ptr<ValueType> load(CacheRequestTask<KeyType, ValueType>& task) override;
+
+    /// \returns the maximum number of requests fetching, waiting for or being
+    ///          decoded.
+    std::size_t maximumPendingDecodes() const;
+
+    enum
+    {
+        /// \brief The default maximum number of pending decodes.
+        DEFAULT_MAXIMUM_PENDING_DECODES = 16
+    };
+
+protected:
+    Poco::Task* createTask(const KeyType& key) override;
+    void doCancelRequest(const KeyType& key) override;
+    void doCancelQueuedRequest(const KeyType& key) override;
+    float doRequestProgress(const KeyType& key) const override;
+    RequestState doRequestState(const KeyType& key) const override;
+
+    /// \returns true if a request may start fetching, which requires a free
+    /// decode slot as well.
+    bool hasFreeSlotLocked() const override;
+
+    /// \brief Queue the raw value for decoding without waiting.
+    ///
+    /// The decode task takes over the decode slot of the fetch task. If the
+    /// fetch task was cancelled, the raw value is dropped.
+    ///
+    /// \param task The fetch task handing off the raw value.
+    /// \param raw The raw value to decode.
+    /// \throws Poco::IOException if the decode task can't be queued.
+    void decodeLater(PipelineFetchTask<KeyType, ValueType, RawType>& task,
+                     std::shared_ptr<RawType> raw);
+
+    /// \brief Start an asynchronous fetch for the task, see fetchAsync().
+    ///
+    /// The fetch holds the decode slot of the task until it calls back, or
+    /// until the request is cancelled.
+    ///
+    /// \param task The fetch task.
+    /// \returns true if the fetch was started.
+    bool startFetchAsync(PipelineFetchTask<KeyType, ValueType, RawType>& task);
+
+    /// \brief Take a decode slot for a new fetch task.
+    void acquireDecodeSlot();
+
+    /// \brief Return a decode slot taken by acquireDecodeSlot().
+    void releaseDecodeSlot();
+
+private:
+    /// \brief Queue a decode task.
+    /// \returns false if the task id is taken on the decode queue.
+    bool queueDecode(const std::string& taskId,
+                     const KeyType& key,
+                     std::shared_ptr<RawType> raw,
+                     const CancellationToken& fetchToken,
+                     const std::string& fetchError);
+
+    /// \brief Forget an asynchronous fetch once it called back.
+    /// \param taskId The task id of the fetch.
+    /// \param fetchId The id of the fetch, as the task id may be reused by
+    ///        the next request for the key.
+    /// \returns true if the fetch still held its decode slot, which passes to
+    ///        the caller.
+    bool finishFetchAsync(const std::string& taskId, std::uint64_t fetchId);
+
+    /// \brief Take the decode slot held by an asynchronous fetch.
+    /// \returns true if the fetch held its slot, which passes to the caller.
+    bool takeFetchAsyncSlot(const std::string& taskId, std::uint64_t fetchId);
+
+    /// \returns true if the task is waiting for an asynchronous fetch.
+    bool isFetchingAsync(const std::string& taskId) const;
+
+    /// \brief Forgets an asynchronous fetch when destroyed.
+    class AsyncFetchScope
+    {
+    public:
+        AsyncFetchScope(BasePipelinedResourceCache& cache,
+                        const std::string& taskId,
+                        std::uint64_t fetchId):
+            _cache(cache),
+            _taskId(taskId),
+            _fetchId(fetchId)
+        {
+        }
+
+        AsyncFetchScope(const AsyncFetchScope&) = delete;
+        AsyncFetchScope& operator = (const AsyncFetchScope&) = delete;
+
+        ~AsyncFetchScope()
+        {
+            if (_cache.finishFetchAsync(_taskId, _fetchId))
+            {
+                _cache.releaseDecodeSlot();
+            }
+        }
+
+    private:
+        BasePipelinedResourceCache& _cache;
+        std::string _taskId;
+        std::uint64_t _fetchId = 0;
+
+    };
+
+    /// \brief The queue used for decoding.
+    TaskQueue& _decodeQueue;
+
+    /// \brief The maximum number of pending decodes.
+    std::size_t _maximumPendingDecodes = DEFAULT_MAXIMUM_PENDING_DECODES;
+
+    /// \brief The number of requests holding a decode slot.
+    std::atomic<std::size_t> _pendingDecodes { 0 };
+
+    /// \brief An asynchronous fetch that didn't call back yet.
+    struct AsyncFetch
+    {
+        /// \brief The id of the fetch.
+        std::uint64_t id = 0;
+
+        /// \brief The cancellation token of the fetch task.
+        CancellationToken token;
+
+        /// \brief True until the decode slot is handed on or returned.
+        bool isHoldingSlot = false;
+    };
+
+    /// \brief The asynchronous fetches, by task id.
+    std::map<std::string, AsyncFetch> _asyncFetches;
+
+    /// \brief The number of asynchronous fetches that didn't return yet.
+    std::size_t _runningAsyncFetches = 0;
+
+    /// \brief The id of the next asynchronous fetch.
+    std::uint64_t _nextAsyncFetchId = 0;
+
+    /// \brief Guards the asynchronous fetches.
+    mutable std::mutex _asyncFetchMutex;
+
+    /// \brief Notified when an asynchronous fetch called back.
+    std::condition_variable _asyncFetchCondition;
+
+    /// \brief The decode queue event listeners.
+    ofEventListener _onDecodeCancelledListener;
+    ofEventListener _onDecodeFailedListener;
+    ofEventListener _onDecodeCustomNotificationListener;
+
+    friend class PipelineFetchTask<KeyType, ValueType, RawType>;
+    friend class PipelineDecodeTask<KeyType, ValueType, RawType>;
+
+};
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+BasePipelinedResourceCache<KeyType, ValueType, RawType>::BasePipelinedResourceCache(std::unique_ptr<BaseCache<KeyType, ValueType>> memoryCache,
+                                                                                   TaskQueue& ioQueue,
+                                                                                   TaskQueue& decodeQueue,
+                                                                                   std::size_t maximumPendingDecodes):
+    BaseResourceCache<KeyType, ValueType>(std::move(memoryCache), ioQueue),
+    _decodeQueue(decodeQueue),
+    _maximumPendingDecodes(std::max(maximumPendingDecodes, std::size_t(1))),
+    _onDecodeCancelledListener(_decodeQueue.onTaskCancelled.newListener(this, &BasePipelinedResourceCache::onTaskCancelled)),
+    _onDecodeFailedListener(_decodeQueue.onTaskFailed.newListener(this, &BasePipelinedResourceCache::onTaskFailed)),
+    _onDecodeCustomNotificationListener(_decodeQueue.onTaskCustomNotification.newListener(this, &BasePipelinedResourceCache::onTaskCustomNotification))
+{
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+BasePipelinedResourceCache<KeyType, ValueType, RawType>::~BasePipelinedResourceCache()
+{
+    // The callbacks of asynchronous fetches use this cache.
+    std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+    _asyncFetchCondition.wait(lock, [this]() { return _runningAsyncFetches == 0; });
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::fetchAsync(CacheRequestTask<KeyType, ValueType>&,
+                                                                         FetchCallback)
+{
+    return false;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+std::shared_ptr<ValueType> BasePipelinedResourceCache<KeyType, ValueType, RawType>::load(CacheRequestTask<KeyType, ValueType>& task)
+{
+    std::shared_ptr<RawType> raw = fetch(task);
+
+    if (raw != nullptr)
+    {
+        return decode(task.key(), *raw);
+    }
+
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+std::size_t BasePipelinedResourceCache<KeyType, ValueType, RawType>::maximumPendingDecodes() const
+{
+    return _maximumPendingDecodes;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+Poco::Task* BasePipelinedResourceCache<KeyType, ValueType, RawType>::createTask(const KeyType& key)
+{
+    return new PipelineFetchTask<KeyType, ValueType, RawType>(key, *this);
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+void BasePipelinedResourceCache<KeyType, ValueType, RawType>::doCancelRequest(const KeyType& key)
+{
+    BaseResourceCache<KeyType, ValueType>::doCancelRequest(key);
+
+    std::string taskId = this->toTaskId(key);
+    CancellationToken token;
+    bool isFetching = false;
+    bool isHoldingSlot = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+        auto iter = _asyncFetches.find(taskId);
+
+        if (iter != _asyncFetches.end())
+        {
+            token = iter->second.token;
+            isFetching = true;
+            isHoldingSlot = iter->second.isHoldingSlot;
+            iter->second.isHoldingSlot = false;
+        }
+    }
+
+    // The fetch task may have returned already, so no task posts the
+    // cancellation. The completion of the fetch drops the raw value. The
+    // slot is free before the request finishes, so finishing it can start
+    // the next waiting one.
+    if (isFetching)
+    {
+        token.cancel();
+
+        if (isHoldingSlot)
+        {
+            releaseDecodeSlot();
+        }
+
+        this->cancelRunningRequest(taskId);
+    }
+
+    try
+    {
+        _decodeQueue.cancel(taskId);
+    }
+    catch (const Poco::ExistsException&)
+    {
+        // Do nothing.
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+void BasePipelinedResourceCache<KeyType, ValueType, RawType>::doCancelQueuedRequest(const KeyType& key)
+{
+    BaseResourceCache<KeyType, ValueType>::doCancelQueuedRequest(key);
+
+    try
+    {
+        _decodeQueue.cancelQueued(this->toTaskId(key));
+    }
+    catch (const Poco::ExistsException&)
+    {
+        // Do nothing.
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+float BasePipelinedResourceCache<KeyType, ValueType, RawType>::doRequestProgress(const KeyType& key) const
+{
+    // Fetching is the first half of the request, decoding is the second half.
+    // The decode queue is only asked once the fetch has finished.
+    if (BaseResourceCache<KeyType, ValueType>::doRequestState(key) != RequestState::FINISHED)
+    {
+        return 0.5f * BaseResourceCache<KeyType, ValueType>::doRequestProgress(key);
+    }
+
+    std::string taskId = this->toTaskId(key);
+
+    // The fetch stage ends once the raw value is handed to the decode queue.
+    if (isFetchingAsync(taskId))
+    {
+        return 0.5f;
+    }
+
+    try
+    {
+        return 0.5f + 0.5f * _decodeQueue.getTaskProgress(taskId);
+    }
+    catch (const Poco::ExistsException&)
+    {
+        return 0.5f;
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+RequestState BasePipelinedResourceCache<KeyType, ValueType, RawType>::doRequestState(const KeyType& key) const
+{
+    auto state = BaseResourceCache<KeyType, ValueType>::doRequestState(key);
+
+    // A finished fetch may still be waiting for or being decoded.
+    if (state != RequestState::FINISHED)
+    {
+        return state;
+    }
+
+    std::string taskId = this->toTaskId(key);
+
+    // A finished fetch task may still wait for its asynchronous fetch.
+    if (isFetchingAsync(taskId))
+    {
+        return RequestState::RUNNING;
+    }
+
+    try
+    {
+        Poco::Task::TaskState status = _decodeQueue.getTaskState(taskId);
+
+        switch (status)
+        {
+            case Poco::Task::TASK_IDLE:
+            case Poco::Task::TASK_STARTING:
+            case Poco::Task::TASK_RUNNING:
+                // The request is running as long as it is in either stage.
+                return RequestState::RUNNING;
+            case Poco::Task::TASK_CANCELLING:
+                return RequestState::CANCELLING;
+            case Poco::Task::TASK_FINISHED:
+                return RequestState::FINISHED;
+            default:
+                return RequestState::UNKNOWN;
+        }
+    }
+    catch (const Poco::ExistsException&)
+    {
+        return state;
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::hasFreeSlotLocked() const
+{
+    // Decode slots are returned before the request finishes, and finishing
+    // the request starts the queued ones.
+    return BaseResourceCache<KeyType, ValueType>::hasFreeSlotLocked()
+        && _pendingDecodes.load() < _maximumPendingDecodes;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+void BasePipelinedResourceCache<KeyType, ValueType, RawType>::decodeLater(PipelineFetchTask<KeyType, ValueType, RawType>& task,
+                                                                          std::shared_ptr<RawType> raw)
+{
+    // A cancelled task already returned its slot.
+    if (task.isCancelled() || !task.takeSlot())
+    {
+        return;
+    }
+
+    // The decode task returns the slot, even if it can't be queued.
+    if (!queueDecode(task.name(), task.key(), raw, task.cancellationToken(), ""))
+    {
+        // Fail the fetch so the request doesn't wait for a decode that
+        // will never be posted.
+        throw Poco::IOException("Unable to queue decode for key.");
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::startFetchAsync(PipelineFetchTask<KeyType, ValueType, RawType>& task)
+{
+    // A cancelled task already returned its slot, the cancellation finishes
+    // the request.
+    if (!task.takeSlot())
+    {
+        return true;
+    }
+
+    std::string taskId = task.name();
+    KeyType key = task.key();
+    CancellationToken token = task.cancellationToken();
+    std::uint64_t fetchId = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+        fetchId = _nextAsyncFetchId++;
+
+        AsyncFetch& fetch = _asyncFetches[taskId];
+        fetch.id = fetchId;
+        fetch.token = token;
+        fetch.isHoldingSlot = true;
+
+        ++_runningAsyncFetches;
+    }
+
+    bool isStarted = false;
+
+    try
+    {
+        isStarted = fetchAsync(task, [this, taskId, fetchId, key, token](std::shared_ptr<RawType> raw,
+                                                                         const std::string& error)
+        {
+            // Forgets the fetch and returns a slot it still holds, even if
+            // queueing the decode throws.
+            AsyncFetchScope scope(*this, taskId, fetchId);
+
+            // Cancelled requests were finished by doCancelRequest() or the
+            // fetch task, so their raw value is dropped.
+            if (token.isCancelled() || !takeFetchAsyncSlot(taskId, fetchId))
+            {
+                return;
+            }
+
+            // Failed fetches are queued as well, their decode task fails the
+            // request.
+            if (!queueDecode(taskId, key, raw, token, error))
+            {
+                // E.g. a decode of a cancelled request for the key still
+                // runs. No task will finish this request, and the slot was
+                // returned with the decode task.
+                ofLogError("BasePipelinedResourceCache::startFetchAsync") << "Unable to queue decode for " << taskId;
+                this->failRunningRequest(taskId, "Unable to queue decode for key.");
+            }
+        });
+    }
+    catch (...)
+    {
+        if (finishFetchAsync(taskId, fetchId))
+        {
+            releaseDecodeSlot();
+        }
+
+        throw;
+    }
+
+    // fetch() uses the slot instead.
+    if (!isStarted && finishFetchAsync(taskId, fetchId))
+    {
+        task.returnSlot();
+    }
+
+    return isStarted;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::queueDecode(const std::string& taskId,
+                                                                          const KeyType& key,
+                                                                          std::shared_ptr<RawType> raw,
+                                                                          const CancellationToken& fetchToken,
+                                                                          const std::string& fetchError)
+{
+    // The decode task holds the slot until it finishes or is cancelled, or
+    // until it is destroyed if it isn't queued.
+    try
+    {
+        Poco::AutoPtr<Poco::Task> decodeTask(new PipelineDecodeTask<KeyType, ValueType, RawType>(taskId,
+                                                                                                 key,
+                                                                                                 raw,
+                                                                                                 fetchToken,
+                                                                                                 fetchError,
+                                                                                                 *this));
+        _decodeQueue.start(taskId, decodeTask.duplicate());
+        return true;
+    }
+    catch (const Poco::ExistsException&)
+    {
+        return false;
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("BasePipelinedResourceCache::queueDecode") << exc.displayText();
+        return false;
+    }
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::finishFetchAsync(const std::string& taskId,
+                                                                               std::uint64_t fetchId)
+{
+    bool isHoldingSlot = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+        auto iter = _asyncFetches.find(taskId);
+
+        if (iter != _asyncFetches.end() && iter->second.id == fetchId)
+        {
+            isHoldingSlot = iter->second.isHoldingSlot;
+            _asyncFetches.erase(iter);
+        }
+
+        --_runningAsyncFetches;
+    }
+
+    _asyncFetchCondition.notify_all();
+    return isHoldingSlot;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::takeFetchAsyncSlot(const std::string& taskId,
+                                                                                 std::uint64_t fetchId)
+{
+    std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+    auto iter = _asyncFetches.find(taskId);
+
+    if (iter == _asyncFetches.end() || iter->second.id != fetchId)
+    {
+        return false;
+    }
+
+    bool isHoldingSlot = iter->second.isHoldingSlot;
+    iter->second.isHoldingSlot = false;
+    return isHoldingSlot;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+bool BasePipelinedResourceCache<KeyType, ValueType, RawType>::isFetchingAsync(const std::string& taskId) const
+{
+    std::unique_lock<std::mutex> lock(_asyncFetchMutex);
+    return _asyncFetches.find(taskId) != _asyncFetches.end();
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+void BasePipelinedResourceCache<KeyType, ValueType, RawType>::acquireDecodeSlot()
+{
+    ++_pendingDecodes;
+}
+
+
+template<typename KeyType, typename ValueType, typename RawType>
+void BasePipelinedResourceCache<KeyType, ValueType, RawType>::releaseDecodeSlot()
+{
+    --_pendingDecodes;
+}
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,284 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A thread-safe pool of small fixed-size memory blocks.
+///
+/// Blocks are carved from large chunks and recycled through one free list per
+/// size class. Memory is returned to the system only when the pool is
+/// destroyed. Requests that are too large or too strictly aligned for the
+/// pool fall back to the global heap, with the requested alignment.
+///
+/// A pool is usually shared by all PoolAllocator instances rebound from the
+/// same allocator, e.g. for the list, map and shared_ptr nodes of a cache.
+class MemoryPool
+{
+public:
+    /// \brief Create a MemoryPool.
+    /// \param blocksPerChunk The number of blocks allocated at once per size
+    /// class.
+    MemoryPool(std::size_t blocksPerChunk = DEFAULT_BLOCKS_PER_CHUNK):
+        _blocksPerChunk(blocksPerChunk > 0 ? blocksPerChunk : 1)
+    {
+        _freeLists.fill(nullptr);
+    }
+
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator = (const MemoryPool&) = delete;
+
+    /// \brief Allocate a block of memory.
+    /// \param bytes The number of bytes.
+    /// \param alignment The required alignment.
+    /// \returns the block.
+    /// \throws std::bad_alloc if no memory is available.
+    void* allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!isPooled(bytes, alignment))
+        {
+            return allocateUnpooled(bytes, alignment);
+        }
+
+        std::size_t sizeClass = toSizeClass(bytes);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_freeLists[sizeClass] == nullptr)
+        {
+            addChunkLocked(sizeClass);
+        }
+
+        FreeBlock* block = _freeLists[sizeClass];
+        _freeLists[sizeClass] = block->next;
+        ++_blocksInUse;
+        return block;
+    }
+
+    /// \brief Return a block allocated with allocate().
+    /// \param pointer The block.
+    /// \param bytes The number of bytes passed to allocate().
+    /// \param alignment The alignment passed to allocate().
+    void deallocate(void* pointer, std::size_t bytes, std::size_t alignment)
+    {
+        if (pointer == nullptr)
+        {
+            return;
+        }
+
+        if (!isPooled(bytes, alignment))
+        {
+            deallocateUnpooled(pointer, alignment);
+            return;
+        }
+
+        std::size_t sizeClass = toSizeClass(bytes);
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        block->next = _freeLists[sizeClass];
+        _freeLists[sizeClass] = block;
+        --_blocksInUse;
+    }
+
+    /// \returns the number of pooled blocks currently allocated.
+    std::size_t blocksInUse() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _blocksInUse;
+    }
+
+    /// \returns the number of bytes reserved from the system.
+    std::size_t reservedBytes() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _reservedBytes;
+    }
+
+    enum
+    {
+        /// \brief The default number of blocks allocated at once.
+        DEFAULT_BLOCKS_PER_CHUNK = 256,
+        /// \brief The size class granularity and maximum pooled alignment.
+        BLOCK_ALIGNMENT = alignof(std::max_align_t),
+        /// \brief The largest pooled block.
+        MAXIMUM_BLOCK_SIZE = 512,
+        /// \brief The number of size classes.
+        SIZE_CLASS_COUNT = MAXIMUM_BLOCK_SIZE / BLOCK_ALIGNMENT
+    };
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static bool isPooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes > 0 && bytes <= MAXIMUM_BLOCK_SIZE && alignment <= BLOCK_ALIGNMENT;
+    }
+
+    /// \brief Allocate a block from the global heap, honoring alignments
+    /// stricter than operator new guarantees.
+    static void* allocateUnpooled(std::size_t bytes, std::size_t alignment)
+    {
+        if (alignment <= BLOCK_ALIGNMENT)
+        {
+            return ::operator new(bytes);
+        }
+
+#if defined(__cpp_aligned_new)
+        return ::operator new(bytes, std::align_val_t(alignment));
+#else
+        // Over-allocate and keep the original pointer in front of the block.
+        unsigned char* raw = static_cast<unsigned char*>(::operator new(bytes + alignment + sizeof(void*)));
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(raw + sizeof(void*));
+        address = (address + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+        void* block = reinterpret_cast<void*>(address);
+        static_cast<void**>(block)[-1] = raw;
+        return block;
+#endif
+    }
+
+    /// \brief Return a block allocated with allocateUnpooled().
+    static void deallocateUnpooled(void* pointer, std::size_t alignment)
+    {
+        if (alignment <= BLOCK_ALIGNMENT)
+        {
+            ::operator delete(pointer);
+            return;
+        }
+
+#if defined(__cpp_aligned_new)
+        ::operator delete(pointer, std::align_val_t(alignment));
+#else
+        ::operator delete(static_cast<void**>(pointer)[-1]);
+#endif
+    }
+
+    static std::size_t toSizeClass(std::size_t bytes)
+    {
+        return (bytes - 1) / BLOCK_ALIGNMENT;
+    }
+
+    void addChunkLocked(std::size_t sizeClass)
+    {
+        std::size_t blockSize = (sizeClass + 1) * BLOCK_ALIGNMENT;
+        std::size_t chunkSize = blockSize * _blocksPerChunk;
+
+        // operator new returns memory aligned to at least BLOCK_ALIGNMENT.
+        _chunks.emplace_back(static_cast<unsigned char*>(::operator new(chunkSize)));
+        _reservedBytes += chunkSize;
+
+        unsigned char* chunk = _chunks.back().get();
+
+        for (std::size_t i = _blocksPerChunk; i-- > 0;)
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+            block->next = _freeLists[sizeClass];
+            _freeLists[sizeClass] = block;
+        }
+    }
+
+    struct ChunkDeleter
+    {
+        void operator()(unsigned char* chunk) const
+        {
+            ::operator delete(chunk);
+        }
+    };
+
+    std::size_t _blocksPerChunk = DEFAULT_BLOCKS_PER_CHUNK;
+    std::array<FreeBlock*, SIZE_CLASS_COUNT> _freeLists;
+    std::vector<std::unique_ptr<unsigned char, ChunkDeleter>> _chunks;
+    std::size_t _blocksInUse = 0;
+    std::size_t _reservedBytes = 0;
+    mutable std::mutex _mutex;
+
+};
+
+
+/// \brief A standard allocator that draws memory from a shared MemoryPool.
+///
+/// Copies and rebound copies share the pool, which stays alive as long as
+/// any allocator or any object allocated with std::allocate_shared uses it,
+/// e.g.
+///
+///     LRUMemoryCache<std::string, ofBuffer, PoolAllocator<ofBuffer>> cache;
+///
+/// \tparam T The allocated type.
+template<typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    /// \brief Create a PoolAllocator with a new pool.
+    PoolAllocator(): _pool(std::make_shared<MemoryPool>())
+    {
+    }
+
+    /// \brief Create a PoolAllocator using the given pool.
+    /// \param pool The pool to allocate from.
+    explicit PoolAllocator(std::shared_ptr<MemoryPool> pool): _pool(pool)
+    {
+    }
+
+    /// \brief Create a PoolAllocator sharing the pool of another one.
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other): _pool(other.pool())
+    {
+    }
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(_pool->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* pointer, std::size_t count)
+    {
+        _pool->deallocate(pointer, count * sizeof(T), alignof(T));
+    }
+
+    /// \returns the pool.
+    std::shared_ptr<MemoryPool> pool() const
+    {
+        return _pool;
+    }
+
+    template<typename U>
+    bool operator == (const PoolAllocator<U>& other) const
+    {
+        return _pool == other.pool();
+    }
+
+    template<typename U>
+    bool operator != (const PoolAllocator<U>& other) const
+    {
+        return _pool != other.pool();
+    }
+
+private:
+    std::shared_ptr<MemoryPool> _pool;
+
+};
+
+
+} } // namespace ofx::Cache
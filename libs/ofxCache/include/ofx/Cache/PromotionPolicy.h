@@ -0,0 +1,199 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Decides whether a value found in a child node is copied up.
+///
+/// BaseCache::get() asks its promotion policy each time a child node answers
+/// a get that this node missed. Values that are not promoted are still
+/// returned, but stay in the slower tier.
+///
+/// Policies are called from any thread and must be thread-safe.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class BasePromotionPolicy
+{
+public:
+    /// \brief Destroy the BasePromotionPolicy.
+    virtual ~BasePromotionPolicy()
+    {
+    }
+
+    /// \brief Decide whether to promote a child hit.
+    /// \param key The key that was found in the child node.
+    /// \returns true if the value should be added to the parent node.
+    virtual bool shouldPromote(const KeyType& key) = 0;
+
+};
+
+
+/// \brief Promotes every child hit. This is the default behavior.
+template<typename KeyType>
+class AlwaysPromotionPolicy: public BasePromotionPolicy<KeyType>
+{
+public:
+    bool shouldPromote(const KeyType&) override
+    {
+        return true;
+    }
+
+};
+
+
+/// \brief Never promotes child hits.
+template<typename KeyType>
+class NeverPromotionPolicy: public BasePromotionPolicy<KeyType>
+{
+public:
+    bool shouldPromote(const KeyType&) override
+    {
+        return false;
+    }
+
+};
+
+
+/// \brief Promotes a key once it was found in the child N times within a
+/// time window.
+///
+/// This keeps one-hit wonders, such as the keys of a single pass over a
+/// large data set, out of the parent node.
+template<typename KeyType>
+class HitCountPromotionPolicy: public BasePromotionPolicy<KeyType>
+{
+public:
+    /// \brief Create a HitCountPromotionPolicy.
+    /// \param hits The number of child hits needed to promote a key.
+    /// \param window The time window in which the hits must occur.
+    /// \param maximumTrackedKeys The maximum number of keys counted at once.
+    HitCountPromotionPolicy(std::size_t hits = DEFAULT_HITS,
+                            std::chrono::milliseconds window = std::chrono::milliseconds(DEFAULT_WINDOW_MILLISECONDS),
+                            std::size_t maximumTrackedKeys = DEFAULT_MAXIMUM_TRACKED_KEYS):
+        _hits(hits),
+        _window(window),
+        _maximumTrackedKeys(maximumTrackedKeys)
+    {
+    }
+
+    bool shouldPromote(const KeyType& key) override
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto iter = _counts.find(key);
+
+        if (iter == _counts.end())
+        {
+            if (_counts.size() >= _maximumTrackedKeys)
+            {
+                removeExpiredLocked(now);
+            }
+
+            iter = _counts.insert(std::make_pair(key, Count { 0, now })).first;
+        }
+        else if (now - iter->second.start > _window)
+        {
+            iter->second = Count { 0, now };
+        }
+
+        if (++iter->second.hits >= _hits)
+        {
+            _counts.erase(iter);
+            return true;
+        }
+
+        return false;
+    }
+
+    enum
+    {
+        /// \brief The default number of child hits needed to promote a key.
+        DEFAULT_HITS = 2,
+        /// \brief The default time window.
+        DEFAULT_WINDOW_MILLISECONDS = 60000,
+        /// \brief The default maximum number of keys counted at once.
+        DEFAULT_MAXIMUM_TRACKED_KEYS = 65536
+    };
+
+private:
+    struct Count
+    {
+        std::size_t hits;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void removeExpiredLocked(std::chrono::steady_clock::time_point now)
+    {
+        for (auto iter = _counts.begin(); iter != _counts.end();)
+        {
+            if (now - iter->second.start > _window)
+            {
+                iter = _counts.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+
+        // Forget everything rather than grow without bound.
+        if (_counts.size() >= _maximumTrackedKeys)
+        {
+            _counts.clear();
+        }
+    }
+
+    std::size_t _hits = DEFAULT_HITS;
+    std::chrono::milliseconds _window;
+    std::size_t _maximumTrackedKeys = DEFAULT_MAXIMUM_TRACKED_KEYS;
+    std::map<KeyType, Count> _counts;
+    std::mutex _mutex;
+
+};
+
+
+/// \brief Promotes a random sample of child hits.
+///
+/// Frequently used keys are promoted quickly while most one-hit wonders are
+/// not, without keeping any per-key state.
+template<typename KeyType>
+class ProbabilisticPromotionPolicy: public BasePromotionPolicy<KeyType>
+{
+public:
+    /// \brief Create a ProbabilisticPromotionPolicy.
+    /// \param probability The probability of promoting a child hit.
+    ProbabilisticPromotionPolicy(double probability): _probability(probability)
+    {
+    }
+
+    bool shouldPromote(const KeyType&) override
+    {
+        thread_local std::minstd_rand random(std::random_device{}());
+        return std::uniform_real_distribution<double>(0, 1)(random) < _probability;
+    }
+
+private:
+    double _probability = 1;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,206 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A policy that predicts which keys will be needed next.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class BaseReadAheadPolicy
+{
+public:
+    /// \brief Destroy the BaseReadAheadPolicy.
+    virtual ~BaseReadAheadPolicy()
+    {
+    }
+
+    /// \brief Record an access and predict the next keys.
+    ///
+    /// This method may be called from multiple threads.
+    ///
+    /// \param key The key that was accessed.
+    /// \returns the keys that should be prefetched, if any.
+    virtual std::vector<KeyType> predict(const KeyType& key) = 0;
+
+};
+
+
+/// \brief A read-ahead policy that detects sequential access.
+///
+/// Keys are mapped to integer indices. When consecutive accesses advance by
+/// the same non-zero stride (e.g. frames 10, 11, 12 or map tiles 4, 6, 8), the
+/// policy predicts the next keys along that stride.
+///
+/// Integral keys are mapped to indices directly. Other key types (e.g. file
+/// names containing a frame number) must supply conversion functions.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class SequentialReadAheadPolicy: public BaseReadAheadPolicy<KeyType>
+{
+public:
+    /// \brief Extract an index from a key.
+    ///
+    /// Returns false if the key has no index.
+    typedef std::function<bool(const KeyType& key, int64_t& index)> KeyToIndex;
+
+    /// \brief Create a key with the given index, based on an accessed key.
+    typedef std::function<KeyType(const KeyType& key, int64_t index)> IndexToKey;
+
+    /// \brief Create a SequentialReadAheadPolicy for integral keys.
+    /// \param depth The number of keys to read ahead.
+    /// \param minimumRunLength The number of same-stride steps required
+    ///        before reading ahead.
+    template<typename K = KeyType, typename std::enable_if<std::is_integral<K>::value, int>::type = 0>
+    SequentialReadAheadPolicy(std::size_t depth = DEFAULT_DEPTH,
+                              std::size_t minimumRunLength = DEFAULT_MINIMUM_RUN_LENGTH):
+        SequentialReadAheadPolicy([](const KeyType& key, int64_t& index) {
+                                      index = static_cast<int64_t>(key);
+                                      return true;
+                                  },
+                                  [](const KeyType&, int64_t index) {
+                                      return static_cast<KeyType>(index);
+                                  },
+                                  depth,
+                                  minimumRunLength)
+    {
+    }
+
+    /// \brief Create a SequentialReadAheadPolicy with custom key mapping.
+    /// \param keyToIndex The function mapping keys to indices.
+    /// \param indexToKey The function mapping indices to keys.
+    /// \param depth The number of keys to read ahead.
+    /// \param minimumRunLength The number of same-stride steps required
+    ///        before reading ahead.
+    SequentialReadAheadPolicy(KeyToIndex keyToIndex,
+                              IndexToKey indexToKey,
+                              std::size_t depth = DEFAULT_DEPTH,
+                              std::size_t minimumRunLength = DEFAULT_MINIMUM_RUN_LENGTH):
+        _keyToIndex(keyToIndex),
+        _indexToKey(indexToKey),
+        _depth(depth),
+        _minimumRunLength(minimumRunLength)
+    {
+    }
+
+    /// \brief Destroy the SequentialReadAheadPolicy.
+    virtual ~SequentialReadAheadPolicy()
+    {
+    }
+
+    std::vector<KeyType> predict(const KeyType& key) override
+    {
+        std::vector<KeyType> keys;
+        int64_t index = 0;
+
+        if (!_keyToIndex(key, index))
+        {
+            return keys;
+        }
+
+        int64_t first = 0;
+        int64_t last = 0;
+        int64_t stride = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            int64_t delta = index - _lastIndex;
+
+            if (_hasLastIndex && delta != 0 && delta == _stride)
+            {
+                ++_runLength;
+            }
+            else
+            {
+                _stride = delta;
+                _runLength = (_hasLastIndex && delta != 0) ? 1 : 0;
+                _hasPredicted = false;
+            }
+
+            _lastIndex = index;
+            _hasLastIndex = true;
+
+            if (_runLength < _minimumRunLength || _depth == 0)
+            {
+                return keys;
+            }
+
+            stride = _stride;
+            first = index + stride;
+            last = index + stride * static_cast<int64_t>(_depth);
+
+            // Skip keys that were already predicted during this run.
+            if (_hasPredicted)
+            {
+                first = (stride > 0) ? std::max(first, _lastPredicted + stride)
+                                     : std::min(first, _lastPredicted + stride);
+            }
+
+            if ((stride > 0 && first > last) || (stride < 0 && first < last))
+            {
+                return keys;
+            }
+
+            _lastPredicted = last;
+            _hasPredicted = true;
+        }
+
+        for (int64_t i = first; stride > 0 ? i <= last : i >= last; i += stride)
+        {
+            keys.push_back(_indexToKey(key, i));
+        }
+
+        return keys;
+    }
+
+    enum
+    {
+        /// \brief The default number of keys to read ahead.
+        DEFAULT_DEPTH = 4,
+        /// \brief The default number of same-stride steps before reading ahead.
+        DEFAULT_MINIMUM_RUN_LENGTH = 2
+    };
+
+private:
+    KeyToIndex _keyToIndex;
+    IndexToKey _indexToKey;
+
+    /// \brief The number of keys to read ahead.
+    std::size_t _depth = DEFAULT_DEPTH;
+
+    /// \brief The number of same-stride steps before reading ahead.
+    std::size_t _minimumRunLength = DEFAULT_MINIMUM_RUN_LENGTH;
+
+    bool _hasLastIndex = false;
+    int64_t _lastIndex = 0;
+    int64_t _stride = 0;
+    std::size_t _runLength = 0;
+
+    bool _hasPredicted = false;
+    int64_t _lastPredicted = 0;
+
+    std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::Cache
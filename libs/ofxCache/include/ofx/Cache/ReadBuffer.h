@@ -0,0 +1,121 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "ofx/Cache/HashedKey.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A lossy, striped buffer of reads.
+///
+/// Readers record reads into one of several stripes, chosen by thread, so
+/// concurrent readers rarely touch the same lock or cache line. A read is
+/// dropped instead of waiting when its stripe is busy or full. The owner
+/// replays the buffered reads in batches with drain(), e.g. to update the
+/// recency order of an LRU cache while holding its exclusive lock.
+///
+/// \tparam T The recorded type, e.g. an iterator.
+template<typename T>
+class ReadBuffer
+{
+public:
+    /// \brief Record a read.
+    /// \param read The read to record.
+    /// \returns true if the stripe is full and should be drained.
+    bool record(const T& read)
+    {
+        Stripe& stripe = _stripes[stripeIndex()];
+        std::unique_lock<std::mutex> lock(stripe.mutex, std::try_to_lock);
+
+        if (!lock.owns_lock())
+        {
+            return false;
+        }
+
+        if (stripe.count < STRIPE_SIZE)
+        {
+            stripe.reads[stripe.count++] = read;
+        }
+
+        return stripe.count == STRIPE_SIZE;
+    }
+
+    /// \brief Replay and remove all recorded reads.
+    ///
+    /// Reads are replayed per stripe, oldest first.
+    ///
+    /// \param replay The function to call for each read.
+    void drain(const std::function<void(const T&)>& replay)
+    {
+        for (auto& stripe: _stripes)
+        {
+            std::unique_lock<std::mutex> lock(stripe.mutex);
+
+            for (std::size_t i = 0; i < stripe.count; ++i)
+            {
+                replay(stripe.reads[i]);
+            }
+
+            stripe.count = 0;
+        }
+    }
+
+    /// \brief Remove all recorded reads without replaying them.
+    void clear()
+    {
+        for (auto& stripe: _stripes)
+        {
+            std::unique_lock<std::mutex> lock(stripe.mutex);
+            stripe.count = 0;
+        }
+    }
+
+    enum
+    {
+        /// \brief The number of stripes, a power of two.
+        STRIPE_COUNT = 16,
+        /// \brief The number of reads buffered per stripe.
+        STRIPE_SIZE = 16,
+        /// \brief The assumed size of a cache line.
+        CACHE_LINE_SIZE = 64
+    };
+
+private:
+    struct Stripe
+    {
+        std::mutex mutex;
+        std::array<T, STRIPE_SIZE> reads;
+        std::size_t count = 0;
+
+        /// \brief Keeps neighbouring stripes off this cache line.
+        char padding[CACHE_LINE_SIZE];
+    };
+
+    static std::size_t stripeIndex()
+    {
+        // Thread ids are often aligned addresses, so mix their bits.
+        static thread_local std::size_t index = static_cast<std::size_t>(mixHash(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        return index & (STRIPE_COUNT - 1);
+    }
+
+    std::array<Stripe, STRIPE_COUNT> _stripes;
+
+};
+
+
+} } // namespace ofx::Cache
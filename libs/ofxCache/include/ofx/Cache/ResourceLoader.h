@@ -8,9 +8,18 @@
 #pragma once
 
 
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include "Poco/AutoPtr.h"
+#include "ofThread.h"
 #include "ofx/TaskQueue.h"
+#include "ofx/Cache/HashedKey.h"
 #include "ofx/Cache/LRUMemoryCache.h"
 #include "ofx/Cache/BaseAsyncCache.h"
+#include "ofx/Cache/CancellationToken.h"
 
 
 namespace ofx {
@@ -38,10 +47,38 @@ public:
     virtual std::shared_ptr<ValueType> load(CacheRequestTask<KeyType, ValueType>& request) = 0;
 
     /// \brief Convert a given Key to a unique task id.
+    ///
+    /// Task ids must be unique within the TaskQueue, which may be shared by
+    /// several caches, so the id should name the cache as well as the key.
+    ///
     /// \param key key to convert.
     /// \returns a unique string corresponding to the key.
     virtual std::string toTaskId(const KeyType& key) const = 0;
 
+    /// \brief Convert a given Key to the hash its request is tracked by.
+    ///
+    /// The default uses KeyHash<KeyType>, which returns the precomputed hash
+    /// of a HashedKey. Keys that KeyHash doesn't support are tracked by the
+    /// hash of their task id.
+    ///
+    /// \param key key to convert.
+    /// \returns a 64-bit hash of the key.
+    virtual std::uint64_t toTaskHash(const KeyType& key) const
+    {
+        return taskHash(key, IsKeyHashable<KeyType>());
+    }
+
+private:
+    std::uint64_t taskHash(const KeyType& key, std::true_type) const
+    {
+        return KeyHash<KeyType>::hash(key);
+    }
+
+    std::uint64_t taskHash(const KeyType& key, std::false_type) const
+    {
+        return KeyHash<std::string>::hash(toTaskId(key));
+    }
+
 };
 
 
@@ -64,7 +101,28 @@ public:
 
     void runTask() override
     {
-        std::shared_ptr<ValueType> value = _loader.load(*this);
+        std::shared_ptr<ValueType> value = nullptr;
+
+        try
+        {
+            CancellationToken::Scope scope(_cancellationToken);
+            value = _loader.load(*this);
+        }
+        catch (...)
+        {
+            // Aborted I/O fails, but the request already counts as cancelled.
+            if (_cancellationToken.isCancelled())
+            {
+                return;
+            }
+
+            throw;
+        }
+
+        if (_cancellationToken.isCancelled())
+        {
+            return;
+        }
 
         if (value != nullptr)
         {
@@ -76,6 +134,16 @@ public:
         }
     }
 
+    /// \brief Cancel the task and abort the I/O of its load.
+    ///
+    /// The token returned by cancellationToken() is cancelled, so stores
+    /// reading on the task's thread stop transferring.
+    void cancel() override
+    {
+        Poco::Task::cancel();
+        _cancellationToken.cancel();
+    }
+
     void setProgress(float progress)
     {
         Poco::Task::setProgress(progress);
@@ -86,9 +154,18 @@ public:
         return _key;
     }
 
-private:
+    /// \returns the token cancelled when the task is cancelled.
+    const CancellationToken& cancellationToken() const
+    {
+        return _cancellationToken;
+    }
+
+protected:
     /// The key to load.
     KeyType _key;
+
+    /// \brief Cancelled with the task, current while loading.
+    CancellationToken _cancellationToken;
     BaseResourceCacheLoader<KeyType, ValueType>& _loader;
 
     friend class BaseResourceCacheLoader<KeyType, ValueType>;
@@ -96,6 +173,30 @@ private:
 };
 
 
+/// \brief What a resource cache does when its request queue is full.
+enum class OverflowPolicy
+{
+    /// \brief Reject the new request.
+    REJECT,
+    /// \brief Drop the oldest queued request to make room.
+    ///
+    /// Only requests that don't outrank the new request are dropped, so e.g.
+    /// an idle prefetch never displaces a queued user request. If every
+    /// queued request outranks the new one, the new request is rejected.
+    DROP_OLDEST,
+    /// \brief Drop the oldest queued request with the lowest priority.
+    ///
+    /// If the new request has a lower priority than every queued request, the
+    /// new request is rejected instead.
+    DROP_LOWEST_PRIORITY,
+    /// \brief Block the caller until there is room in the queue.
+    ///
+    /// Requests made from the main thread, where completions are processed,
+    /// and requests made with tryRequest() are rejected instead of blocking.
+    BLOCK
+};
+
+
 /// \brief A resource cache is a composite of a memory cache and a disk cache.
 ///
 /// When an value is requested with request() it will first search for the value
@@ -103,6 +204,15 @@ private:
 /// attempt to load the resource into the cache. Subclasses must implement the
 /// load() function from the BaseKeyRequestTaskLoader() interface.
 ///
+/// The number of requests handed to the TaskQueue at once and the number of
+/// requests waiting to be handed over can both be limited. Waiting requests
+/// are started in priority order. When the wait queue is full, the overflow
+/// policy decides which request is dropped or whether the caller blocks.
+///
+/// Requests are tracked by toTaskHash(), so checking the progress or state
+/// of a request does not build its task id. Using HashedKey keys avoids
+/// rehashing the key as well.
+///
 /// \tparam KeyType The key type.
 /// \tparam ValueType The value type (e.g. a std::shared_ptr<ValueType>).
 template<typename KeyType, typename ValueType>
@@ -123,6 +233,45 @@ public:
     /// \brief Destroy the BaseResourceCache.
     virtual ~BaseResourceCache();
 
+    /// \brief Set the maximum number of requests running at once.
+    ///
+    /// Requests count as running from the time they are handed to the
+    /// TaskQueue until they complete, fail or are cancelled.
+    ///
+    /// Request priorities only take effect with a limit. Without one, every
+    /// request is started immediately and idle prefetches compete with
+    /// regular requests for the TaskQueue's threads.
+    ///
+    /// \param maximumInFlightRequests The maximum, or 0 for no limit.
+    void setMaximumInFlightRequests(std::size_t maximumInFlightRequests);
+
+    /// \returns the maximum number of requests running at once, or 0.
+    std::size_t maximumInFlightRequests() const;
+
+    /// \brief Set the maximum number of requests waiting to run.
+    /// \param maximumQueuedRequests The maximum, or 0 for no limit.
+    void setMaximumQueuedRequests(std::size_t maximumQueuedRequests);
+
+    /// \returns the maximum number of requests waiting to run, or 0.
+    std::size_t maximumQueuedRequests() const;
+
+    /// \brief Set the policy applied when the wait queue is full.
+    /// \param overflowPolicy The overflow policy.
+    void setOverflowPolicy(OverflowPolicy overflowPolicy);
+
+    /// \returns the policy applied when the wait queue is full.
+    OverflowPolicy overflowPolicy() const;
+
+    /// \returns the number of requests currently running.
+    std::size_t inFlightRequests() const;
+
+    /// \returns the number of requests currently waiting to run.
+    std::size_t queuedRequests() const;
+
+    /// \returns the counters of this node, including the bytes and
+    /// evictions of its memory cache.
+    CacheStatistics statistics() const override;
+
 protected:
     bool doHas(const KeyType& key) const override
     {
@@ -158,23 +307,109 @@ protected:
         _memoryCache->clear();
     }
 
-    void doRequest(const KeyType& key) override;
+    bool doRequest(const KeyType& key, RequestPriority priority, bool wait) override;
     void doCancelRequest(const KeyType& key) override;
     void doCancelQueuedRequest(const KeyType& key) override;
     float doRequestProgress(const KeyType& key) const override;
     RequestState doRequestState(const KeyType& key) const override;
 
+    /// \brief Create the task that loads the given key.
+    /// \param key The key to load.
+    /// \returns a new task owned by the caller.
+    virtual Poco::Task* createTask(const KeyType& key);
+
     bool onTaskCancelled(const TaskQueueEventArgs& args);
     bool onTaskFailed(const TaskFailedEventArgs& args);
     bool onTaskCustomNotification(const TaskCustomNotificationEventArgs& args);
 
-    /// \brief A list of task ids.
-    std::map<std::string, KeyType> _requests;
+    /// \brief Finish a running request as cancelled.
+    ///
+    /// Used when no task will post the cancellation, e.g. after a stage of
+    /// the request couldn't be handed to its queue.
+    ///
+    /// \param taskId The task id of the request.
+    /// \returns false if the request already finished.
+    bool cancelRunningRequest(const std::string& taskId);
+
+    /// \brief Finish a running request as failed.
+    ///
+    /// Used when no task will post the failure, see cancelRunningRequest().
+    ///
+    /// \param taskId The task id of the request.
+    /// \param error The error of the request.
+    /// \returns false if the request already finished.
+    bool failRunningRequest(const std::string& taskId, const std::string& error);
+
+    /// \brief Decide whether another request may be handed to the TaskQueue.
+    ///
+    /// Requires the request mutex. Subclasses may add their own limits, but
+    /// must make sure finishing a request can free the slot again.
+    ///
+    /// \returns true if a request may be started now.
+    virtual bool hasFreeSlotLocked() const;
+
+    /// \brief A request that was handed to the TaskQueue.
+    struct RunningRequest
+    {
+        KeyType key;
+        std::string taskId;
+        Poco::AutoPtr<Poco::Task> task;
+    };
+
+    /// \brief Running requests indexed by task hash.
+    std::unordered_map<std::uint64_t, RunningRequest> _requests;
+
+    /// \brief Task hashes indexed by task id, for the TaskQueue events.
+    std::unordered_map<std::string, std::uint64_t> _requestHashes;
 
-private:
     /// \brief The shared task queue.
     TaskQueue& _taskQueue;
 
+private:
+    /// \brief A request waiting for a free slot.
+    struct QueuedRequest
+    {
+        KeyType key;
+        std::uint64_t hash;
+        RequestPriority priority;
+    };
+
+    /// \brief Take a finished request out of the request table.
+    ///
+    /// Queued requests are started if the finished request freed a slot.
+    ///
+    /// \param taskId The finished task id.
+    /// \param key The key of the finished request.
+    /// \returns true if the request belonged to this cache.
+    bool finishRequest(const std::string& taskId, KeyType& key);
+
+    /// \brief Remove a waiting request from the queue.
+    /// \returns true if the key was queued.
+    bool unqueueRequest(const KeyType& key);
+
+    /// \brief Find a running request. Requires the request mutex.
+    /// \returns the request or nullptr if the key is not running.
+    const RunningRequest* findRunningRequestLocked(const KeyType& key, std::uint64_t hash) const;
+
+    /// \brief Find the sequence of a queued request. Requires the request mutex.
+    /// \returns the sequence or nullptr if the key is not queued.
+    const std::uint64_t* findQueuedRequestLocked(const KeyType& key, std::uint64_t hash) const;
+
+    /// \brief Hand a request to the TaskQueue. Requires the request mutex.
+    /// \returns false if the TaskQueue already runs a task with the same id.
+    bool startRequestLocked(const KeyType& key, std::uint64_t hash);
+
+    /// \brief Start queued requests while slots are free. Requires the request mutex.
+    /// \param failed The keys that could not be started, to be failed by the
+    ///        caller once the mutex is released.
+    void startQueuedRequestsLocked(std::vector<KeyType>& failed);
+
+    /// \brief Drop a queued request. Requires the request mutex.
+    void dropQueuedRequestLocked(std::uint64_t sequence, std::vector<KeyType>& dropped);
+
+    /// \returns true if both keys are equivalent.
+    static bool isSameKey(const KeyType& lhs, const KeyType& rhs);
+
     /// \brief The task event listener.
     ofEventListener _onTaskCancelledListener;
     ofEventListener _onTaskFailedListener;
@@ -182,17 +417,47 @@ private:
 
     std::unique_ptr<BaseCache<KeyType, ValueType>> _memoryCache;
 
+    /// \brief The maximum number of running requests, or 0.
+    std::size_t _maximumInFlightRequests = 0;
+
+    /// \brief The maximum number of waiting requests, or 0.
+    std::size_t _maximumQueuedRequests = 0;
+
+    /// \brief The overflow policy.
+    OverflowPolicy _overflowPolicy = OverflowPolicy::REJECT;
+
+    /// \brief The number of running requests.
+    std::size_t _inFlightRequests = 0;
+
+    /// \brief The next queued request sequence number.
+    std::uint64_t _nextSequence = 0;
+
+    /// \brief Waiting requests indexed by sequence number (oldest first).
+    std::map<std::uint64_t, QueuedRequest> _queuedRequests;
+
+    /// \brief Waiting request sequences in start order (-priority, sequence).
+    std::set<std::pair<int, std::uint64_t>> _queuedRequestOrder;
+
+    /// \brief Waiting request sequences indexed by task hash.
+    std::unordered_map<std::uint64_t, std::uint64_t> _queuedRequestSequences;
+
+    /// \brief The mutex protecting the request tables.
+    mutable std::mutex _requestMutex;
+
+    /// \brief The condition signalled when queued requests are started.
+    std::condition_variable _requestCondition;
+
 };
 
 
 template<typename KeyType, typename ValueType>
 BaseResourceCache<KeyType, ValueType>::BaseResourceCache(std::unique_ptr<BaseCache<KeyType, ValueType>> memoryCache,
                                                          TaskQueue& taskQueue):
-    _memoryCache(std::move(memoryCache)),
     _taskQueue(taskQueue),
     _onTaskCancelledListener(_taskQueue.onTaskCancelled.newListener(this, &BaseResourceCache::onTaskCancelled)),
     _onTaskFailedListener(_taskQueue.onTaskFailed.newListener(this, &BaseResourceCache::onTaskFailed)),
-    _onTaskCustomNotificationListener(_taskQueue.onTaskCustomNotification.newListener(this, &BaseResourceCache::onTaskCustomNotification))
+    _onTaskCustomNotificationListener(_taskQueue.onTaskCustomNotification.newListener(this, &BaseResourceCache::onTaskCustomNotification)),
+    _memoryCache(std::move(memoryCache))
 {
 }
 
@@ -204,27 +469,241 @@ BaseResourceCache<KeyType, ValueType>::~BaseResourceCache()
 
 
 template<typename KeyType, typename ValueType>
-void BaseResourceCache<KeyType, ValueType>::doRequest(const KeyType& key)
+void BaseResourceCache<KeyType, ValueType>::setMaximumInFlightRequests(std::size_t maximumInFlightRequests)
 {
-    try
+    std::vector<KeyType> failed;
+
     {
-        auto taskId = this->toTaskId(key);
-        _taskQueue.start(taskId, new CacheRequestTask<KeyType, ValueType>(key, *this));
-        _requests[taskId] = key;;
+        std::unique_lock<std::mutex> lock(_requestMutex);
+        _maximumInFlightRequests = maximumInFlightRequests;
+        startQueuedRequestsLocked(failed);
     }
-    catch (const Poco::ExistsException& exc)
+
+    for (const auto& failedKey: failed)
     {
-        // Do nothing.
+        this->failRequest(failedKey, "Unable to start request.");
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t BaseResourceCache<KeyType, ValueType>::maximumInFlightRequests() const
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    return _maximumInFlightRequests;
+}
+
+
+template<typename KeyType, typename ValueType>
+void BaseResourceCache<KeyType, ValueType>::setMaximumQueuedRequests(std::size_t maximumQueuedRequests)
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    _maximumQueuedRequests = maximumQueuedRequests;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t BaseResourceCache<KeyType, ValueType>::maximumQueuedRequests() const
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    return _maximumQueuedRequests;
+}
+
+
+template<typename KeyType, typename ValueType>
+void BaseResourceCache<KeyType, ValueType>::setOverflowPolicy(OverflowPolicy overflowPolicy)
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    _overflowPolicy = overflowPolicy;
+}
+
+
+template<typename KeyType, typename ValueType>
+OverflowPolicy BaseResourceCache<KeyType, ValueType>::overflowPolicy() const
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    return _overflowPolicy;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t BaseResourceCache<KeyType, ValueType>::inFlightRequests() const
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    return _inFlightRequests;
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t BaseResourceCache<KeyType, ValueType>::queuedRequests() const
+{
+    std::unique_lock<std::mutex> lock(_requestMutex);
+    return _queuedRequests.size();
+}
+
+
+template<typename KeyType, typename ValueType>
+CacheStatistics BaseResourceCache<KeyType, ValueType>::statistics() const
+{
+    auto result = BaseAsyncCache<KeyType, ValueType>::statistics();
+    auto memoryStatistics = _memoryCache->statistics();
+    result.evictions += memoryStatistics.evictions;
+    result.bytes += memoryStatistics.bytes;
+    return result;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::doRequest(const KeyType& key,
+                                                      RequestPriority priority,
+                                                      bool wait)
+{
+    std::vector<KeyType> dropped;
+    std::uint64_t hash = this->toTaskHash(key);
+    bool isStarted = true;
+
+    {
+        std::unique_lock<std::mutex> lock(_requestMutex);
+
+        auto queued = findQueuedRequestLocked(key, hash);
+
+        if (queued != nullptr)
+        {
+            // Already queued, but the new request may be more important.
+            auto sequence = *queued;
+            auto& request = _queuedRequests.find(sequence)->second;
+
+            if (priority > request.priority)
+            {
+                _queuedRequestOrder.erase(std::make_pair(-static_cast<int>(request.priority), sequence));
+                request.priority = priority;
+                _queuedRequestOrder.insert(std::make_pair(-static_cast<int>(request.priority), sequence));
+            }
+
+            return true;
+        }
+
+        if (findRunningRequestLocked(key, hash) != nullptr)
+        {
+            // Already running.
+            return true;
+        }
+
+        if (_queuedRequestSequences.find(hash) != _queuedRequestSequences.end()
+         || _requests.find(hash) != _requests.end())
+        {
+            ofLogError("BaseResourceCache::doRequest") << "Task hash collision, rejecting request.";
+            return false;
+        }
+
+        for (;;)
+        {
+            if (_queuedRequests.empty() && hasFreeSlotLocked())
+            {
+                isStarted = startRequestLocked(key, hash);
+                break;
+            }
+
+            if (_maximumQueuedRequests == 0 || _queuedRequests.size() < _maximumQueuedRequests)
+            {
+                auto sequence = _nextSequence++;
+                _queuedRequests.emplace(sequence, QueuedRequest{ key, hash, priority });
+                _queuedRequestOrder.insert(std::make_pair(-static_cast<int>(priority), sequence));
+                _queuedRequestSequences[hash] = sequence;
+                break;
+            }
+
+            if (_overflowPolicy == OverflowPolicy::REJECT)
+            {
+                return false;
+            }
+            else if (_overflowPolicy == OverflowPolicy::DROP_OLDEST)
+            {
+                // Find the oldest request that doesn't outrank the new one,
+                // the oldest of each priority level comes first.
+                auto oldest = _queuedRequestOrder.end();
+
+                for (auto level = _queuedRequestOrder.lower_bound(std::make_pair(-static_cast<int>(priority), std::uint64_t(0)));
+                     level != _queuedRequestOrder.end();
+                     level = _queuedRequestOrder.lower_bound(std::make_pair(level->first + 1, std::uint64_t(0))))
+                {
+                    if (oldest == _queuedRequestOrder.end() || level->second < oldest->second)
+                    {
+                        oldest = level;
+                    }
+                }
+
+                if (oldest == _queuedRequestOrder.end())
+                {
+                    // Every queued request outranks the new one.
+                    return false;
+                }
+
+                dropQueuedRequestLocked(oldest->second, dropped);
+            }
+            else if (_overflowPolicy == OverflowPolicy::DROP_LOWEST_PRIORITY)
+            {
+                auto lowest = std::prev(_queuedRequestOrder.end());
+
+                if (lowest->first < -static_cast<int>(priority))
+                {
+                    // Every queued request outranks the new one.
+                    return false;
+                }
+
+                // Drop the oldest request among those with the lowest priority.
+                auto oldest = _queuedRequestOrder.lower_bound(std::make_pair(lowest->first, std::uint64_t(0)));
+                dropQueuedRequestLocked(oldest->second, dropped);
+            }
+            else if (!wait || ofThread::isMainThread())
+            {
+                // Completions are processed on the main thread, so blocking it
+                // would never free a slot.
+                return false;
+            }
+            else
+            {
+                _requestCondition.wait(lock);
+            }
+        }
+    }
+
+    for (const auto& droppedKey: dropped)
+    {
+        this->failRequest(droppedKey, "Request dropped.");
     }
+
+    // If the task couldn't be started, the caller fails the request.
+    return isStarted;
 }
 
 
 template<typename KeyType, typename ValueType>
 void BaseResourceCache<KeyType, ValueType>::doCancelRequest(const KeyType& key)
 {
+    if (unqueueRequest(key))
+    {
+        this->cancelledRequest(key);
+        return;
+    }
+
+    std::string taskId;
+
+    {
+        std::unique_lock<std::mutex> lock(_requestMutex);
+        auto request = findRunningRequestLocked(key, this->toTaskHash(key));
+
+        if (request == nullptr)
+        {
+            return;
+        }
+
+        taskId = request->taskId;
+    }
+
     try
     {
-        _taskQueue.cancel(this->toTaskId(key));
+        _taskQueue.cancel(taskId);
     }
     catch (const Poco::ExistsException& exc)
     {
@@ -236,9 +715,29 @@ void BaseResourceCache<KeyType, ValueType>::doCancelRequest(const KeyType& key)
 template<typename KeyType, typename ValueType>
 void BaseResourceCache<KeyType, ValueType>::doCancelQueuedRequest(const KeyType& key)
 {
+    if (unqueueRequest(key))
+    {
+        this->cancelledRequest(key);
+        return;
+    }
+
+    std::string taskId;
+
+    {
+        std::unique_lock<std::mutex> lock(_requestMutex);
+        auto request = findRunningRequestLocked(key, this->toTaskHash(key));
+
+        if (request == nullptr)
+        {
+            return;
+        }
+
+        taskId = request->taskId;
+    }
+
     try
     {
-        _taskQueue.cancelQueued(this->toTaskId(key));
+        _taskQueue.cancelQueued(taskId);
     }
     catch (const Poco::ExistsException& exc)
     {
@@ -250,56 +749,95 @@ void BaseResourceCache<KeyType, ValueType>::doCancelQueuedRequest(const KeyType&
 template<typename KeyType, typename ValueType>
 float BaseResourceCache<KeyType, ValueType>::doRequestProgress(const KeyType& key) const
 {
-    try
-    {
-        return _taskQueue.getTaskProgress(this->toTaskId(key));
-    }
-    catch (const Poco::ExistsException& exc)
+    Poco::AutoPtr<Poco::Task> task;
+
     {
-        return 0;
+        std::unique_lock<std::mutex> lock(_requestMutex);
+        auto request = findRunningRequestLocked(key, this->toTaskHash(key));
+
+        if (request == nullptr)
+        {
+            return 0;
+        }
+
+        task = request->task;
     }
+
+    return task->progress();
 }
 
 
 template<typename KeyType, typename ValueType>
 RequestState BaseResourceCache<KeyType, ValueType>::doRequestState(const KeyType& key) const
 {
-    try
+    Poco::AutoPtr<Poco::Task> task;
+    std::uint64_t hash = this->toTaskHash(key);
+
     {
-        Poco::Task::TaskState status = _taskQueue.getTaskState(this->toTaskId(key));
+        std::unique_lock<std::mutex> lock(_requestMutex);
+
+        if (findQueuedRequestLocked(key, hash) != nullptr)
+        {
+            return RequestState::IDLE;
+        }
 
-        switch (status)
+        auto request = findRunningRequestLocked(key, hash);
+
+        if (request == nullptr)
         {
-            case Poco::Task::TASK_IDLE:
-                return RequestState::IDLE;
-            case Poco::Task::TASK_STARTING:
-                return RequestState::STARTING;
-            case Poco::Task::TASK_RUNNING:
-                return RequestState::RUNNING;
-            case Poco::Task::TASK_CANCELLING:
-                return RequestState::CANCELLING;
-            case Poco::Task::TASK_FINISHED:
-                return RequestState::FINISHED;
-            default:
-                return RequestState::UNKNOWN;
+            return RequestState::UNKNOWN;
         }
+
+        task = request->task;
     }
-    catch (const Poco::ExistsException& exc)
+
+    switch (task->state())
     {
-        return RequestState::UNKNOWN;
+        case Poco::Task::TASK_IDLE:
+            return RequestState::IDLE;
+        case Poco::Task::TASK_STARTING:
+            return RequestState::STARTING;
+        case Poco::Task::TASK_RUNNING:
+            return RequestState::RUNNING;
+        case Poco::Task::TASK_CANCELLING:
+            return RequestState::CANCELLING;
+        case Poco::Task::TASK_FINISHED:
+            return RequestState::FINISHED;
+        default:
+            return RequestState::UNKNOWN;
     }
 }
 
 
+template<typename KeyType, typename ValueType>
+Poco::Task* BaseResourceCache<KeyType, ValueType>::createTask(const KeyType& key)
+{
+    return new CacheRequestTask<KeyType, ValueType>(key, *this);
+}
+
+
 template<typename KeyType, typename ValueType>
 bool BaseResourceCache<KeyType, ValueType>::onTaskCancelled(const TaskQueueEventArgs& args)
 {
-    auto iter = _requests.find(args.taskId());
+    return cancelRunningRequest(args.taskId());
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::onTaskFailed(const TaskFailedEventArgs& args)
+{
+    return failRunningRequest(args.taskId(), args.getException().displayText());
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::cancelRunningRequest(const std::string& taskId)
+{
+    KeyType key;
 
-    if (iter != _requests.end())
+    if (finishRequest(taskId, key))
     {
-        ofNotifyEvent(this->onRequestCancelled, iter->second, this);
-        _requests.erase(iter);
+        this->cancelledRequest(key);
         return true;
     }
     else
@@ -310,15 +848,15 @@ bool BaseResourceCache<KeyType, ValueType>::onTaskCancelled(const TaskQueueEvent
 
 
 template<typename KeyType, typename ValueType>
-bool BaseResourceCache<KeyType, ValueType>::onTaskFailed(const TaskFailedEventArgs& args)
+bool BaseResourceCache<KeyType, ValueType>::failRunningRequest(const std::string& taskId,
+                                                               const std::string& error)
 {
-    auto iter = _requests.find(args.taskId());
+    KeyType key;
 
-    if (iter != _requests.end())
+    if (finishRequest(taskId, key))
     {
-        RequestFailedArgs<KeyType> evt(iter->second, args.getException().displayText());
-        ofNotifyEvent(this->onRequestFailed, evt, this);
-        _requests.erase(iter);
+        CacheCounters::increment(this->_counters.loadFailures);
+        this->failRequest(key, error);
         return true;
     }
     else
@@ -331,20 +869,25 @@ bool BaseResourceCache<KeyType, ValueType>::onTaskFailed(const TaskFailedEventAr
 template<typename KeyType, typename ValueType>
 bool BaseResourceCache<KeyType, ValueType>::onTaskCustomNotification(const TaskCustomNotificationEventArgs& args)
 {
-    auto iter = _requests.find(args.taskId());
+    KeyType key;
 
-    if (iter != _requests.end())
+    if (finishRequest(args.taskId(), key))
     {
         typename CacheRequestTask<KeyType, ValueType>::KeyValuePair result;
 
         if (args.extract(result))
         {
+            CacheCounters::increment(this->_counters.loads);
+
             // Cache it!
             this->add(result.first, result.second);
+            this->completeRequest(result.first, result.second, CacheStatus::CACHE_MISS);
         }
         else
         {
             ofLogError("BaseResourceCache<KeyType, ValueType>::onTaskCustomNotification") << "Unable to extract the value.";
+            CacheCounters::increment(this->_counters.loadFailures);
+            this->failRequest(key, "Unable to extract the value.");
         }
 
         return true;
@@ -356,4 +899,165 @@ bool BaseResourceCache<KeyType, ValueType>::onTaskCustomNotification(const TaskC
 }
 
 
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::finishRequest(const std::string& taskId, KeyType& key)
+{
+    std::vector<KeyType> failed;
+
+    {
+        std::unique_lock<std::mutex> lock(_requestMutex);
+
+        auto hash = _requestHashes.find(taskId);
+
+        if (hash == _requestHashes.end())
+        {
+            return false;
+        }
+
+        auto iter = _requests.find(hash->second);
+        key = iter->second.key;
+        _requests.erase(iter);
+        _requestHashes.erase(hash);
+
+        if (_inFlightRequests > 0)
+        {
+            --_inFlightRequests;
+        }
+
+        startQueuedRequestsLocked(failed);
+    }
+
+    _requestCondition.notify_all();
+
+    for (const auto& failedKey: failed)
+    {
+        this->failRequest(failedKey, "Unable to start request.");
+    }
+
+    return true;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::unqueueRequest(const KeyType& key)
+{
+    {
+        std::unique_lock<std::mutex> lock(_requestMutex);
+
+        auto sequence = findQueuedRequestLocked(key, this->toTaskHash(key));
+
+        if (sequence == nullptr)
+        {
+            return false;
+        }
+
+        std::vector<KeyType> unqueued;
+        dropQueuedRequestLocked(*sequence, unqueued);
+    }
+
+    _requestCondition.notify_all();
+    return true;
+}
+
+
+template<typename KeyType, typename ValueType>
+const typename BaseResourceCache<KeyType, ValueType>::RunningRequest*
+BaseResourceCache<KeyType, ValueType>::findRunningRequestLocked(const KeyType& key, std::uint64_t hash) const
+{
+    auto iter = _requests.find(hash);
+
+    if (iter == _requests.end() || !isSameKey(iter->second.key, key))
+    {
+        return nullptr;
+    }
+
+    return &iter->second;
+}
+
+
+template<typename KeyType, typename ValueType>
+const std::uint64_t* BaseResourceCache<KeyType, ValueType>::findQueuedRequestLocked(const KeyType& key, std::uint64_t hash) const
+{
+    auto iter = _queuedRequestSequences.find(hash);
+
+    if (iter == _queuedRequestSequences.end() || !isSameKey(_queuedRequests.find(iter->second)->second.key, key))
+    {
+        return nullptr;
+    }
+
+    return &iter->second;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::startRequestLocked(const KeyType& key, std::uint64_t hash)
+{
+    try
+    {
+        auto taskId = this->toTaskId(key);
+        Poco::AutoPtr<Poco::Task> task(createTask(key));
+        _taskQueue.start(taskId, task.duplicate());
+        _requestHashes[taskId] = hash;
+        _requests[hash] = RunningRequest { key, taskId, task };
+        ++_inFlightRequests;
+        return true;
+    }
+    catch (const Poco::ExistsException& exc)
+    {
+        // The task id is taken, e.g. by another cache sharing the TaskQueue,
+        // so no notification would ever complete this request.
+        ofLogError("BaseResourceCache::startRequestLocked") << exc.displayText();
+        return false;
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+void BaseResourceCache<KeyType, ValueType>::startQueuedRequestsLocked(std::vector<KeyType>& failed)
+{
+    while (!_queuedRequestOrder.empty() && hasFreeSlotLocked())
+    {
+        auto sequence = _queuedRequestOrder.begin()->second;
+        QueuedRequest request = _queuedRequests.find(sequence)->second;
+        std::vector<KeyType> started;
+        dropQueuedRequestLocked(sequence, started);
+
+        if (!startRequestLocked(request.key, request.hash))
+        {
+            failed.push_back(request.key);
+        }
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+void BaseResourceCache<KeyType, ValueType>::dropQueuedRequestLocked(std::uint64_t sequence,
+                                                                    std::vector<KeyType>& dropped)
+{
+    auto iter = _queuedRequests.find(sequence);
+
+    if (iter != _queuedRequests.end())
+    {
+        _queuedRequestOrder.erase(std::make_pair(-static_cast<int>(iter->second.priority), sequence));
+        _queuedRequestSequences.erase(iter->second.hash);
+        dropped.push_back(iter->second.key);
+        _queuedRequests.erase(iter);
+    }
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::hasFreeSlotLocked() const
+{
+    return _maximumInFlightRequests == 0 || _inFlightRequests < _maximumInFlightRequests;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool BaseResourceCache<KeyType, ValueType>::isSameKey(const KeyType& lhs, const KeyType& rhs)
+{
+    return !(lhs < rhs) && !(rhs < lhs);
+}
+
+
 } } // namespace ofx::Cache
@@ -0,0 +1,345 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Poco/Exception.h"
+#include "ofEvents.h"
+#include "ofFileUtils.h"
+#include "ofLog.h"
+#include "ofx/Cache/BaseStore.h"
+#include "ofx/Cache/KeySerializer.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief The operations recorded in an access trace.
+enum class TraceOperation: uint8_t
+{
+    /// \brief A key was read.
+    GET = 0,
+    /// \brief A key was added or updated.
+    ADD = 1,
+    /// \brief A key was removed.
+    REMOVE = 2
+};
+
+
+/// \brief Records the key accesses of one or more stores to a trace file.
+///
+/// A trace file starts with an 8 byte signature followed by one record per
+/// access. Each record is a TraceOperation byte followed by the key written
+/// with KeySerializer<KeyType>. Values are never recorded.
+///
+/// Records are buffered in memory. Full buffers are handed to a background
+/// thread that writes them in large blocks, so recording costs a key copy
+/// under a lock and never waits for the disk.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class TraceRecorder
+{
+public:
+    /// \brief Create a TraceRecorder writing to the given path.
+    /// \param path The path of the trace file. Existing files are replaced.
+    /// \param bufferSize The number of bytes buffered before writing.
+    /// \throws Poco::CreateFileException if the trace file can't be written.
+    TraceRecorder(const std::string& path,
+                  std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    /// \brief Flush and close the trace.
+    ~TraceRecorder();
+
+    /// \brief Record the gets of a store.
+    ///
+    /// The store must outlive the recorder.
+    ///
+    /// \param store The store to record.
+    template<typename ValueType>
+    void attach(BaseReadableStore<KeyType, ValueType>& store);
+
+    /// \brief Record the gets, adds and removes of a store.
+    ///
+    /// The store must outlive the recorder.
+    ///
+    /// \param store The store to record.
+    template<typename ValueType>
+    void attach(BaseWritableStore<KeyType, ValueType>& store);
+
+    /// \brief Record a single access.
+    /// \param operation The operation.
+    /// \param key The key that was accessed.
+    void record(TraceOperation operation, const KeyType& key);
+
+    /// \brief Write all buffered records to the trace file.
+    ///
+    /// Waits for the blocks handed to the background thread as well.
+    void flush();
+
+    /// \returns the number of records written or buffered.
+    uint64_t count() const;
+
+    /// \brief Read a trace file.
+    /// \param path The path of the trace file.
+    /// \param callback The function called for each record.
+    /// \returns the number of records read.
+    static uint64_t read(const std::string& path,
+                         std::function<void(TraceOperation, const KeyType&)> callback);
+
+    enum
+    {
+        /// \brief The default number of bytes buffered before writing.
+        DEFAULT_BUFFER_SIZE = 1024 * 1024
+    };
+
+private:
+    /// \brief Write full blocks until the recorder is destroyed.
+    void run();
+
+    /// \brief Write the given blocks to the trace file.
+    ///
+    /// The stream mutex must be held by the caller.
+    void writeBlocks(const std::vector<std::string>& blocks);
+
+    static const char* signature()
+    {
+        return "OFXCTRC1";
+    }
+
+    std::ofstream _stream;
+    std::ostringstream _buffer;
+    std::size_t _bufferSize = DEFAULT_BUFFER_SIZE;
+    std::atomic<uint64_t> _count;
+
+    /// \brief The full blocks waiting to be written, oldest first.
+    std::vector<std::string> _blocks;
+
+    /// \brief False once the writer thread should stop.
+    bool _isRunning = true;
+
+    /// \brief Guards the buffer, the blocks and the running flag.
+    mutable std::mutex _mutex;
+
+    /// \brief Guards the stream. Blocks are only taken while holding it, so
+    /// they are written in order. Taken before the mutex.
+    std::mutex _streamMutex;
+
+    /// \brief Notified when a block is full or the recorder stops.
+    std::condition_variable _condition;
+
+    /// \brief The thread writing full blocks.
+    std::thread _thread;
+
+    std::vector<ofEventListener> _listeners;
+
+};
+
+
+template<typename KeyType>
+TraceRecorder<KeyType>::TraceRecorder(const std::string& path,
+                                      std::size_t bufferSize):
+    _stream(ofToDataPath(path, true), std::ios::binary | std::ios::trunc),
+    _bufferSize(bufferSize),
+    _count(0)
+{
+    if (!_stream.good())
+    {
+        throw Poco::CreateFileException("Unable to open trace file.", path);
+    }
+
+    _stream.write(signature(), 8);
+
+    if (!_stream.good())
+    {
+        throw Poco::CreateFileException("Unable to write trace file.", path);
+    }
+
+    _thread = std::thread([this]() { run(); });
+}
+
+
+template<typename KeyType>
+TraceRecorder<KeyType>::~TraceRecorder()
+{
+    // Stop listening before the buffer goes away.
+    _listeners.clear();
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _isRunning = false;
+    }
+
+    _condition.notify_all();
+    _thread.join();
+
+    flush();
+}
+
+
+template<typename KeyType>
+template<typename ValueType>
+void TraceRecorder<KeyType>::attach(BaseReadableStore<KeyType, ValueType>& store)
+{
+    _listeners.push_back(store.onGet.newListener([this](const KeyType& key) {
+        record(TraceOperation::GET, key);
+    }));
+}
+
+
+template<typename KeyType>
+template<typename ValueType>
+void TraceRecorder<KeyType>::attach(BaseWritableStore<KeyType, ValueType>& store)
+{
+    attach(static_cast<BaseReadableStore<KeyType, ValueType>&>(store));
+
+    _listeners.push_back(store.onAdd.newListener([this](const std::pair<KeyType, std::shared_ptr<ValueType>>& args) {
+        record(TraceOperation::ADD, args.first);
+    }));
+
+    _listeners.push_back(store.onUpdate.newListener([this](const std::pair<KeyType, std::shared_ptr<ValueType>>& args) {
+        record(TraceOperation::ADD, args.first);
+    }));
+
+    _listeners.push_back(store.onRemove.newListener([this](const KeyType& key) {
+        record(TraceOperation::REMOVE, key);
+    }));
+}
+
+
+template<typename KeyType>
+void TraceRecorder<KeyType>::record(TraceOperation operation, const KeyType& key)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _buffer.put(static_cast<char>(operation));
+        KeySerializer<KeyType>::write(_buffer, key);
+        ++_count;
+
+        if (static_cast<std::size_t>(_buffer.tellp()) < _bufferSize)
+        {
+            return;
+        }
+
+        // Hand the full buffer to the writer thread.
+        _blocks.push_back(_buffer.str());
+        _buffer.str(std::string());
+        _buffer.clear();
+    }
+
+    _condition.notify_all();
+}
+
+
+template<typename KeyType>
+void TraceRecorder<KeyType>::flush()
+{
+    std::unique_lock<std::mutex> streamLock(_streamMutex);
+    std::vector<std::string> blocks;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::swap(blocks, _blocks);
+        blocks.push_back(_buffer.str());
+        _buffer.str(std::string());
+        _buffer.clear();
+    }
+
+    writeBlocks(blocks);
+    _stream.flush();
+}
+
+
+template<typename KeyType>
+uint64_t TraceRecorder<KeyType>::count() const
+{
+    return _count.load();
+}
+
+
+template<typename KeyType>
+uint64_t TraceRecorder<KeyType>::read(const std::string& path,
+                                      std::function<void(TraceOperation, const KeyType&)> callback)
+{
+    std::ifstream stream(ofToDataPath(path, true), std::ios::binary);
+    char header[8];
+
+    if (!stream.read(header, 8) || !std::equal(header, header + 8, signature()))
+    {
+        ofLogError("TraceRecorder::read") << "Invalid trace file " << path;
+        return 0;
+    }
+
+    uint64_t count = 0;
+    char operation = 0;
+    KeyType key;
+
+    while (stream.get(operation) && KeySerializer<KeyType>::read(stream, key))
+    {
+        callback(static_cast<TraceOperation>(operation), key);
+        ++count;
+    }
+
+    return count;
+}
+
+
+template<typename KeyType>
+void TraceRecorder<KeyType>::run()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]() { return !_isRunning || !_blocks.empty(); });
+
+            if (!_isRunning)
+            {
+                // The destructor flushes the remaining blocks.
+                return;
+            }
+        }
+
+        std::unique_lock<std::mutex> streamLock(_streamMutex);
+        std::vector<std::string> blocks;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::swap(blocks, _blocks);
+        }
+
+        writeBlocks(blocks);
+    }
+}
+
+
+template<typename KeyType>
+void TraceRecorder<KeyType>::writeBlocks(const std::vector<std::string>& blocks)
+{
+    for (const auto& block: blocks)
+    {
+        if (!_stream.write(block.data(), block.size()))
+        {
+            ofLogError("TraceRecorder::writeBlocks") << "Unable to write " << block.size() << " bytes of records.";
+        }
+    }
+}
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,419 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include "ofJson.h"
+#include "ofx/Cache/TraceRecorder.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A lightweight model of an eviction policy used for trace replay.
+///
+/// Models only track keys, so replaying a trace costs no value memory.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class BaseSimulatedPolicy
+{
+public:
+    /// \brief Create a simulated policy.
+    /// \param capacity The maximum number of keys.
+    BaseSimulatedPolicy(std::size_t capacity): _capacity(capacity)
+    {
+    }
+
+    /// \brief Destroy the simulated policy.
+    virtual ~BaseSimulatedPolicy()
+    {
+    }
+
+    /// \brief Look up a key.
+    /// \returns true if the key was present.
+    virtual bool get(const KeyType& key) = 0;
+
+    /// \brief Insert a key, evicting if needed.
+    virtual void add(const KeyType& key) = 0;
+
+    /// \brief Remove a key.
+    virtual void remove(const KeyType& key) = 0;
+
+protected:
+    /// \brief The maximum number of keys.
+    std::size_t _capacity = 0;
+
+};
+
+
+/// \brief A simulated least recently used policy, matching LRUMemoryCache.
+template<typename KeyType>
+class SimulatedLRUPolicy: public BaseSimulatedPolicy<KeyType>
+{
+public:
+    using BaseSimulatedPolicy<KeyType>::BaseSimulatedPolicy;
+
+    bool get(const KeyType& key) override
+    {
+        auto iter = _index.find(key);
+
+        if (iter == _index.end())
+        {
+            return false;
+        }
+
+        _keys.splice(_keys.begin(), _keys, iter->second);
+        return true;
+    }
+
+    void add(const KeyType& key) override
+    {
+        if (get(key))
+        {
+            return;
+        }
+
+        _keys.push_front(key);
+        _index[key] = _keys.begin();
+
+        while (_keys.size() > this->_capacity)
+        {
+            _index.erase(_keys.back());
+            _keys.pop_back();
+        }
+    }
+
+    void remove(const KeyType& key) override
+    {
+        auto iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            _keys.erase(iter->second);
+            _index.erase(iter);
+        }
+    }
+
+private:
+    std::list<KeyType> _keys;
+    std::map<KeyType, typename std::list<KeyType>::iterator> _index;
+
+};
+
+
+/// \brief A simulated first in, first out policy.
+template<typename KeyType>
+class SimulatedFIFOPolicy: public BaseSimulatedPolicy<KeyType>
+{
+public:
+    using BaseSimulatedPolicy<KeyType>::BaseSimulatedPolicy;
+
+    bool get(const KeyType& key) override
+    {
+        return _index.find(key) != _index.end();
+    }
+
+    void add(const KeyType& key) override
+    {
+        if (get(key))
+        {
+            return;
+        }
+
+        _keys.push_front(key);
+        _index[key] = _keys.begin();
+
+        while (_keys.size() > this->_capacity)
+        {
+            _index.erase(_keys.back());
+            _keys.pop_back();
+        }
+    }
+
+    void remove(const KeyType& key) override
+    {
+        auto iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            _keys.erase(iter->second);
+            _index.erase(iter);
+        }
+    }
+
+private:
+    std::list<KeyType> _keys;
+    std::map<KeyType, typename std::list<KeyType>::iterator> _index;
+
+};
+
+
+/// \brief A simulated least frequently used policy.
+///
+/// Ties are broken by evicting the least recently inserted key.
+template<typename KeyType>
+class SimulatedLFUPolicy: public BaseSimulatedPolicy<KeyType>
+{
+public:
+    using BaseSimulatedPolicy<KeyType>::BaseSimulatedPolicy;
+
+    bool get(const KeyType& key) override
+    {
+        auto iter = _index.find(key);
+
+        if (iter == _index.end())
+        {
+            return false;
+        }
+
+        _order.erase(iter->second);
+        _keys.erase(iter->second.second);
+        ++iter->second.first;
+        iter->second.second = _clock++;
+        _order.insert(iter->second);
+        _keys[iter->second.second] = key;
+        return true;
+    }
+
+    void add(const KeyType& key) override
+    {
+        if (get(key))
+        {
+            return;
+        }
+
+        if (_index.size() >= this->_capacity && !_order.empty())
+        {
+            auto victim = _order.begin();
+            auto keyIter = _keys.find(victim->second);
+            _index.erase(keyIter->second);
+            _keys.erase(keyIter);
+            _order.erase(victim);
+        }
+
+        Rank rank(1, _clock++);
+        _index[key] = rank;
+        _order.insert(rank);
+        _keys[rank.second] = key;
+    }
+
+    void remove(const KeyType& key) override
+    {
+        auto iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            _order.erase(iter->second);
+            _keys.erase(iter->second.second);
+            _index.erase(iter);
+        }
+    }
+
+private:
+    /// \brief The access count and the last access time.
+    typedef std::pair<uint64_t, uint64_t> Rank;
+
+    uint64_t _clock = 0;
+    std::map<KeyType, Rank> _index;
+    std::set<Rank> _order;
+    std::map<uint64_t, KeyType> _keys;
+
+};
+
+
+/// \brief The result of replaying a trace against one policy and capacity.
+class SimulationResult
+{
+public:
+    /// \brief The name of the simulated policy.
+    std::string policy;
+
+    /// \brief The simulated capacity.
+    std::size_t capacity = 0;
+
+    /// \brief The number of gets that hit.
+    uint64_t hits = 0;
+
+    /// \brief The number of gets that missed.
+    uint64_t misses = 0;
+
+    /// \returns the fraction of gets that hit.
+    double hitRatio() const
+    {
+        return (hits + misses) > 0 ? double(hits) / double(hits + misses) : 0;
+    }
+
+    /// \returns the result as JSON.
+    ofJson toJson() const
+    {
+        ofJson json;
+        json["policy"] = policy;
+        json["capacity"] = capacity;
+        json["hits"] = hits;
+        json["misses"] = misses;
+        json["hitRatio"] = hitRatio();
+        return json;
+    }
+};
+
+
+/// \brief Replays access traces against simulated eviction policies.
+///
+/// Replaying a trace against several capacities produces a hit-ratio curve
+/// for each policy, which can be used to size caches offline. A get that
+/// misses inserts the key, modelling a read-through cascade.
+///
+/// \tparam KeyType The key type.
+template<typename KeyType>
+class TraceSimulator
+{
+public:
+    typedef std::function<std::unique_ptr<BaseSimulatedPolicy<KeyType>>(std::size_t capacity)> PolicyFactory;
+
+    /// \brief Create a TraceSimulator with the LRU, FIFO and LFU policies.
+    TraceSimulator()
+    {
+        addPolicy("LRU", [](std::size_t capacity) {
+            return std::unique_ptr<BaseSimulatedPolicy<KeyType>>(new SimulatedLRUPolicy<KeyType>(capacity));
+        });
+
+        addPolicy("FIFO", [](std::size_t capacity) {
+            return std::unique_ptr<BaseSimulatedPolicy<KeyType>>(new SimulatedFIFOPolicy<KeyType>(capacity));
+        });
+
+        addPolicy("LFU", [](std::size_t capacity) {
+            return std::unique_ptr<BaseSimulatedPolicy<KeyType>>(new SimulatedLFUPolicy<KeyType>(capacity));
+        });
+    }
+
+    /// \brief Add a policy to simulate.
+    /// \param name The name of the policy.
+    /// \param factory The function creating the policy for a capacity.
+    void addPolicy(const std::string& name, PolicyFactory factory)
+    {
+        _policies[name] = factory;
+    }
+
+    /// \brief Load a trace written by TraceRecorder.
+    /// \param path The path of the trace file.
+    /// \returns the number of records loaded.
+    uint64_t load(const std::string& path)
+    {
+        _trace.clear();
+
+        return TraceRecorder<KeyType>::read(path, [this](TraceOperation operation, const KeyType& key) {
+            _trace.push_back(std::make_pair(operation, key));
+        });
+    }
+
+    /// \brief Replay the loaded trace against every policy and capacity.
+    ///
+    /// Policies and capacities are simulated in parallel, on at most one
+    /// thread per core.
+    ///
+    /// \param capacities The capacities to simulate.
+    /// \returns the results, grouped by policy in capacity order.
+    std::vector<SimulationResult> simulate(const std::vector<std::size_t>& capacities) const
+    {
+        std::vector<SimulationResult> results;
+
+        for (const auto& policy: _policies)
+        {
+            for (auto capacity: capacities)
+            {
+                SimulationResult result;
+                result.policy = policy.first;
+                result.capacity = capacity;
+                results.push_back(result);
+            }
+        }
+
+        std::size_t numThreads = std::min<std::size_t>(results.size(),
+                                                       std::max(std::thread::hardware_concurrency(), 1u));
+        std::atomic<std::size_t> next(0);
+        std::vector<std::thread> threads;
+
+        for (std::size_t i = 0; i < numThreads; ++i)
+        {
+            threads.push_back(std::thread([this, &results, &next]() {
+                for (std::size_t index = next++; index < results.size(); index = next++)
+                {
+                    replay(results[index]);
+                }
+            }));
+        }
+
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+
+        return results;
+    }
+
+    /// \brief Convert simulation results to JSON.
+    /// \param results The results to convert.
+    /// \returns a JSON array of results.
+    static ofJson toJson(const std::vector<SimulationResult>& results)
+    {
+        ofJson json = ofJson::array();
+
+        for (const auto& result: results)
+        {
+            json.push_back(result.toJson());
+        }
+
+        return json;
+    }
+
+private:
+    void replay(SimulationResult& result) const
+    {
+        auto policy = _policies.find(result.policy)->second(result.capacity);
+
+        for (const auto& record: _trace)
+        {
+            switch (record.first)
+            {
+                case TraceOperation::GET:
+                    if (policy->get(record.second))
+                    {
+                        ++result.hits;
+                    }
+                    else
+                    {
+                        ++result.misses;
+                        policy->add(record.second);
+                    }
+                    break;
+                case TraceOperation::ADD:
+                    policy->add(record.second);
+                    break;
+                case TraceOperation::REMOVE:
+                    policy->remove(record.second);
+                    break;
+            }
+        }
+    }
+
+    std::map<std::string, PolicyFactory> _policies;
+    std::vector<std::pair<TraceOperation, KeyType>> _trace;
+
+};
+
+
+} } // namespace ofx::Cache
@@ -0,0 +1,84 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "ofFileUtils.h"
+#include "ofPixels.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief Estimates the number of bytes held by a cached value.
+///
+/// The default estimate is sizeof(ValueType). Types that own heap memory
+/// should specialize this template so byte counters and budgets are useful.
+///
+/// \tparam ValueType The value type.
+template<typename ValueType, typename Enable = void>
+struct ValueSize
+{
+    /// \param value The value to measure.
+    /// \returns the estimated number of bytes held by the value.
+    static std::size_t size(const ValueType&)
+    {
+        return sizeof(ValueType);
+    }
+};
+
+
+/// \brief A ValueSize for strings.
+template<>
+struct ValueSize<std::string>
+{
+    static std::size_t size(const std::string& value)
+    {
+        return sizeof(value) + value.capacity();
+    }
+};
+
+
+/// \brief A ValueSize for vectors of trivially copyable elements.
+template<typename T>
+struct ValueSize<std::vector<T>, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+    static std::size_t size(const std::vector<T>& value)
+    {
+        return sizeof(value) + value.capacity() * sizeof(T);
+    }
+};
+
+
+/// \brief A ValueSize for buffers.
+template<>
+struct ValueSize<ofBuffer>
+{
+    static std::size_t size(const ofBuffer& value)
+    {
+        return sizeof(value) + value.size();
+    }
+};
+
+
+/// \brief A ValueSize for pixels.
+template<typename PixelType>
+struct ValueSize<ofPixels_<PixelType>>
+{
+    static std::size_t size(const ofPixels_<PixelType>& value)
+    {
+        return sizeof(value) + value.getTotalBytes();
+    }
+};
+
+
+} } // namespace ofx::Cache
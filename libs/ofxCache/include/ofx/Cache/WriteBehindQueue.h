@@ -0,0 +1,324 @@
+//
+// Copyright (c) 2014 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier: MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace Cache {
+
+
+/// \brief A bounded queue of writes flushed by a background thread.
+///
+/// Writes are coalesced per key: if a key is written again before it is
+/// flushed, the queued value is replaced and the key keeps its place in the
+/// queue (last write wins). The background thread hands the queued writes to
+/// the write function in batches, in the order the keys were first queued.
+///
+/// When the queue is full, writes of new keys block until the background
+/// thread has made room. Destroying the queue flushes all pending writes.
+///
+/// \tparam KeyType The key type.
+/// \tparam ValueType The value type.
+template<typename KeyType, typename ValueType>
+class WriteBehindQueue
+{
+public:
+    typedef std::pair<KeyType, std::shared_ptr<ValueType>> Write;
+    typedef std::function<void(const std::vector<Write>&)> WriteFunction;
+
+    /// \brief Create a WriteBehindQueue.
+    /// \param writeFunction The function called with each batch of writes.
+    /// \param maximumPendingWrites The maximum number of queued keys.
+    /// \param batchSize The maximum number of writes in one batch.
+    WriteBehindQueue(WriteFunction writeFunction,
+                     std::size_t maximumPendingWrites = DEFAULT_MAXIMUM_PENDING_WRITES,
+                     std::size_t batchSize = DEFAULT_BATCH_SIZE);
+
+    /// \brief Flush all pending writes and stop the background thread.
+    ~WriteBehindQueue();
+
+    /// \brief Queue a write.
+    ///
+    /// Blocks while the queue is full and the key is not already queued.
+    ///
+    /// \param key The key to write.
+    /// \param value The value to write.
+    void write(const KeyType& key, std::shared_ptr<ValueType> value);
+
+    /// \brief Find a value that has not been written yet.
+    /// \param key The key to find.
+    /// \returns the most recent queued value or nullptr.
+    std::shared_ptr<ValueType> find(const KeyType& key) const;
+
+    /// \brief Drop the queued write of a key.
+    ///
+    /// A write that is already being written can't be recalled, but it is no
+    /// longer returned by find().
+    ///
+    /// \param key The key to drop.
+    /// \returns true if a queued write was dropped.
+    bool erase(const KeyType& key);
+
+    /// \brief Drop all queued writes.
+    ///
+    /// Writes that are already being written complete.
+    void clear();
+
+    /// \brief Block until all writes queued so far have been written.
+    void flush();
+
+    /// \returns the number of keys waiting to be written.
+    std::size_t size() const;
+
+    enum
+    {
+        /// \brief The default maximum number of queued keys.
+        DEFAULT_MAXIMUM_PENDING_WRITES = 1024,
+        /// \brief The default maximum number of writes in one batch.
+        DEFAULT_BATCH_SIZE = 64
+    };
+
+private:
+    void run();
+
+    WriteFunction _writeFunction;
+    std::size_t _maximumPendingWrites = DEFAULT_MAXIMUM_PENDING_WRITES;
+    std::size_t _batchSize = DEFAULT_BATCH_SIZE;
+
+    /// \brief The queued writes, oldest first.
+    std::list<Write> _pending;
+
+    /// \brief The queued writes indexed by key.
+    std::map<KeyType, typename std::list<Write>::iterator> _index;
+
+    /// \brief The values of the batch currently being written, for find().
+    std::map<KeyType, std::shared_ptr<ValueType>> _writing;
+
+    /// \brief True while a batch is being written.
+    bool _isWriting = false;
+
+    bool _isRunning = true;
+    mutable std::mutex _mutex;
+    std::condition_variable _pendingCondition;
+    std::condition_variable _writtenCondition;
+    std::thread _thread;
+
+};
+
+
+template<typename KeyType, typename ValueType>
+WriteBehindQueue<KeyType, ValueType>::WriteBehindQueue(WriteFunction writeFunction,
+                                                       std::size_t maximumPendingWrites,
+                                                       std::size_t batchSize):
+    _writeFunction(writeFunction),
+    _maximumPendingWrites(std::max(maximumPendingWrites, std::size_t(1))),
+    _batchSize(std::max(batchSize, std::size_t(1))),
+    _thread(&WriteBehindQueue::run, this)
+{
+}
+
+
+template<typename KeyType, typename ValueType>
+WriteBehindQueue<KeyType, ValueType>::~WriteBehindQueue()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _isRunning = false;
+    }
+
+    _pendingCondition.notify_all();
+    _thread.join();
+}
+
+
+template<typename KeyType, typename ValueType>
+void WriteBehindQueue<KeyType, ValueType>::write(const KeyType& key,
+                                                 std::shared_ptr<ValueType> value)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            iter->second->second = value;
+            return;
+        }
+
+        _writtenCondition.wait(lock, [&]() {
+            return _pending.size() < _maximumPendingWrites;
+        });
+
+        // The key may have been queued by another writer while waiting.
+        iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            iter->second->second = value;
+            return;
+        }
+
+        _pending.push_back(std::make_pair(key, value));
+        _index[key] = std::prev(_pending.end());
+    }
+
+    _pendingCondition.notify_one();
+}
+
+
+template<typename KeyType, typename ValueType>
+std::shared_ptr<ValueType> WriteBehindQueue<KeyType, ValueType>::find(const KeyType& key) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _index.find(key);
+
+    if (iter != _index.end())
+    {
+        return iter->second->second;
+    }
+
+    auto writingIter = _writing.find(key);
+
+    if (writingIter != _writing.end())
+    {
+        return writingIter->second;
+    }
+
+    return nullptr;
+}
+
+
+template<typename KeyType, typename ValueType>
+bool WriteBehindQueue<KeyType, ValueType>::erase(const KeyType& key)
+{
+    bool isErased = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _writing.erase(key);
+
+        auto iter = _index.find(key);
+
+        if (iter != _index.end())
+        {
+            _pending.erase(iter->second);
+            _index.erase(iter);
+            isErased = true;
+        }
+    }
+
+    if (isErased)
+    {
+        // Writers may be waiting for room.
+        _writtenCondition.notify_all();
+    }
+
+    return isErased;
+}
+
+
+template<typename KeyType, typename ValueType>
+void WriteBehindQueue<KeyType, ValueType>::clear()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _pending.clear();
+        _index.clear();
+        _writing.clear();
+    }
+
+    _writtenCondition.notify_all();
+}
+
+
+template<typename KeyType, typename ValueType>
+void WriteBehindQueue<KeyType, ValueType>::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _writtenCondition.wait(lock, [&]() {
+        return _pending.empty() && !_isWriting;
+    });
+}
+
+
+template<typename KeyType, typename ValueType>
+std::size_t WriteBehindQueue<KeyType, ValueType>::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _pending.size();
+}
+
+
+template<typename KeyType, typename ValueType>
+void WriteBehindQueue<KeyType, ValueType>::run()
+{
+    std::vector<Write> batch;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        _pendingCondition.wait(lock, [&]() {
+            return !_pending.empty() || !_isRunning;
+        });
+
+        // Pending writes are always drained before stopping.
+        if (_pending.empty())
+        {
+            return;
+        }
+
+        batch.clear();
+        _isWriting = true;
+
+        while (!_pending.empty() && batch.size() < _batchSize)
+        {
+            auto& write = _pending.front();
+            _writing[write.first] = write.second;
+            _index.erase(write.first);
+            batch.push_back(write);
+            _pending.pop_front();
+        }
+
+        lock.unlock();
+
+        try
+        {
+            _writeFunction(batch);
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("WriteBehindQueue::run") << "Unable to write batch: " << exc.what();
+        }
+
+        lock.lock();
+        _writing.clear();
+        _isWriting = false;
+        _writtenCondition.notify_all();
+    }
+}
+
+
+} } // namespace ofx::Cache
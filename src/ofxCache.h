@@ -10,6 +10,13 @@
 
 #include "ofx/Cache/LRUMemoryCache.h"
 #include "ofx/Cache/ResourceLoader.h"
+#include "ofx/Cache/PipelinedResourceCache.h"
+#include "ofx/Cache/AdapterCache.h"
+#include "ofx/Cache/Cascade.h"
+#include "ofx/Cache/TraceRecorder.h"
+#include "ofx/Cache/TraceSimulator.h"
+#include "ofx/Cache/MemoryGovernor.h"
+#include "ofx/Cache/ContentAddressedCache.h"
 
 
 namespace ofxCache = ofx::Cache;
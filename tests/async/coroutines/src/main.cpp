@@ -0,0 +1,331 @@
+#include "ofxCache.h"
+#include "ofxUnitTests.h"
+
+
+#if !OFX_CACHE_HAS_COROUTINES
+#error "Coroutines require C++20, see config.make."
+#endif
+
+
+// An async cache whose requests stay pending until the test finishes them.
+class ManualCache: public ofxCache::BaseAsyncCache<std::string, std::string>
+{
+public:
+    /// Complete a pending request with a value derived from its key.
+    void finish(const std::string& key)
+    {
+        auto value = std::make_shared<std::string>(key + "!");
+        _pending.erase(key);
+        add(key, value);
+        completeRequest(key, value, ofxCache::CacheStatus::CACHE_MISS);
+    }
+
+    /// Fail a pending request.
+    void fail(const std::string& key)
+    {
+        _pending.erase(key);
+        failRequest(key, "Unable to load " + key + ".");
+    }
+
+    std::size_t pendingCount() const
+    {
+        return _pending.size();
+    }
+
+    std::size_t requestCount() const
+    {
+        return _requestCount;
+    }
+
+protected:
+    bool doHas(const std::string& key) const override
+    {
+        return _values.find(key) != _values.end();
+    }
+
+    std::shared_ptr<std::string> doGet(const std::string& key) override
+    {
+        auto iter = _values.find(key);
+        return iter != _values.end() ? iter->second : nullptr;
+    }
+
+    void doAdd(const std::string& key, std::shared_ptr<std::string> entry) override
+    {
+        _values[key] = entry;
+    }
+
+    void doRemove(const std::string& key) override
+    {
+        _values.erase(key);
+    }
+
+    std::size_t doSize() override
+    {
+        return _values.size();
+    }
+
+    void doClear() override
+    {
+        _values.clear();
+    }
+
+    bool doRequest(const std::string& key, ofxCache::RequestPriority, bool) override
+    {
+        ++_requestCount;
+        _pending.insert(key);
+        return true;
+    }
+
+    void doCancelRequest(const std::string& key) override
+    {
+        if (_pending.erase(key) > 0)
+        {
+            cancelledRequest(key);
+        }
+    }
+
+    void doCancelQueuedRequest(const std::string& key) override
+    {
+        doCancelRequest(key);
+    }
+
+    float doRequestProgress(const std::string&) const override
+    {
+        return 0;
+    }
+
+    ofxCache::RequestState doRequestState(const std::string& key) const override
+    {
+        return _pending.find(key) != _pending.end() ? ofxCache::RequestState::RUNNING
+                                                    : ofxCache::RequestState::UNKNOWN;
+    }
+
+private:
+    std::map<std::string, std::shared_ptr<std::string>> _values;
+    std::set<std::string> _pending;
+    std::size_t _requestCount = 0;
+
+};
+
+
+// The observable progress of a test coroutine.
+struct Progress
+{
+    bool isStarted = false;
+    bool isFinished = false;
+    bool isFailed = false;
+    std::string error;
+    std::vector<std::shared_ptr<std::string>> values;
+};
+
+
+ofxCache::AsyncTask awaitOne(ManualCache& cache,
+                             std::string key,
+                             Progress& progress,
+                             ofxCache::Executor executor = nullptr)
+{
+    progress.isStarted = true;
+
+    try
+    {
+        progress.values.push_back(co_await cache.asyncGet(key, ofxCache::RequestPriority::NORMAL, executor));
+    }
+    catch (const Poco::IOException& exc)
+    {
+        progress.isFailed = true;
+        progress.error = exc.message();
+    }
+
+    progress.isFinished = true;
+}
+
+
+ofxCache::AsyncTask awaitAll(ManualCache& cache,
+                             std::vector<std::string> keys,
+                             Progress& progress)
+{
+    progress.isStarted = true;
+    progress.values = co_await cache.asyncGetAll(keys);
+    progress.isFinished = true;
+}
+
+
+class ofApp: public ofxUnitTestsApp
+{
+    void run()
+    {
+        testAwait();
+        testAwaitCached();
+        testAwaitFailed();
+        testAwaitCancelled();
+        testAwaitExecutor();
+        testAwaitAll();
+    }
+
+    void testAwait()
+    {
+        std::string testName = "testAwait";
+
+        ManualCache cache;
+        Progress progress;
+        awaitOne(cache, "a", progress);
+
+        // The coroutine is suspended until the request completes.
+        ofxTest(progress.isStarted, testName);
+        ofxTest(!progress.isFinished, testName);
+        ofxTestEq(cache.pendingCount(), 1, testName);
+
+        cache.finish("a");
+
+        ofxTest(progress.isFinished, testName);
+        ofxTest(!progress.isFailed, testName);
+        ofxTestEq(progress.values.size(), 1, testName);
+        ofxTest(progress.values[0] != nullptr && *progress.values[0] == "a!", testName);
+    }
+
+    void testAwaitCached()
+    {
+        std::string testName = "testAwaitCached";
+
+        ManualCache cache;
+        cache.add("a", std::make_shared<std::string>("cached"));
+
+        // Cached values resume the coroutine without a request.
+        Progress progress;
+        awaitOne(cache, "a", progress);
+
+        ofxTest(progress.isFinished, testName);
+        ofxTestEq(cache.requestCount(), 0, testName);
+        ofxTest(progress.values[0] != nullptr && *progress.values[0] == "cached", testName);
+    }
+
+    void testAwaitFailed()
+    {
+        std::string testName = "testAwaitFailed";
+
+        ManualCache cache;
+        Progress progress;
+        awaitOne(cache, "a", progress);
+        cache.fail("a");
+
+        ofxTest(progress.isFinished, testName);
+        ofxTest(progress.isFailed, testName);
+        ofxTestEq(progress.error, "Unable to load a.", testName);
+    }
+
+    void testAwaitCancelled()
+    {
+        std::string testName = "testAwaitCancelled";
+
+        ManualCache cache;
+        Progress first;
+        Progress second;
+
+        // Both coroutines wait for the same request.
+        awaitOne(cache, "a", first);
+        awaitOne(cache, "a", second);
+        ofxTestEq(cache.requestCount(), 1, testName);
+
+        cache.cancelRequest("a");
+
+        ofxTest(first.isFinished && first.isFailed, testName);
+        ofxTest(second.isFinished && second.isFailed, testName);
+        ofxTestEq(first.error, "Request cancelled.", testName);
+        ofxTestEq(cache.pendingCount(), 0, testName);
+        ofxTest(!cache.isRequestPending("a"), testName);
+    }
+
+    void testAwaitExecutor()
+    {
+        std::string testName = "testAwaitExecutor";
+
+        ManualCache cache;
+        std::vector<std::function<void()>> work;
+        ofxCache::Executor executor = [&](std::function<void()> item)
+        {
+            work.push_back(std::move(item));
+        };
+
+        // Completion posts the resumption instead of resuming inline.
+        Progress progress;
+        awaitOne(cache, "a", progress, executor);
+        cache.finish("a");
+
+        ofxTest(!progress.isFinished, testName);
+        ofxTestEq(work.size(), 1, testName);
+
+        work[0]();
+        ofxTest(progress.isFinished, testName);
+        ofxTest(progress.values[0] != nullptr && *progress.values[0] == "a!", testName);
+
+        // So does a value that is already cached.
+        work.clear();
+        Progress cached;
+        awaitOne(cache, "a", cached, executor);
+
+        ofxTest(!cached.isFinished, testName);
+        ofxTestEq(work.size(), 1, testName);
+
+        work[0]();
+        ofxTest(cached.isFinished, testName);
+
+        // The main thread executor resumes during update.
+        Progress main;
+        awaitOne(cache, "b", main, ofxCache::MainThreadExecutor::instance().executor());
+        cache.finish("b");
+
+        ofxTest(!main.isFinished, testName);
+        ofxCache::MainThreadExecutor::instance().update();
+        ofxTest(main.isFinished, testName);
+    }
+
+    void testAwaitAll()
+    {
+        std::string testName = "testAwaitAll";
+
+        ManualCache cache;
+        cache.add("b", std::make_shared<std::string>("cached"));
+
+        Progress progress;
+        awaitAll(cache, { "a", "b", "c", "d" }, progress);
+
+        // Every request is issued at once, cached keys need none.
+        ofxTestEq(cache.requestCount(), 3, testName);
+        ofxTest(!progress.isFinished, testName);
+
+        // The coroutine resumes once, after the last request.
+        cache.finish("c");
+        cache.cancelRequest("d");
+        ofxTest(!progress.isFinished, testName);
+
+        cache.finish("a");
+        ofxTest(progress.isFinished, testName);
+
+        // Values keep the order of the keys, failed requests are nullptr.
+        ofxTestEq(progress.values.size(), 4, testName);
+        ofxTest(progress.values[0] != nullptr && *progress.values[0] == "a!", testName);
+        ofxTest(progress.values[1] != nullptr && *progress.values[1] == "cached", testName);
+        ofxTest(progress.values[2] != nullptr && *progress.values[2] == "c!", testName);
+        ofxTest(progress.values[3] == nullptr, testName);
+
+        // An empty batch doesn't suspend.
+        Progress empty;
+        awaitAll(cache, { }, empty);
+        ofxTest(empty.isFinished && empty.values.empty(), testName);
+    }
+
+};
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+	ofInit();
+	auto window = std::make_shared<ofAppNoWindow>();
+	auto app = std::make_shared<ofApp>();
+	ofRunApp(window, app);
+	return ofRunMainLoop();
+}
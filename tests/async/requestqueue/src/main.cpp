@@ -0,0 +1,479 @@
+#include "ofxCache.h"
+#include "ofxUnitTests.h"
+
+
+// A request task counting the tasks that may still call the cache.
+class CountedRequestTask: public ofxCache::CacheRequestTask<std::string, std::string>
+{
+public:
+    CountedRequestTask(const std::string& key,
+                       ofxCache::BaseResourceCacheLoader<std::string, std::string>& loader,
+                       std::atomic<int>& count):
+        ofxCache::CacheRequestTask<std::string, std::string>(key, loader),
+        _count(count)
+    {
+        ++_count;
+    }
+
+    ~CountedRequestTask()
+    {
+        finish();
+    }
+
+    void runTask() override
+    {
+        try
+        {
+            ofxCache::CacheRequestTask<std::string, std::string>::runTask();
+        }
+        catch (...)
+        {
+            finish();
+            throw;
+        }
+
+        finish();
+    }
+
+private:
+    void finish()
+    {
+        if (!_isFinished.exchange(true))
+        {
+            --_count;
+        }
+    }
+
+    std::atomic<int>& _count;
+    std::atomic<bool> _isFinished { false };
+
+};
+
+
+// A resource cache whose loads wait until the gate is opened, so started
+// requests stay in flight while the test fills the request queue.
+class GatedCache: public ofxCache::BaseResourceCache<std::string, std::string>
+{
+public:
+    GatedCache(ofx::TaskQueue& taskQueue):
+        ofxCache::BaseResourceCache<std::string, std::string>(std::make_unique<ofxCache::LRUMemoryCache<std::string, std::string>>(),
+                                                              taskQueue),
+        _gate(_opener.get_future().share())
+    {
+    }
+
+    ~GatedCache()
+    {
+        // Started tasks use the cache.
+        open();
+
+        while (_tasks > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    std::shared_ptr<std::string> load(ofxCache::CacheRequestTask<std::string, std::string>& request) override
+    {
+        _gate.wait();
+        return std::make_shared<std::string>(request.key());
+    }
+
+    std::string toTaskId(const std::string& key) const override
+    {
+        return "GatedCache:" + key;
+    }
+
+    /// Let the loads finish.
+    void open()
+    {
+        std::call_once(_isOpen, [this]() { _opener.set_value(); });
+    }
+
+    /// \returns the keys handed to the task queue, in start order.
+    std::vector<std::string> startedKeys()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _startedKeys;
+    }
+
+protected:
+    Poco::Task* createTask(const std::string& key) override
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _startedKeys.push_back(key);
+        }
+
+        return new CountedRequestTask(key, *this, _tasks);
+    }
+
+private:
+    std::promise<void> _opener;
+    std::shared_future<void> _gate;
+    std::once_flag _isOpen;
+    std::atomic<int> _tasks { 0 };
+    std::mutex _mutex;
+    std::vector<std::string> _startedKeys;
+
+};
+
+
+// A task that runs until its gate opens.
+class GatedTask: public Poco::Task
+{
+public:
+    GatedTask(const std::string& name, std::shared_future<void> gate):
+        Poco::Task(name),
+        _gate(gate)
+    {
+    }
+
+    void runTask() override
+    {
+        _gate.wait();
+    }
+
+private:
+    std::shared_future<void> _gate;
+
+};
+
+
+class ofApp: public ofxUnitTestsApp
+{
+    typedef GatedCache::RequestFuture RequestFuture;
+
+    void run()
+    {
+        testReject();
+        testDropOldest();
+        testDropLowestPriority();
+        testStartFailure();
+        testDropOldestPriority();
+        testPrefetchRejected();
+        testPrefetchPromotion();
+        testSequentialReadAhead();
+    }
+
+    /// \returns true if the request failed with the given error.
+    static bool isFailed(RequestFuture& future, const std::string& error)
+    {
+        if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return false;
+        }
+
+        try
+        {
+            future.get();
+            return false;
+        }
+        catch (const Poco::IOException& exc)
+        {
+            return exc.message() == error;
+        }
+    }
+
+    /// \returns true if the request neither finished nor failed.
+    static bool isWaiting(RequestFuture& future)
+    {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::timeout;
+    }
+
+    void testReject()
+    {
+        std::string testName = "testReject";
+
+        ofx::TaskQueue queue(1);
+        GatedCache cache(queue);
+        cache.setMaximumInFlightRequests(1);
+        cache.setMaximumQueuedRequests(2);
+        cache.setOverflowPolicy(ofxCache::OverflowPolicy::REJECT);
+
+        auto a = cache.request("a");
+        auto b = cache.request("b");
+        auto c = cache.request("c");
+        ofxTestEq(cache.inFlightRequests(), 1, testName);
+        ofxTestEq(cache.queuedRequests(), 2, testName);
+
+        // The full queue rejects the new request and keeps the others.
+        auto d = cache.request("d", ofxCache::RequestPriority::HIGH);
+        ofxTest(isFailed(d, "Request rejected."), testName);
+        ofxTest(!cache.isRequestPending("d"), testName);
+        ofxTest(isWaiting(a), testName);
+        ofxTest(isWaiting(b), testName);
+        ofxTest(isWaiting(c), testName);
+        ofxTestEq(cache.queuedRequests(), 2, testName);
+
+        // Requests for queued keys join them instead of overflowing.
+        auto b2 = cache.request("b");
+        ofxTest(isWaiting(b2), testName);
+        ofxTestEq(cache.queuedRequests(), 2, testName);
+    }
+
+    void testDropOldest()
+    {
+        std::string testName = "testDropOldest";
+
+        ofx::TaskQueue queue(1);
+        GatedCache cache(queue);
+        cache.setMaximumInFlightRequests(1);
+        cache.setMaximumQueuedRequests(2);
+        cache.setOverflowPolicy(ofxCache::OverflowPolicy::DROP_OLDEST);
+
+        auto a = cache.request("a");
+        auto b = cache.request("b");
+        auto c = cache.request("c");
+
+        // The oldest queued request makes room, the running one stays.
+        auto d = cache.request("d");
+        ofxTest(isFailed(b, "Request dropped."), testName);
+        ofxTest(!cache.isRequestPending("b"), testName);
+        ofxTest(isWaiting(a), testName);
+        ofxTest(isWaiting(c), testName);
+        ofxTest(isWaiting(d), testName);
+        ofxTestEq(cache.inFlightRequests(), 1, testName);
+        ofxTestEq(cache.queuedRequests(), 2, testName);
+
+        auto e = cache.request("e");
+        ofxTest(isFailed(c, "Request dropped."), testName);
+        ofxTest(isWaiting(d), testName);
+        ofxTest(isWaiting(e), testName);
+        ofxTestEq(cache.queuedRequests(), 2, testName);
+    }
+
+    void testDropLowestPriority()
+    {
+        std::string testName = "testDropLowestPriority";
+
+        ofx::TaskQueue queue(1);
+        GatedCache cache(queue);
+        cache.setMaximumInFlightRequests(1);
+        cache.setMaximumQueuedRequests(3);
+        cache.setOverflowPolicy(ofxCache::OverflowPolicy::DROP_LOWEST_PRIORITY);
+
+        auto a = cache.request("a", ofxCache::RequestPriority::LOW);
+        auto b = cache.request("b", ofxCache::RequestPriority::HIGH);
+        auto c = cache.request("c", ofxCache::RequestPriority::LOW);
+        auto d = cache.request("d", ofxCache::RequestPriority::LOW);
+
+        // The oldest of the lowest priority requests is dropped, even though
+        // an older request has a higher priority.
+        auto e = cache.request("e", ofxCache::RequestPriority::NORMAL);
+        ofxTest(isFailed(c, "Request dropped."), testName);
+        ofxTest(isWaiting(a), testName);
+        ofxTest(isWaiting(b), testName);
+        ofxTest(isWaiting(d), testName);
+        ofxTest(isWaiting(e), testName);
+        ofxTestEq(cache.queuedRequests(), 3, testName);
+
+        // Equal priorities may be dropped.
+        auto f = cache.request("f", ofxCache::RequestPriority::LOW);
+        ofxTest(isFailed(d, "Request dropped."), testName);
+        ofxTest(isWaiting(f), testName);
+
+        // Nothing queued has a lower priority than the new request.
+        cache.request("g", ofxCache::RequestPriority::HIGH);
+        ofxTest(isFailed(f, "Request dropped."), testName);
+
+        auto h = cache.request("h", ofxCache::RequestPriority::LOW);
+        ofxTest(isFailed(h, "Request rejected."), testName);
+        ofxTestEq(cache.queuedRequests(), 3, testName);
+    }
+
+    void testStartFailure()
+    {
+        std::string testName = "testStartFailure";
+
+        ofx::TaskQueue queue(2);
+        GatedCache cache(queue);
+
+        // Another task holds the task ids of "b" and "c", so the requests
+        // can't be handed to the task queue.
+        std::promise<void> opener;
+        std::shared_future<void> gate = opener.get_future().share();
+        queue.start(cache.toTaskId("b"), new GatedTask(cache.toTaskId("b"), gate));
+        queue.start(cache.toTaskId("c"), new GatedTask(cache.toTaskId("c"), gate));
+
+        // Started right away, the request fails instead of waiting forever.
+        auto b = cache.request("b");
+        ofxTest(isFailed(b, "Request rejected."), testName);
+        ofxTest(!cache.isRequestPending("b"), testName);
+        ofxTestEq(cache.inFlightRequests(), 0, testName);
+
+        // Started from the queue, the request fails once a slot is free.
+        cache.setMaximumInFlightRequests(1);
+        auto a = cache.request("a");
+        auto c = cache.request("c");
+        ofxTestEq(cache.queuedRequests(), 1, testName);
+
+        cache.setMaximumInFlightRequests(2);
+        ofxTest(isFailed(c, "Unable to start request."), testName);
+        ofxTest(!cache.isRequestPending("c"), testName);
+        ofxTest(isWaiting(a), testName);
+        ofxTestEq(cache.inFlightRequests(), 1, testName);
+        ofxTestEq(cache.queuedRequests(), 0, testName);
+
+        opener.set_value();
+    }
+
+    void testDropOldestPriority()
+    {
+        std::string testName = "testDropOldestPriority";
+
+        ofx::TaskQueue queue(1);
+        GatedCache cache(queue);
+        cache.setMaximumInFlightRequests(1);
+        cache.setMaximumQueuedRequests(3);
+        cache.setOverflowPolicy(ofxCache::OverflowPolicy::DROP_OLDEST);
+
+        auto a = cache.request("a");
+        auto b = cache.request("b", ofxCache::RequestPriority::HIGH);
+        auto c = cache.request("c", ofxCache::RequestPriority::LOW);
+        auto d = cache.request("d", ofxCache::RequestPriority::NORMAL);
+
+        // The oldest request that doesn't outrank the new one is dropped,
+        // older requests of a higher priority are skipped.
+        auto e = cache.request("e", ofxCache::RequestPriority::NORMAL);
+        ofxTest(isFailed(c, "Request dropped."), testName);
+        ofxTest(isWaiting(b), testName);
+        ofxTest(isWaiting(d), testName);
+        ofxTest(isWaiting(e), testName);
+
+        // Every queued request outranks the new one.
+        auto f = cache.request("f", ofxCache::RequestPriority::LOW);
+        ofxTest(isFailed(f, "Request rejected."), testName);
+        ofxTest(isWaiting(b), testName);
+        ofxTest(isWaiting(d), testName);
+        ofxTest(isWaiting(e), testName);
+        ofxTestEq(cache.queuedRequests(), 3, testName);
+    }
+
+    void testPrefetchRejected()
+    {
+        std::string testName = "testPrefetchRejected";
+
+        for (auto policy: { ofxCache::OverflowPolicy::DROP_OLDEST,
+                            ofxCache::OverflowPolicy::DROP_LOWEST_PRIORITY,
+                            ofxCache::OverflowPolicy::BLOCK })
+        {
+            ofx::TaskQueue queue(1);
+            GatedCache cache(queue);
+            cache.setMaximumInFlightRequests(1);
+            cache.setMaximumQueuedRequests(2);
+            cache.setOverflowPolicy(policy);
+
+            auto a = cache.request("a", ofxCache::RequestPriority::LOW);
+            auto b = cache.request("b", ofxCache::RequestPriority::LOW);
+            auto c = cache.request("c", ofxCache::RequestPriority::LOW);
+
+            // An idle prefetch never displaces a queued request, nor blocks.
+            cache.prefetch("p");
+            ofxTest(!cache.isRequestPending("p"), testName);
+            ofxTest(isWaiting(b), testName);
+            ofxTest(isWaiting(c), testName);
+            ofxTestEq(cache.queuedRequests(), 2, testName);
+        }
+    }
+
+    void testPrefetchPromotion()
+    {
+        std::string testName = "testPrefetchPromotion";
+
+        ofx::TaskQueue queue(4);
+        GatedCache cache(queue);
+        cache.setMaximumInFlightRequests(1);
+
+        auto a = cache.request("a");
+        cache.prefetch("p");
+        cache.prefetch("q");
+        auto r = cache.request("r");
+
+        ofxTest(cache.isRequestPending("p"), testName);
+        ofxTestEq(cache.queuedRequests(), 3, testName);
+
+        // Requesting a prefetched key shares the prefetch and raises its
+        // priority, so it starts before the regular request queued earlier.
+        auto p = cache.request("p", ofxCache::RequestPriority::HIGH);
+        ofxTest(isWaiting(p), testName);
+        ofxTestEq(cache.queuedRequests(), 3, testName);
+
+        cache.setMaximumInFlightRequests(4);
+
+        std::vector<std::string> expected = { "a", "p", "r", "q" };
+        ofxTest(cache.startedKeys() == expected, testName);
+        ofxTestEq(cache.queuedRequests(), 0, testName);
+        ofxTest(isWaiting(p), testName);
+    }
+
+    void testSequentialReadAhead()
+    {
+        std::string testName = "testSequentialReadAhead";
+
+        typedef std::vector<int> Keys;
+
+        ofxCache::SequentialReadAheadPolicy<int> policy(3, 2);
+
+        // Two steps of the same stride start reading ahead.
+        ofxTest(policy.predict(10).empty(), testName);
+        ofxTest(policy.predict(11).empty(), testName);
+        ofxTest((policy.predict(12) == Keys { 13, 14, 15 }), testName);
+
+        // Keys already predicted during the run are skipped.
+        ofxTest((policy.predict(13) == Keys { 16 }), testName);
+
+        // A new stride starts a new run.
+        ofxTest(policy.predict(20).empty(), testName);
+        ofxTest(policy.predict(22).empty(), testName);
+        ofxTest((policy.predict(24) == Keys { 26, 28, 30 }), testName);
+
+        // Negative strides read backwards.
+        ofxTest(policy.predict(50).empty(), testName);
+        ofxTest(policy.predict(47).empty(), testName);
+        ofxTest((policy.predict(44) == Keys { 41, 38, 35 }), testName);
+        ofxTest((policy.predict(41) == Keys { 32 }), testName);
+
+        // Repeated keys have no stride.
+        ofxTest(policy.predict(41).empty(), testName);
+        ofxTest(policy.predict(41).empty(), testName);
+
+        // Keys without an index are ignored.
+        ofxCache::SequentialReadAheadPolicy<std::string> framePolicy([](const std::string& key, int64_t& index)
+                                                                      {
+                                                                          if (key.compare(0, 6, "frame_") != 0)
+                                                                          {
+                                                                              return false;
+                                                                          }
+
+                                                                          index = std::stoll(key.substr(6));
+                                                                          return true;
+                                                                      },
+                                                                      [](const std::string&, int64_t index)
+                                                                      {
+                                                                          return "frame_" + ofToString(index);
+                                                                      },
+                                                                      2,
+                                                                      2);
+
+        ofxTest(framePolicy.predict("frame_9").empty(), testName);
+        ofxTest(framePolicy.predict("other").empty(), testName);
+        ofxTest(framePolicy.predict("frame_6").empty(), testName);
+        ofxTest((framePolicy.predict("frame_3") == std::vector<std::string> { "frame_0", "frame_-3" }), testName);
+    }
+
+};
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+	ofInit();
+	auto window = std::make_shared<ofAppNoWindow>();
+	auto app = std::make_shared<ofApp>();
+	ofRunApp(window, app);
+	return ofRunMainLoop();
+}
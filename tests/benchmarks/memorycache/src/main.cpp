@@ -0,0 +1,307 @@
+#include "ofMain.h"
+#include "ofxCache.h"
+
+
+// Benchmarks the memory cache tiers with synthetic workloads.
+//
+// Each workload is run with 1, 2, 4 ... N threads against each cache
+// configuration, see caches(). Results (ops/sec, p50/p99/p999 latency in
+// nanoseconds and hit ratio) are printed as JSON and saved to
+// bin/data/benchmarks.json so they can be compared between runs.
+class ofApp: public ofBaseApp
+{
+public:
+    enum class Workload
+    {
+        UNIFORM,
+        ZIPFIAN,
+        SCAN,
+        MIXED
+    };
+
+    struct Result
+    {
+        uint64_t operations = 0;
+        uint64_t hits = 0;
+        double seconds = 0;
+        std::vector<uint32_t> latencies;
+    };
+
+    void setup() override
+    {
+        buildZipfianDistribution();
+
+        ofJson results = ofJson::array();
+
+        for (auto workload: { Workload::UNIFORM, Workload::ZIPFIAN, Workload::SCAN, Workload::MIXED })
+        {
+            for (auto numThreads: threadCounts())
+            {
+                for (const auto& cache: caches())
+                {
+                    results.push_back(run(cache.first, cache.second, workload, numThreads));
+                }
+            }
+        }
+
+        ofJson json;
+        json["capacity"] = CACHE_SIZE;
+        json["keySpace"] = KEY_SPACE;
+        json["operationsPerThread"] = OPERATIONS_PER_THREAD;
+        json["results"] = results;
+
+        std::cout << json.dump(4) << std::endl;
+        ofSavePrettyJson("benchmarks.json", json);
+        ofExit();
+    }
+
+    typedef ofxCache::BaseCache<uint64_t, uint64_t> Cache;
+    typedef ofxCache::LRUMemoryCache<uint64_t, uint64_t> DefaultCache;
+    typedef ofxCache::LRUMemoryCache<uint64_t, uint64_t, ofxCache::PoolAllocator<uint64_t>> PooledCache;
+    typedef ofxCache::Cascade<DefaultCache, DefaultCache> CascadeCache;
+    typedef std::function<std::unique_ptr<Cache>()> CacheFactory;
+
+    /// \returns 1, 2, 4 ... threads, ending with the number of cores.
+    static std::vector<std::size_t> threadCounts()
+    {
+        std::size_t maximumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::size_t> counts;
+
+        for (std::size_t numThreads = 1; numThreads < maximumThreads; numThreads *= 2)
+        {
+            counts.push_back(numThreads);
+        }
+
+        counts.push_back(maximumThreads);
+        return counts;
+    }
+
+    /// \returns the named cache configurations to benchmark.
+    static std::vector<std::pair<std::string, CacheFactory>> caches()
+    {
+        return {
+            { "lru", []() {
+                return std::make_unique<DefaultCache>(CACHE_SIZE);
+            } },
+            { "lru-pool", []() {
+                return std::make_unique<PooledCache>(CACHE_SIZE);
+            } },
+            { "lru-bytes", []() {
+                // Limited by bytes instead of count, with the same capacity.
+                auto cache = std::make_unique<DefaultCache>(KEY_SPACE);
+                cache->setMaximumBytes(CACHE_SIZE * ofxCache::ValueSize<uint64_t>::size(0));
+                return cache;
+            } },
+            { "lru-tiered", []() {
+                // A small parent promoting hits from a larger child.
+                auto cache = std::make_unique<DefaultCache>(CACHE_SIZE / 10);
+                cache->setChild<DefaultCache>(CACHE_SIZE);
+                return cache;
+            } },
+            { "cascade", []() {
+                return std::make_unique<CascadeCache>(CACHE_SIZE / 10, CACHE_SIZE);
+            } }
+        };
+    }
+
+    ofJson run(const std::string& name,
+               const CacheFactory& factory,
+               Workload workload,
+               std::size_t numThreads)
+    {
+        auto cache = factory();
+
+        // Start warm so that the first thread does not measure cold misses.
+        for (uint64_t key = 0; key < CACHE_SIZE; ++key)
+        {
+            cache->add(key, key);
+        }
+
+        std::vector<Result> results(numThreads);
+        std::vector<std::thread> threads;
+
+        for (std::size_t i = 0; i < numThreads; ++i)
+        {
+            threads.push_back(std::thread([&, i]() {
+                runThread(*cache, workload, i, results[i]);
+            }));
+        }
+
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+
+        Result total;
+
+        for (auto& result: results)
+        {
+            total.operations += result.operations;
+            total.hits += result.hits;
+            total.seconds = std::max(total.seconds, result.seconds);
+            total.latencies.insert(total.latencies.end(),
+                                   result.latencies.begin(),
+                                   result.latencies.end());
+        }
+
+        std::sort(total.latencies.begin(), total.latencies.end());
+
+        ofJson json;
+        json["cache"] = name;
+        json["workload"] = toString(workload);
+        json["threads"] = numThreads;
+        json["operations"] = total.operations;
+        json["opsPerSecond"] = total.seconds > 0 ? total.operations / total.seconds : 0;
+        json["p50"] = percentile(total.latencies, 0.5);
+        json["p99"] = percentile(total.latencies, 0.99);
+        json["p999"] = percentile(total.latencies, 0.999);
+        json["hitRatio"] = double(total.hits) / double(std::max(total.operations, uint64_t(1)));
+        return json;
+    }
+
+    void runThread(Cache& cache,
+                   Workload workload,
+                   std::size_t threadIndex,
+                   Result& result)
+    {
+        std::mt19937_64 random(threadIndex + 1);
+        std::uniform_real_distribution<double> unit(0, 1);
+        std::uniform_int_distribution<uint64_t> uniform(0, KEY_SPACE - 1);
+
+        // Generate keys up front so key generation is not measured.
+        std::vector<uint64_t> keys(OPERATIONS_PER_THREAD);
+        std::vector<bool> writes(OPERATIONS_PER_THREAD, false);
+
+        for (std::size_t i = 0; i < OPERATIONS_PER_THREAD; ++i)
+        {
+            switch (workload)
+            {
+                case Workload::UNIFORM:
+                    keys[i] = uniform(random);
+                    break;
+                case Workload::ZIPFIAN:
+                    keys[i] = zipfian(unit(random));
+                    break;
+                case Workload::SCAN:
+                    keys[i] = (threadIndex * OPERATIONS_PER_THREAD + i) % KEY_SPACE;
+                    break;
+                case Workload::MIXED:
+                    keys[i] = zipfian(unit(random));
+                    writes[i] = unit(random) < MIXED_WRITE_RATIO;
+                    break;
+            }
+        }
+
+        result.latencies.reserve(OPERATIONS_PER_THREAD);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < OPERATIONS_PER_THREAD; ++i)
+        {
+            auto operationStart = std::chrono::steady_clock::now();
+
+            if (writes[i])
+            {
+                cache.add(keys[i], keys[i]);
+            }
+            else if (cache.get(keys[i]) != nullptr)
+            {
+                ++result.hits;
+            }
+            else
+            {
+                // Read through on a miss.
+                cache.add(keys[i], keys[i]);
+            }
+
+            auto operationEnd = std::chrono::steady_clock::now();
+            auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(operationEnd - operationStart).count();
+            result.latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(nanoseconds, std::numeric_limits<uint32_t>::max())));
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.operations = OPERATIONS_PER_THREAD;
+    }
+
+    void buildZipfianDistribution()
+    {
+        _zipfianCDF.resize(KEY_SPACE);
+
+        double sum = 0;
+
+        for (std::size_t i = 0; i < KEY_SPACE; ++i)
+        {
+            sum += 1.0 / std::pow(double(i + 1), ZIPFIAN_THETA);
+            _zipfianCDF[i] = sum;
+        }
+
+        for (auto& value: _zipfianCDF)
+        {
+            value /= sum;
+        }
+    }
+
+    uint64_t zipfian(double u) const
+    {
+        auto iter = std::lower_bound(_zipfianCDF.begin(), _zipfianCDF.end(), u);
+        return std::min<uint64_t>(std::distance(_zipfianCDF.begin(), iter), KEY_SPACE - 1);
+    }
+
+    static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+
+        return sorted[std::min(sorted.size() - 1, std::size_t(p * sorted.size()))];
+    }
+
+    static std::string toString(Workload workload)
+    {
+        switch (workload)
+        {
+            case Workload::UNIFORM:
+                return "uniform";
+            case Workload::ZIPFIAN:
+                return "zipfian";
+            case Workload::SCAN:
+                return "scan";
+            case Workload::MIXED:
+                return "mixed";
+        }
+
+        return "unknown";
+    }
+
+    enum
+    {
+        CACHE_SIZE = 10000,
+        KEY_SPACE = 100000,
+        OPERATIONS_PER_THREAD = 500000
+    };
+
+    static constexpr double ZIPFIAN_THETA = 0.99;
+    static constexpr double MIXED_WRITE_RATIO = 0.1;
+
+    std::vector<double> _zipfianCDF;
+
+};
+
+
+constexpr double ofApp::ZIPFIAN_THETA;
+constexpr double ofApp::MIXED_WRITE_RATIO;
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+    ofInit();
+    auto window = std::make_shared<ofAppNoWindow>();
+    auto app = std::make_shared<ofApp>();
+    ofRunApp(window, app);
+    return ofRunMainLoop();
+}
@@ -0,0 +1,449 @@
+#include "ofxCache.h"
+#include "ofx/Cache/BaseFileStore.h"
+#include "ofx/Cache/FileIOService.h"
+#include "ofx/Cache/MembershipFilter.h"
+#include "ofxUnitTests.h"
+
+
+#if defined(__linux__) && !OFX_CACHE_HAS_IO_URING
+#error "The io_uring path requires OFX_CACHE_USE_IO_URING, see config.make."
+#endif
+
+
+class FileStore: public ofxCache::BaseReadableFileStore<std::string, ofBuffer>
+{
+public:
+    FileStore(const std::string& path): _path(path)
+    {
+    }
+
+    std::string keyToURI(const std::string& key) const override
+    {
+        return _path + "/" + key;
+    }
+
+protected:
+    std::shared_ptr<ofBuffer> rawToValue(ofBuffer& buffer) override
+    {
+        return std::make_shared<ofBuffer>(buffer);
+    }
+
+private:
+    std::string _path;
+
+};
+
+
+// A pipelined cache fetching with FileStore::readAsync(). Completed reads can
+// be held back, so a test can cancel a request while its read is pending.
+class FileCache: public ofxCache::BasePipelinedResourceCache<std::string, ofBuffer, ofBuffer>
+{
+public:
+    FileCache(FileStore& store, ofx::TaskQueue& ioQueue, ofx::TaskQueue& decodeQueue):
+        ofxCache::BasePipelinedResourceCache<std::string, ofBuffer, ofBuffer>(std::make_unique<ofxCache::LRUMemoryCache<std::string, ofBuffer>>(),
+                                                                             ioQueue,
+                                                                             decodeQueue),
+        _store(store)
+    {
+    }
+
+    std::shared_ptr<ofBuffer> fetch(ofxCache::CacheRequestTask<std::string, ofBuffer>& task) override
+    {
+        ++_fetchCount;
+        return _store.get(task.key());
+    }
+
+    bool fetchAsync(ofxCache::CacheRequestTask<std::string, ofBuffer>& task, FetchCallback callback) override
+    {
+        _store.readAsync(task.key(), [this, callback](std::shared_ptr<ofBuffer> buffer, const std::string& error)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            if (_isHolding)
+            {
+                _held.push_back([=]() { callback(buffer, error); });
+                return;
+            }
+
+            lock.unlock();
+            callback(buffer, error);
+        });
+
+        return true;
+    }
+
+    std::shared_ptr<ofBuffer> decode(const std::string& key, ofBuffer& raw) override
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _decoded[key] = raw.getText();
+        return std::make_shared<ofBuffer>(raw);
+    }
+
+    std::string toTaskId(const std::string& key) const override
+    {
+        return "FileCache:" + key;
+    }
+
+    /// Hold back the completed reads until release().
+    void hold()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _isHolding = true;
+    }
+
+    /// Hand the held reads to the cache.
+    void release()
+    {
+        std::vector<std::function<void()>> held;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _isHolding = false;
+            std::swap(held, _held);
+        }
+
+        for (auto& callback: held)
+        {
+            callback();
+        }
+    }
+
+    /// \returns true once the given number of reads is held back.
+    bool waitForHeld(std::size_t count, int milliseconds)
+    {
+        return waitFor([&]() { return _held.size() >= count; }, milliseconds);
+    }
+
+    /// \returns true once the key was decoded.
+    bool waitForDecoded(const std::string& key, int milliseconds)
+    {
+        return waitFor([&]() { return _decoded.find(key) != _decoded.end(); }, milliseconds);
+    }
+
+    std::string decoded(const std::string& key)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto iter = _decoded.find(key);
+        return iter != _decoded.end() ? iter->second : "";
+    }
+
+    std::size_t decodedCount()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _decoded.size();
+    }
+
+    std::size_t fetchCount() const
+    {
+        return _fetchCount;
+    }
+
+private:
+    bool waitFor(std::function<bool()> condition, int milliseconds)
+    {
+        for (int i = 0; i < milliseconds; i += 10)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+
+                if (condition())
+                {
+                    return true;
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        return false;
+    }
+
+    FileStore& _store;
+    std::mutex _mutex;
+    bool _isHolding = false;
+    std::vector<std::function<void()>> _held;
+    std::map<std::string, std::string> _decoded;
+    std::atomic<std::size_t> _fetchCount { 0 };
+
+};
+
+
+// A task that runs until its gate opens.
+class GatedTask: public Poco::Task
+{
+public:
+    GatedTask(const std::string& name, std::shared_future<void> gate):
+        Poco::Task(name),
+        _gate(gate)
+    {
+    }
+
+    void runTask() override
+    {
+        _gate.wait();
+    }
+
+private:
+    std::shared_future<void> _gate;
+
+};
+
+
+class ofApp: public ofxUnitTestsApp
+{
+    void run()
+    {
+        ofLogNotice("ofApp::run") << "Using io_uring: " << ofxCache::FileIOService::instance().isUsingIOURing();
+
+        testRoundTrip();
+        testLargeFile();
+        testMissingFile();
+        testReadAsync();
+        testPipelinedFetch();
+        testPipelinedCancel();
+        testPipelinedDecodeCollision();
+    }
+
+    void testRoundTrip()
+    {
+        std::string testName = "testRoundTrip";
+        std::string path = ofToDataPath("fileioservice", true);
+        ofDirectory::createDirectory(path);
+
+        // More requests than the queue depth keep the ring full.
+        ofxCache::FileIOService service(4);
+        std::size_t count = service.queueDepth() * 8;
+
+        std::vector<std::future<void>> writes;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto buffer = std::make_shared<ofBuffer>(std::string(i * 100 + 1, 'a' + i % 26));
+            writes.push_back(service.write(path + "/" + ofToString(i), buffer));
+        }
+
+        std::size_t written = 0;
+
+        for (auto& write: writes)
+        {
+            try
+            {
+                write.get();
+                ++written;
+            }
+            catch (const Poco::IOException&)
+            {
+            }
+        }
+
+        ofxTestEq(written, count, testName);
+
+        std::vector<std::future<std::shared_ptr<ofBuffer>>> reads;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            reads.push_back(service.read(path + "/" + ofToString(i)));
+        }
+
+        std::size_t matching = 0;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto buffer = reads[i].get();
+
+            if (buffer != nullptr && buffer->getText() == std::string(i * 100 + 1, 'a' + i % 26))
+            {
+                ++matching;
+            }
+        }
+
+        ofxTestEq(matching, count, testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+    void testLargeFile()
+    {
+        std::string testName = "testLargeFile";
+        std::string path = ofToDataPath("large.bin", true);
+
+        std::string data(8 * 1024 * 1024, 0);
+
+        for (std::size_t i = 0; i < data.size(); ++i)
+        {
+            data[i] = static_cast<char>(i * 31);
+        }
+
+        auto& service = ofxCache::FileIOService::instance();
+        service.write(path, std::make_shared<ofBuffer>(data)).get();
+
+        auto buffer = service.read(path).get();
+        ofxTest(buffer != nullptr, testName);
+        ofxTestEq(buffer->size(), data.size(), testName);
+        ofxTest(buffer->getText() == data, testName);
+
+        ofFile::removeFile(path);
+    }
+
+    void testMissingFile()
+    {
+        std::string testName = "testMissingFile";
+
+        bool isFailed = false;
+
+        try
+        {
+            ofxCache::FileIOService::instance().read(ofToDataPath("missing.bin", true)).get();
+        }
+        catch (const Poco::IOException&)
+        {
+            isFailed = true;
+        }
+
+        ofxTest(isFailed, testName);
+    }
+
+    void testReadAsync()
+    {
+        std::string testName = "testReadAsync";
+        std::string path = "readasync";
+
+        ofDirectory::createDirectory(path);
+        ofBufferToFile(path + "/a", ofBuffer(std::string("a")));
+        ofBufferToFile(path + "/b", ofBuffer(std::string("b")));
+
+        FileStore store(path);
+        store.buildMembershipFilter(std::make_shared<ofxCache::BloomFilter>(100), { "a" });
+
+        // Keys ruled out by the filter call back before returning.
+        bool isMissed = false;
+        store.readAsync("b", [&](std::shared_ptr<ofBuffer> buffer, const std::string& error)
+        {
+            isMissed = buffer == nullptr && !error.empty();
+        });
+
+        ofxTest(isMissed, testName);
+
+        std::promise<std::string> result;
+        store.readAsync("a", [&](std::shared_ptr<ofBuffer> buffer, const std::string& error)
+        {
+            result.set_value(buffer != nullptr ? buffer->getText() : error);
+        });
+
+        ofxTestEq(result.get_future().get(), "a", testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+    void testPipelinedFetch()
+    {
+        std::string testName = "testPipelinedFetch";
+        std::string path = "pipelined";
+
+        ofDirectory::createDirectory(path);
+        ofBufferToFile(path + "/a", ofBuffer(std::string("a")));
+
+        FileStore store(path);
+        ofx::TaskQueue ioQueue(1);
+        ofx::TaskQueue decodeQueue(1);
+        FileCache cache(store, ioQueue, decodeQueue);
+
+        // The fetch task only starts the read, the completion decodes.
+        cache.request("a");
+        ofxTest(cache.waitForDecoded("a", 5000), testName);
+        ofxTestEq(cache.decoded("a"), "a", testName);
+        ofxTestEq(cache.fetchCount(), 0, testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+    void testPipelinedCancel()
+    {
+        std::string testName = "testPipelinedCancel";
+        std::string path = "pipelined";
+
+        ofDirectory::createDirectory(path);
+        ofBufferToFile(path + "/a", ofBuffer(std::string("a")));
+
+        FileStore store(path);
+        ofx::TaskQueue ioQueue(1);
+        ofx::TaskQueue decodeQueue(1);
+        FileCache cache(store, ioQueue, decodeQueue);
+
+        cache.hold();
+        auto future = cache.request("a");
+        ofxTest(cache.waitForHeld(1, 5000), testName);
+
+        // The fetch task returned, the request waits for the read.
+        ofxTest(cache.requestState("a") == ofxCache::RequestState::RUNNING, testName);
+
+        // The request finishes right away, a read completing after the
+        // cancellation is never decoded.
+        cache.cancelRequest("a");
+        ofxTest(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready, testName);
+        cache.release();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ofxTestEq(cache.decodedCount(), 0, testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+    void testPipelinedDecodeCollision()
+    {
+        std::string testName = "testPipelinedDecodeCollision";
+        std::string path = "pipelined";
+
+        ofDirectory::createDirectory(path);
+        ofBufferToFile(path + "/a", ofBuffer(std::string("a")));
+
+        FileStore store(path);
+        ofx::TaskQueue ioQueue(1);
+        ofx::TaskQueue decodeQueue(1);
+        FileCache cache(store, ioQueue, decodeQueue);
+
+        // A task on the decode queue holds the task id of the request, as
+        // the decode of a cancelled request for the same key would.
+        std::promise<void> gate;
+        decodeQueue.start(cache.toTaskId("a"), new GatedTask(cache.toTaskId("a"), gate.get_future().share()));
+
+        // The decode can't be queued, so the request fails instead of
+        // waiting forever.
+        auto future = cache.request("a");
+        ofxTest(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready, testName);
+
+        bool isFailed = false;
+
+        try
+        {
+            future.get();
+        }
+        catch (const Poco::IOException&)
+        {
+            isFailed = true;
+        }
+
+        ofxTest(isFailed, testName);
+        ofxTest(!cache.isRequestPending("a"), testName);
+        ofxTestEq(cache.decodedCount(), 0, testName);
+
+        gate.set_value();
+
+        ofDirectory(path).remove(true);
+    }
+
+};
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+	ofInit();
+	auto window = std::make_shared<ofAppNoWindow>();
+	auto app = std::make_shared<ofApp>();
+	ofRunApp(window, app);
+	return ofRunMainLoop();
+}
@@ -0,0 +1,113 @@
+#include "ofxCache.h"
+#include "ofx/Cache/BaseFileStore.h"
+#include "ofx/Cache/MembershipFilter.h"
+#include "ofxUnitTests.h"
+
+
+class FileStore:
+    public ofxCache::BaseReadableFileStore<std::string, ofBuffer>,
+    public ofxCache::BaseWritableFileStore<std::string, ofBuffer>
+{
+public:
+    FileStore(const std::string& path): _path(path)
+    {
+    }
+
+    std::string keyToURI(const std::string& key) const override
+    {
+        return _path + "/" + key;
+    }
+
+protected:
+    std::shared_ptr<ofBuffer> rawToValue(ofBuffer& buffer) override
+    {
+        return std::make_shared<ofBuffer>(buffer);
+    }
+
+    std::shared_ptr<ofBuffer> valueToRaw(ofBuffer& value) override
+    {
+        return std::make_shared<ofBuffer>(value);
+    }
+
+private:
+    std::string _path;
+
+};
+
+
+class ofApp: public ofxUnitTestsApp
+{
+    void run()
+    {
+        testDefiniteMiss();
+        testFilterUpdates();
+    }
+
+    void testDefiniteMiss()
+    {
+        std::string testName = "testDefiniteMiss";
+        std::string path = "filestore";
+
+        ofDirectory::createDirectory(path);
+        ofBufferToFile(path + "/a", ofBuffer(std::string("a")));
+        ofBufferToFile(path + "/b", ofBuffer(std::string("b")));
+
+        FileStore store(path);
+        ofxTest(store.has("b"), testName);
+
+        // "b" is on disk but not in the filter, so finding it as a miss
+        // proves the file system was never asked.
+        store.buildMembershipFilter(std::make_shared<ofxCache::BloomFilter>(100), { "a" });
+
+        ofxTest(store.has("a"), testName);
+        ofxTest(store.get("a") != nullptr, testName);
+        ofxTest(!store.has("b"), testName);
+        ofxTest(store.get("b") == nullptr, testName);
+        ofxTest(!store.has("c"), testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+    void testFilterUpdates()
+    {
+        std::string testName = "testFilterUpdates";
+        std::string path = "filestore";
+
+        ofDirectory::createDirectory(path);
+
+        FileStore store(path);
+        auto filter = std::make_shared<ofxCache::CuckooFilter>(100);
+        store.setMembershipFilter(filter);
+
+        // Added keys are recorded, even when added twice.
+        store.add("a", std::make_shared<ofBuffer>(std::string("a")));
+        store.add("a", std::make_shared<ofBuffer>(std::string("a2")));
+        store.add("b", std::make_shared<ofBuffer>(std::string("b")));
+        ofxTest(store.has("a"), testName);
+        ofxTest(store.has("b"), testName);
+
+        // Removed keys are ruled out without I/O.
+        store.remove("a");
+        ofxTest(!filter->mightContain(ofxCache::KeyHash<std::string>::hash("a")), testName);
+        ofxTest(!store.has("a"), testName);
+        ofxTest(store.get("a") == nullptr, testName);
+        ofxTest(store.has("b"), testName);
+
+        ofDirectory(path).remove(true);
+    }
+
+};
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+	ofInit();
+	auto window = std::make_shared<ofAppNoWindow>();
+	auto app = std::make_shared<ofApp>();
+	ofRunApp(window, app);
+	return ofRunMainLoop();
+}
@@ -1,6 +1,115 @@
 #include "ofxCache.h"
+#include "ofx/Cache/MembershipFilter.h"
 #include "ofxUnitTests.h"
 
+
+// A child cache whose writes wait until the gate is opened.
+class GatedCache: public ofxCache::LRUMemoryCache<int, int>
+{
+public:
+    using ofxCache::LRUMemoryCache<int, int>::LRUMemoryCache;
+
+    void open()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _isOpen = true;
+        }
+
+        _condition.notify_all();
+    }
+
+protected:
+    void doAdd(const int& key, std::shared_ptr<int> entry) override
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]() { return _isOpen; });
+        }
+
+        ofxCache::LRUMemoryCache<int, int>::doAdd(key, entry);
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _isOpen = false;
+
+};
+
+
+// A value whose contents all hash alike, see testContentAddressedCollisions().
+struct CollidingValue
+{
+    std::string data;
+};
+
+
+namespace ofx {
+namespace Cache {
+
+
+template<>
+struct ContentHash<CollidingValue>
+{
+    static std::uint64_t hash(const CollidingValue&)
+    {
+        return 42;
+    }
+
+    static bool equal(const CollidingValue& a, const CollidingValue& b)
+    {
+        return a.data == b.data;
+    }
+};
+
+
+} } // namespace ofx::Cache
+
+
+// A child cache that drops its writes without an error.
+class DroppingCache: public ofxCache::LRUMemoryCache<std::string, std::string>
+{
+public:
+    using ofxCache::LRUMemoryCache<std::string, std::string>::LRUMemoryCache;
+
+protected:
+    void doAdd(const std::string&, std::shared_ptr<std::string>) override
+    {
+    }
+
+};
+
+
+// A child cache that waits for a gate before each write and records the
+// written keys in a set that outlives it.
+class RecordingCache: public ofxCache::LRUMemoryCache<std::string, std::string>
+{
+public:
+    RecordingCache(std::size_t size,
+                   std::shared_future<void> gate,
+                   std::shared_ptr<std::set<std::string>> written):
+        ofxCache::LRUMemoryCache<std::string, std::string>(size),
+        _gate(gate),
+        _written(written)
+    {
+    }
+
+protected:
+    void doAdd(const std::string& key, std::shared_ptr<std::string> entry) override
+    {
+        _gate.wait();
+        _written->insert(key);
+        ofxCache::LRUMemoryCache<std::string, std::string>::doAdd(key, entry);
+    }
+
+private:
+    std::shared_future<void> _gate;
+    std::shared_ptr<std::set<std::string>> _written;
+
+};
+
+
 class ofApp: public ofxUnitTestsApp
 {
     void run()
@@ -9,9 +118,29 @@ class ofApp: public ofxUnitTestsApp
         testCacheSize0();
         testCacheSize1();
         testCacheSize2();
+        testCacheSize2Order();
         testCacheSizeN();
         testDuplicateAdd();
         testUpdate();
+        testHotSet();
+        testKeySerializer();
+        testStatistics();
+        testCascade();
+        testPromotionPolicies();
+        testHeterogeneousLookup();
+        testPin();
+        testBufferedReads();
+        testConcurrentReads();
+        testAdapterCache();
+        testContentAddressed();
+        testContentAddressedCollisions();
+        testWriteBehindRemove();
+        testWriteBehindDestroy();
+        testPoolAllocator();
+        testTraceRoundTrip();
+        testMemoryGovernor();
+        testKeyHash();
+        testMembershipFilter();
 
 
         std::cout << sizeof(Poco::Int64) << " " << std::numeric_limits<Poco::Int64>::max() << std::endl;
@@ -129,6 +258,46 @@ class ofApp: public ofxUnitTestsApp
         ofxTest(!aCache.has(5), "");
     }
 
+    void testCacheSize2Order()
+    {
+        std::string testName = "testCacheSize2Order";
+
+        // keys() lists the values most recently used first.
+        ofxCache::LRUMemoryCache<int, int> aCache(2);
+        aCache.add(1, 2);
+        aCache.add(3, 4);
+        ofxTest(aCache.keys() == std::vector<int>({ 3, 1 }), testName);
+
+        aCache.get(1);
+        ofxTest(aCache.keys() == std::vector<int>({ 1, 3 }), testName);
+        aCache.get(3);
+        ofxTest(aCache.keys() == std::vector<int>({ 3, 1 }), testName);
+
+        // The least recently used value is evicted.
+        aCache.add(5, 6);
+        ofxTest(aCache.keys() == std::vector<int>({ 5, 3 }), testName);
+        aCache.get(3);
+        ofxTest(aCache.keys() == std::vector<int>({ 3, 5 }), testName);
+
+        // Removing from either end keeps the order of the rest.
+        aCache.remove(5);
+        ofxTest(aCache.keys() == std::vector<int>({ 3 }), testName);
+        aCache.add(5, 6);
+        ofxTest(aCache.keys() == std::vector<int>({ 5, 3 }), testName);
+        aCache.remove(3);
+        ofxTest(aCache.keys() == std::vector<int>({ 5 }), testName);
+
+        // Updates count as a use.
+        aCache.add(7, 8);
+        aCache.update(5, std::make_shared<int>(9));
+        ofxTest(aCache.keys() == std::vector<int>({ 5, 7 }), testName);
+        aCache.add(9, 10);
+        ofxTest(aCache.keys() == std::vector<int>({ 9, 5 }), testName);
+
+        aCache.clear();
+        ofxTest(aCache.keys().empty(), testName);
+    }
+
     void testCacheSizeN()
     {
         // 3-1 represents the cache sorted by pos, elements get replaced at the end of the list
@@ -231,6 +400,898 @@ class ofApp: public ofxUnitTestsApp
 
     }
 
+    void testHotSet()
+    {
+        std::string testName = "testHotSet";
+        std::string path = "hotset.bin";
+
+        ofxCache::LRUMemoryCache<int, int> aCache(3);
+        aCache.add(1, 2);
+        aCache.add(3, 4);
+        aCache.add(5, 6); // 5-3-1
+        aCache.get(1);    // 1-5-3
+
+        std::vector<int> expected = { 1, 5, 3 };
+        ofxTest(aCache.keys() == expected, testName);
+        ofxTest(aCache.saveHotSet(path), testName);
+        ofxTest((ofxCache::LRUMemoryCache<int, int>::loadHotSet(path) == expected), testName);
+
+        ofxCache::LRUMemoryCache<int, int> warmCache(3);
+        auto child = warmCache.setChild<ofxCache::LRUMemoryCache<int, int>>(10);
+        child->add(1, 2);
+        child->add(3, 4);
+        child->add(5, 6);
+
+        ofxTestEq(warmCache.size(), 0, testName);
+        ofxTestEq(warmCache.warmFromHotSet(path, 2), 3, testName);
+        ofxTest(warmCache.keys() == expected, testName);
+        ofxTestEq(*warmCache.get(5), 6, testName);
+
+        ofFile::removeFile(path);
+    }
+
+    void testKeySerializer()
+    {
+        std::string testName = "testKeySerializer";
+
+        typedef ofxCache::KeySerializer<std::string> Serializer;
+
+        std::stringstream stream;
+        Serializer::write(stream, "alpha");
+        Serializer::write(stream, "");
+
+        std::string key;
+        ofxTest(Serializer::read(stream, key), testName);
+        ofxTestEq(key, "alpha", testName);
+        ofxTest(Serializer::read(stream, key), testName);
+        ofxTest(key.empty(), testName);
+        ofxTest(!Serializer::read(stream, key), testName);
+
+        // Lengths beyond the end of the stream fail without allocating.
+        std::stringstream corrupt;
+        uint32_t size = 0xFFFFFFF0;
+        corrupt.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        corrupt.write("abc", 3);
+
+        key = "unchanged";
+        ofxTest(!Serializer::read(corrupt, key), testName);
+        ofxTestEq(key, "unchanged", testName);
+    }
+
+    void testStatistics()
+    {
+        std::string testName = "testStatistics";
+
+        ofxCache::LRUMemoryCache<int, int> aCache(2);
+        auto child = aCache.setChild<ofxCache::LRUMemoryCache<int, int>>(10);
+        child->add(1, 2);
+        child->add(3, 4);
+        child->add(5, 6);
+
+        aCache.get(1);   // miss, promoted from the child
+        aCache.get(1);   // hit
+        aCache.get(3);   // miss, promoted from the child
+        aCache.get(5);   // miss, promoted from the child, evicts 1
+        aCache.get(666); // miss in both nodes
+
+        auto statistics = aCache.statistics();
+        ofxTestEq(statistics.hits, 1, testName);
+        ofxTestEq(statistics.misses, 4, testName);
+        ofxTestEq(statistics.promotions, 3, testName);
+        ofxTestEq(statistics.evictions, 1, testName);
+        ofxTestEq(statistics.bytes, 2 * sizeof(int), testName);
+
+        auto cascade = aCache.cascadeStatistics();
+        ofxTestEq(cascade.hits, 4, testName);
+        ofxTestEq(cascade.misses, 5, testName);
+        ofxTestEq(cascade.bytes, 5 * sizeof(int), testName);
+
+        aCache.resetStatistics();
+        ofxTestEq(aCache.statistics().hits, 0, testName);
+        ofxTestEq(aCache.statistics().bytes, 2 * sizeof(int), testName);
+    }
+
+    void testCascade()
+    {
+        std::string testName = "testCascade";
+
+        typedef ofxCache::LRUMemoryCache<int, int> Tier;
+
+        ofxCache::Cascade<Tier, Tier> aCache(2, 10);
+        Tier& fast = aCache.tier<0>();
+        Tier& slow = aCache.tier<1>();
+
+        slow.add(1, 2);
+        slow.add(3, 4);
+        slow.add(5, 6);
+
+        // Hits in the lower tier are promoted to the upper tier.
+        ofxTestEq(*aCache.get(1), 2, testName);
+        ofxTestEq(fast.size(), 1, testName);
+        ofxTestEq(*aCache.get(3), 4, testName);
+        ofxTestEq(*aCache.get(5), 6, testName); // evicts 1 from the upper tier
+        ofxTest(aCache.get(666) == nullptr, testName);
+
+        // The counters of the cascade include the bytes and evictions of
+        // its tiers.
+        auto statistics = aCache.statistics();
+        ofxTestEq(statistics.hits, 3, testName);
+        ofxTestEq(statistics.misses, 1, testName);
+        ofxTestEq(statistics.promotions, 3, testName);
+        ofxTestEq(statistics.evictions, 1, testName);
+        ofxTestEq(statistics.bytes, 5 * sizeof(int), testName);
+
+        std::vector<int> expected = { 5, 3 };
+        ofxTest(fast.keys() == expected, testName);
+
+        // The promotion policy can keep hits in the lower tier.
+        aCache.setPromotionPolicy(std::make_shared<ofxCache::NeverPromotionPolicy<int>>());
+        slow.add(7, 8);
+        ofxTestEq(*aCache.get(7), 8, testName);
+        ofxTest(!fast.has(7), testName);
+        ofxTestEq(aCache.statistics().promotions, 3, testName);
+
+        // Adds go to the upper tier, removes reach every tier.
+        aCache.add(9, 10);
+        ofxTest(fast.has(9) && !slow.has(9), testName);
+        aCache.remove(5);
+        ofxTest(!fast.has(5) && !slow.has(5), testName);
+        ofxTest(!aCache.has(5), testName);
+
+        aCache.clear();
+        ofxTestEq(fast.size(), 0, testName);
+        ofxTestEq(slow.size(), 0, testName);
+        ofxTestEq(aCache.statistics().bytes, 0, testName);
+    }
+
+    void testPromotionPolicies()
+    {
+        std::string testName = "testPromotionPolicies";
+
+        // Keys are promoted on their second hit within the window.
+        ofxCache::HitCountPromotionPolicy<int> hitCount(2, std::chrono::milliseconds(50));
+        ofxTest(!hitCount.shouldPromote(1), testName);
+        ofxTest(hitCount.shouldPromote(1), testName);
+        ofxTest(!hitCount.shouldPromote(1), testName);
+
+        // Hits outside of the window start a new count.
+        ofxTest(!hitCount.shouldPromote(2), testName);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ofxTest(!hitCount.shouldPromote(2), testName);
+        ofxTest(hitCount.shouldPromote(2), testName);
+
+        // Expired keys make room for new ones.
+        ofxCache::HitCountPromotionPolicy<int> expiring(2, std::chrono::milliseconds(50), 2);
+        ofxTest(!expiring.shouldPromote(1), testName);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ofxTest(!expiring.shouldPromote(2), testName);
+        ofxTest(!expiring.shouldPromote(3), testName);
+        ofxTest(expiring.shouldPromote(2), testName);
+
+        // Once too many keys are counted, all counts are forgotten.
+        ofxCache::HitCountPromotionPolicy<int> bounded(2, std::chrono::seconds(60), 2);
+        ofxTest(!bounded.shouldPromote(1), testName);
+        ofxTest(!bounded.shouldPromote(2), testName);
+        ofxTest(!bounded.shouldPromote(3), testName);
+        ofxTest(!bounded.shouldPromote(1), testName);
+        ofxTest(bounded.shouldPromote(1), testName);
+
+        ofxCache::NeverPromotionPolicy<int> never;
+        ofxCache::ProbabilisticPromotionPolicy<int> none(0);
+        ofxCache::ProbabilisticPromotionPolicy<int> all(1);
+        ofxCache::ProbabilisticPromotionPolicy<int> half(0.5);
+
+        std::size_t neverCount = 0;
+        std::size_t noneCount = 0;
+        std::size_t allCount = 0;
+        std::size_t halfCount = 0;
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            neverCount += never.shouldPromote(i);
+            noneCount += none.shouldPromote(i);
+            allCount += all.shouldPromote(i);
+            halfCount += half.shouldPromote(i);
+        }
+
+        ofxTestEq(neverCount, 0, testName);
+        ofxTestEq(noneCount, 0, testName);
+        ofxTestEq(allCount, 1000, testName);
+        ofxTest(halfCount > 350 && halfCount < 650, testName);
+    }
+
+    void testHeterogeneousLookup()
+    {
+        std::string testName = "testHeterogeneousLookup";
+
+        ofxCache::LRUMemoryCache<std::string, std::string> aCache(10);
+        auto child = aCache.setChild<ofxCache::LRUMemoryCache<std::string, std::string>>(10);
+        aCache.add("alpha", std::make_shared<std::string>("a"));
+        child->add("gamma", std::make_shared<std::string>("g"));
+
+        const char* alpha = "alpha";
+        ofxTest(aCache.has(alpha), testName);
+        ofxTestEq(*aCache.get(alpha), "a", testName);
+        ofxTest(!aCache.has("beta"), testName);
+        ofxTest(aCache.get("beta") == nullptr, testName);
+
+#if OFX_CACHE_HAS_STRING_VIEW
+        // Views need not be null terminated.
+        std::string buffer = "alphabet";
+        std::string_view view(buffer.data(), 5);
+        ofxTest(aCache.has(view), testName);
+        ofxTestEq(*aCache.get(view), "a", testName);
+        ofxTest(!aCache.has(std::string_view(buffer)), testName);
+
+        // Misses fall through to the child and are promoted.
+        auto gamma = aCache.get(std::string_view("gamma"));
+        ofxTest(gamma != nullptr && *gamma == "g", testName);
+        ofxTest(aCache.has(std::string_view("gamma")), testName);
+
+        auto statistics = aCache.statistics();
+        ofxTestEq(statistics.hits, 2, testName);
+        ofxTestEq(statistics.misses, 2, testName);
+        ofxTestEq(statistics.promotions, 1, testName);
+#endif
+    }
+
+    void testPin()
+    {
+        std::string testName = "testPin";
+
+        ofxCache::LRUMemoryCache<int, int> aCache(2);
+        aCache.add(1, 2);
+        aCache.add(3, 4);
+
+        {
+            auto pin = aCache.pin(1);
+            ofxTest(pin.isPinned(), testName);
+            ofxTestEq(aCache.pinnedCount(), 1, testName);
+            ofxTestEq(aCache.pinnedBytes(), sizeof(int), testName);
+
+            aCache.add(5, 6); // evicts 3, the oldest unpinned entry
+            aCache.add(7, 8); // evicts 5
+            ofxTest(aCache.has(1), testName);
+            ofxTest(!aCache.has(3), testName);
+            ofxTest(!aCache.has(5), testName);
+            ofxTestEq(*pin.value(), 2, testName);
+        }
+
+        ofxTestEq(aCache.pinnedCount(), 0, testName);
+        ofxTestEq(aCache.pinnedBytes(), 0, testName);
+
+        aCache.setMaximumBytes(sizeof(int));
+        ofxTestEq(aCache.size(), 1, testName);
+
+        ofxTest(!aCache.pin(666), testName);
+    }
+
+    void testBufferedReads()
+    {
+        std::string testName = "testBufferedReads";
+
+        // Hits on one thread are never dropped, so the recency order stays
+        // exact across several drains of the read buffer.
+        const int count = 10;
+        ofxCache::LRUMemoryCache<int, int> aCache(count);
+        std::list<int> expected;
+
+        for (int i = 0; i < count; ++i)
+        {
+            aCache.add(i, i * 2);
+            expected.push_front(i);
+        }
+
+        std::size_t hits = ofxCache::ReadBuffer<int>::STRIPE_SIZE * 3 + 5;
+
+        for (std::size_t i = 0; i < hits; ++i)
+        {
+            int key = static_cast<int>((i * 7) % count);
+            ofxTestEq(*aCache.get(key), key * 2, testName);
+            expected.remove(key);
+            expected.push_front(key);
+        }
+
+        ofxTest(aCache.keys() == std::vector<int>(expected.begin(), expected.end()), testName);
+
+        // The next add evicts the least recently read key.
+        int oldest = expected.back();
+        aCache.add(count, count * 2);
+        ofxTest(!aCache.has(oldest), testName);
+        ofxTestEq(aCache.size(), count, testName);
+    }
+
+    void testConcurrentReads()
+    {
+        std::string testName = "testConcurrentReads";
+
+        const int capacity = 64;
+        const int keyCount = 256;
+        ofxCache::LRUMemoryCache<int, int> aCache(capacity);
+
+        for (int i = 0; i < capacity; ++i)
+        {
+            aCache.add(i, i * 2);
+        }
+
+        std::atomic<bool> isRunning(true);
+        std::atomic<int> mismatches(0);
+        std::vector<std::thread> threads;
+
+        // Readers hit and miss while the other threads reorder the entries.
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.push_back(std::thread([&, t]()
+            {
+                for (int i = 0; isRunning; ++i)
+                {
+                    int key = (i * 13 + t) % keyCount;
+                    auto value = aCache.get(key);
+
+                    if (value != nullptr && *value != key * 2)
+                    {
+                        ++mismatches;
+                    }
+                }
+            }));
+        }
+
+        // A writer adds new keys, which evicts the old ones.
+        threads.push_back(std::thread([&]()
+        {
+            for (int i = 0; isRunning; ++i)
+            {
+                int key = (i * 7) % keyCount;
+                aCache.add(key, key * 2);
+            }
+        }));
+
+        // Pinned entries leave the recency order while they are read.
+        threads.push_back(std::thread([&]()
+        {
+            for (int i = 0; isRunning; ++i)
+            {
+                int key = (i * 11) % keyCount;
+                auto pin = aCache.pin(key);
+
+                if (pin && *pin.value() != key * 2)
+                {
+                    ++mismatches;
+                }
+            }
+        }));
+
+        // Shrinking the byte limit evicts from under the readers.
+        threads.push_back(std::thread([&]()
+        {
+            for (int i = 0; isRunning; ++i)
+            {
+                aCache.setMaximumBytes(i % 2 == 0 ? capacity / 2 * sizeof(int) : 0);
+            }
+        }));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        isRunning = false;
+
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+
+        ofxTestEq(mismatches.load(), 0, testName);
+
+        // Every key is listed once, whatever reads were dropped.
+        aCache.setMaximumBytes(0);
+        auto keys = aCache.keys();
+        std::set<int> uniqueKeys(keys.begin(), keys.end());
+        ofxTestEq(keys.size(), aCache.size(), testName);
+        ofxTestEq(uniqueKeys.size(), keys.size(), testName);
+        ofxTest(aCache.size() <= capacity, testName);
+        ofxTestEq(aCache.pinnedCount(), 0, testName);
+
+        for (int key: keys)
+        {
+            ofxTestEq(*aCache.get(key), key * 2, testName);
+        }
+    }
+
+    void testAdapterCache()
+    {
+        std::string testName = "testAdapterCache";
+
+        typedef ofxCache::AdapterCache<std::string, int, std::string, std::string> Adapter;
+
+        auto decodes = std::make_shared<std::size_t>(0);
+
+        auto decoder = [decodes](const std::string&, const std::string& raw)
+        {
+            ++*decodes;
+            return std::make_shared<int>(ofToInt(raw));
+        };
+
+        auto encoder = [](const std::string&, const int& value)
+        {
+            return std::make_shared<std::string>(ofToString(value));
+        };
+
+        ofxCache::LRUMemoryCache<std::string, int> aCache(10);
+        auto adapter = aCache.setChild<Adapter>([](const std::string& key) { return "raw_" + key; },
+                                                decoder,
+                                                encoder);
+        auto raw = adapter->setChild<ofxCache::LRUMemoryCache<std::string, std::string>>(10);
+
+        // Child values are decoded once, when they are promoted.
+        raw->add("raw_a", std::make_shared<std::string>("1"));
+        auto a = aCache.get("a");
+        ofxTest(a != nullptr && *a == 1, testName);
+        ofxTestEq(aCache.size(), 1, testName);
+        ofxTestEq(adapter->size(), 0, testName);
+        ofxTestEq(*decodes, 1, testName);
+
+        aCache.get("a");
+        ofxTestEq(*decodes, 1, testName);
+        ofxTest(aCache.get("b") == nullptr, testName);
+
+        // Written values are encoded and written through to the child.
+        aCache.setWritePolicy(ofxCache::WritePolicy::WRITE_THROUGH);
+        aCache.add("c", std::make_shared<int>(3));
+        auto c = raw->get("raw_c");
+        ofxTest(c != nullptr && *c == "3", testName);
+
+        // Without a key mapper, keys convert implicitly.
+        ofxCache::LRUMemoryCache<std::string, int> bCache(10);
+        auto implicitRaw = bCache.setChild<Adapter>(nullptr, decoder)->setChild<ofxCache::LRUMemoryCache<std::string, std::string>>(10);
+        implicitRaw->add("a", std::make_shared<std::string>("2"));
+        auto b = bCache.get("a");
+        ofxTest(b != nullptr && *b == 2, testName);
+        ofxTestEq(*decodes, 2, testName);
+    }
+
+    void testContentAddressed()
+    {
+        std::string testName = "testContentAddressed";
+
+        typedef ofxCache::ContentAddressedCache<std::string, std::string> Cache;
+
+        Cache aCache;
+        auto child = aCache.setChild<ofxCache::LRUMemoryCache<std::string, std::string>>(10);
+        aCache.setWritePolicy(ofxCache::WritePolicy::WRITE_THROUGH);
+
+        aCache.add("a", std::make_shared<std::string>("same"));
+        aCache.add("b", std::make_shared<std::string>("same"));
+        aCache.add("c", std::make_shared<std::string>("other"));
+
+        ofxTestEq(aCache.size(), 3, testName);
+        ofxTestEq(aCache.uniqueCount(), 2, testName);
+        ofxTestEq(child->size(), 2, testName);
+        ofxTestEq(aCache.deduplicatedBytes(), ofxCache::ValueSize<std::string>::size("same"), testName);
+
+        // Keys of the same contents share one value.
+        auto a = aCache.get("a");
+        ofxTest(a != nullptr && *a == "same", testName);
+        ofxTest(aCache.get("b") == a, testName);
+        ofxTest(aCache.get("d") == nullptr, testName);
+
+        // Values are removed from the child with their last key.
+        aCache.remove("a");
+        ofxTestEq(child->size(), 2, testName);
+        aCache.remove("b");
+        ofxTestEq(child->size(), 1, testName);
+        ofxTestEq(aCache.uniqueCount(), 1, testName);
+
+        std::string path = "index.bin";
+        ofxTest(aCache.saveIndex(path), testName);
+
+        Cache restored;
+        ofxTest(restored.loadIndex(path), testName);
+        ofxTest(restored.has("c"), testName);
+        ofxTestEq(restored.uniqueCount(), 1, testName);
+
+        ofFile::removeFile(path);
+    }
+
+    void testContentAddressedCollisions()
+    {
+        std::string testName = "testContentAddressedCollisions";
+
+        ofxCache::ContentAddressedCache<std::string, CollidingValue> aCache;
+        auto child = aCache.setChild<ofxCache::LRUMemoryCache<std::string, CollidingValue>>(10);
+        aCache.setWritePolicy(ofxCache::WritePolicy::WRITE_THROUGH);
+
+        // Stored blobs are only weakly held, so a and b are compared with
+        // the contents in the child.
+        aCache.add("a", CollidingValue { "first" });
+        aCache.add("b", CollidingValue { "second" });
+        aCache.add("c", CollidingValue { "first" });
+
+        ofxTestEq(aCache.uniqueCount(), 2, testName);
+        ofxTestEq(child->size(), 2, testName);
+        ofxTestEq(aCache.get("a")->data, "first", testName);
+        ofxTestEq(aCache.get("b")->data, "second", testName);
+        ofxTestEq(aCache.get("c")->data, "first", testName);
+
+        // Blobs the child didn't write stay in memory and out of the index.
+        ofxCache::ContentAddressedCache<std::string, std::string> droppedCache;
+        auto droppingChild = droppedCache.setChild<DroppingCache>(10);
+        droppedCache.setWritePolicy(ofxCache::WritePolicy::WRITE_THROUGH);
+        droppedCache.add("a", std::make_shared<std::string>("value"));
+
+        ofxTestEq(droppingChild->size(), 0, testName);
+        ofxTest(droppedCache.get("a") != nullptr && *droppedCache.get("a") == "value", testName);
+
+        std::string path = "dropped.bin";
+        ofxTest(droppedCache.saveIndex(path), testName);
+
+        ofxCache::ContentAddressedCache<std::string, std::string> restored;
+        ofxTest(restored.loadIndex(path), testName);
+        ofxTest(!restored.has("a"), testName);
+
+        ofFile::removeFile(path);
+    }
+
+    void testWriteBehindRemove()
+    {
+        std::string testName = "testWriteBehindRemove";
+
+        ofxCache::LRUMemoryCache<int, int> aCache(10);
+        auto child = aCache.setChild<GatedCache>(10);
+        aCache.setWritePolicy(ofxCache::WritePolicy::WRITE_BEHIND, 16, 1);
+
+        // The writer waits in the write of 0, so later writes stay queued.
+        aCache.add(0, 1);
+        aCache.add(1, 2);
+        aCache.remove(1);
+        ofxTest(aCache.get(1) == nullptr, testName);
+        ofxTest(!aCache.has(1), testName);
+
+        aCache.add(2, 3);
+        aCache.clear();
+        ofxTest(aCache.get(2) == nullptr, testName);
+
+        child->open();
+        aCache.flush();
+        ofxTest(!child->has(1), testName);
+        ofxTest(!child->has(2), testName);
+        ofxTestEq(aCache.pendingWrites(), 0, testName);
+    }
+
+    void testWriteBehindDestroy()
+    {
+        std::string testName = "testWriteBehindDestroy";
+
+        std::promise<void> gate;
+        auto written = std::make_shared<std::set<std::string>>();
+        std::thread opener;
+
+        {
+            ofxCache::ContentAddressedCache<std::string, std::string> aCache;
+            aCache.setChild<RecordingCache>(10, gate.get_future().share(), written);
+            aCache.setWritePolicy(ofxCache::WritePolicy::WRITE_BEHIND, 16, 1);
+
+            aCache.add("a", std::make_shared<std::string>("same"));
+            aCache.add("b", std::make_shared<std::string>("same"));
+            aCache.add("c", std::make_shared<std::string>("other"));
+
+            // The writes are still queued when the cache is destroyed, so
+            // they drain while its index is alive.
+            ofxTest(written->empty(), testName);
+
+            opener = std::thread([&]()
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                gate.set_value();
+            });
+        }
+
+        opener.join();
+
+        ofxTestEq(written->size(), 2, testName);
+        ofxTest(written->find(ofxCache::hashToString(ofxCache::ContentHash<std::string>::hash("same"))) != written->end(), testName);
+        ofxTest(written->find(ofxCache::hashToString(ofxCache::ContentHash<std::string>::hash("other"))) != written->end(), testName);
+    }
+
+    void testPoolAllocator()
+    {
+        std::string testName = "testPoolAllocator";
+
+        // Returned blocks are reused.
+        ofxCache::PoolAllocator<int> allocator;
+        int* block = allocator.allocate(1);
+        allocator.deallocate(block, 1);
+        ofxTest(allocator.allocate(1) == block, testName);
+        ofxTestEq(allocator.pool()->blocksInUse(), 1, testName);
+        allocator.deallocate(block, 1);
+        ofxTestEq(allocator.pool()->blocksInUse(), 0, testName);
+
+        // Strictly aligned requests bypass the pool but keep their alignment.
+        struct alignas(64) Aligned
+        {
+            char data[64];
+        };
+
+        ofxCache::PoolAllocator<Aligned> alignedAllocator;
+        Aligned* aligned = alignedAllocator.allocate(2);
+        ofxTestEq(reinterpret_cast<std::uintptr_t>(aligned) % alignof(Aligned), 0, testName);
+        alignedAllocator.deallocate(aligned, 2);
+
+        // Once warm, inserts and evictions recycle pooled nodes only.
+        ofxCache::LRUMemoryCache<int, int, ofxCache::PoolAllocator<int>> aCache(100);
+
+        for (int i = 0; i < 300; ++i)
+        {
+            aCache.emplace(i, i);
+        }
+
+        auto pool = aCache.allocator().pool();
+        auto blocksInUse = pool->blocksInUse();
+        auto reservedBytes = pool->reservedBytes();
+
+        ofxTest(blocksInUse > 0, testName);
+
+        for (int i = 300; i < 1300; ++i)
+        {
+            aCache.emplace(i, i);
+        }
+
+        ofxTestEq(pool->blocksInUse(), blocksInUse, testName);
+        ofxTestEq(pool->reservedBytes(), reservedBytes, testName);
+        ofxTestEq(*aCache.get(1299), 1299, testName);
+    }
+
+    void testTraceRoundTrip()
+    {
+        std::string testName = "testTraceRoundTrip";
+        std::string path = "trace.bin";
+
+        // A small buffer hands many blocks to the writer thread.
+        {
+            ofxCache::TraceRecorder<int> recorder(path, 64);
+
+            for (int i = 0; i < 1000; ++i)
+            {
+                recorder.record(ofxCache::TraceOperation::GET, i % 10);
+            }
+
+            recorder.record(ofxCache::TraceOperation::REMOVE, 9);
+            ofxTestEq(recorder.count(), 1001, testName);
+        }
+
+        // Records are read back in order.
+        std::vector<int> keys;
+        std::size_t removes = 0;
+
+        auto count = ofxCache::TraceRecorder<int>::read(path, [&](ofxCache::TraceOperation operation, const int& key)
+        {
+            if (operation == ofxCache::TraceOperation::GET)
+            {
+                keys.push_back(key);
+            }
+            else if (operation == ofxCache::TraceOperation::REMOVE && key == 9)
+            {
+                ++removes;
+            }
+        });
+
+        ofxTestEq(count, 1001, testName);
+        ofxTestEq(keys.size(), 1000, testName);
+        ofxTestEq(removes, 1, testName);
+
+        bool isOrdered = true;
+
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            isOrdered = isOrdered && keys[i] == static_cast<int>(i % 10);
+        }
+
+        ofxTest(isOrdered, testName);
+
+        // Cycling through 10 keys misses every time below that capacity.
+        ofxCache::TraceSimulator<int> simulator;
+        ofxTestEq(simulator.load(path), 1001, testName);
+
+        for (const auto& result: simulator.simulate({ 5, 10 }))
+        {
+            if (result.policy == "LRU" && result.capacity == 5)
+            {
+                ofxTestEq(result.hits, 0, testName);
+                ofxTestEq(result.misses, 1000, testName);
+            }
+            else if (result.policy == "LRU" && result.capacity == 10)
+            {
+                ofxTestEq(result.hits, 990, testName);
+                ofxTestEq(result.misses, 10, testName);
+            }
+        }
+
+        ofFile::removeFile(path);
+    }
+
+    void testMemoryGovernor()
+    {
+        std::string testName = "testMemoryGovernor";
+
+        // Rebalances only when asked to.
+        ofxCache::MemoryGovernor governor(1000, std::chrono::milliseconds(0));
+
+        struct FakeCache
+        {
+            ofxCache::CacheStatistics statistics;
+            std::size_t maximumBytes = 0;
+        };
+
+        FakeCache a;
+        FakeCache b;
+
+        // The callbacks may use the governor, as they are not called under
+        // its lock.
+        auto consumer = [&governor](const std::string& name, FakeCache& cache)
+        {
+            ofxCache::MemoryGovernor::Consumer result;
+            result.name = name;
+            result.statistics = [&governor, &cache]()
+            {
+                governor.memoryPressure();
+                return cache.statistics;
+            };
+            result.setMaximumBytes = [&governor, &cache](std::size_t bytes)
+            {
+                governor.totalBytes();
+                cache.maximumBytes = bytes;
+            };
+            return result;
+        };
+
+        auto aRegistration = governor.add(consumer("a", a));
+        ofxTestEq(a.maximumBytes, 1000, testName);
+
+        auto bRegistration = governor.add(consumer("b", b));
+        ofxTestEq(a.maximumBytes, 500, testName);
+        ofxTestEq(b.maximumBytes, 500, testName);
+
+        governor.setMemoryPressure(0.5);
+        ofxTestEq(a.maximumBytes, 250, testName);
+        ofxTestEq(b.maximumBytes, 250, testName);
+
+        governor.setMemoryPressure(0);
+        ofxTestEq(a.maximumBytes, 500, testName);
+
+        // "a" is full and misses, "b" is barely used, so a step of the
+        // total moves from "b" to "a".
+        a.statistics.bytes = 500;
+        a.statistics.misses = 100;
+        b.statistics.bytes = 100;
+        b.statistics.hits = 1;
+
+        governor.rebalance();
+        ofxTestEq(a.maximumBytes, 550, testName);
+        ofxTestEq(b.maximumBytes, 450, testName);
+
+        // Without new misses nothing moves.
+        governor.rebalance();
+        ofxTestEq(a.maximumBytes, 550, testName);
+
+        auto json = governor.toJson();
+        ofxTestEq(json["caches"].size(), 2, testName);
+        ofxTestEq(json["totalBytes"].get<std::size_t>(), 1000, testName);
+
+        // The remaining cache gets the freed share, the removed one is left
+        // alone.
+        bRegistration.reset();
+        ofxTestEq(a.maximumBytes, 1000, testName);
+        ofxTestEq(b.maximumBytes, 450, testName);
+        ofxTestEq(governor.toJson()["caches"].size(), 1, testName);
+    }
+
+    void testKeyHash()
+    {
+        std::string testName = "testKeyHash";
+
+        // Equal keys hash equally.
+        ofxTestEq(ofxCache::KeyHash<float>::hash(-0.0f), ofxCache::KeyHash<float>::hash(0.0f), testName);
+        ofxTestEq(ofxCache::KeyHash<double>::hash(-0.0), ofxCache::KeyHash<double>::hash(0.0), testName);
+        ofxTestEq(ofxCache::KeyHash<long double>::hash(-0.0L), ofxCache::KeyHash<long double>::hash(0.0L), testName);
+        ofxTest(ofxCache::KeyHash<double>::hash(1.0) != ofxCache::KeyHash<double>::hash(-1.0), testName);
+
+        // The padding of long double doesn't change the hash.
+        long double a;
+        long double b;
+        std::memset(&a, 0x00, sizeof(a));
+        std::memset(&b, 0xff, sizeof(b));
+        a = 1.5L;
+        b = 1.5L;
+        ofxTestEq(ofxCache::KeyHash<long double>::hash(a), ofxCache::KeyHash<long double>::hash(b), testName);
+
+        // Hash strings convert back to their hash.
+        for (std::uint64_t hash: { std::uint64_t(0), std::uint64_t(12345), ofxCache::KeyHash<std::string>::hash("a"), ~std::uint64_t(0) })
+        {
+            std::uint64_t parsed = 0;
+            ofxTest(ofxCache::stringToHash(ofxCache::hashToString(hash), parsed), testName);
+            ofxTestEq(parsed, hash, testName);
+        }
+
+        std::uint64_t parsed = 0;
+        ofxTest(!ofxCache::stringToHash("", parsed), testName);
+        ofxTest(!ofxCache::stringToHash("g000000000000", parsed), testName);
+        ofxTest(!ofxCache::stringToHash("000000000000w", parsed), testName);
+    }
+
+    void testMembershipFilter()
+    {
+        std::string testName = "testMembershipFilter";
+
+        const std::size_t count = 10000;
+
+        ofxCache::BloomFilter bloom(count);
+        ofxCache::CuckooFilter cuckoo(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            bloom.insert(ofxCache::KeyHash<std::size_t>::hash(i));
+            cuckoo.insert(ofxCache::KeyHash<std::size_t>::hash(i));
+        }
+
+        // Inserted keys are never ruled out.
+        std::size_t bloomMisses = 0;
+        std::size_t cuckooMisses = 0;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            bloomMisses += bloom.mightContain(ofxCache::KeyHash<std::size_t>::hash(i)) ? 0 : 1;
+            cuckooMisses += cuckoo.mightContain(ofxCache::KeyHash<std::size_t>::hash(i)) ? 0 : 1;
+        }
+
+        ofxTestEq(bloomMisses, 0, testName);
+        ofxTestEq(cuckooMisses, 0, testName);
+        ofxTest(!cuckoo.isOverflowed(), testName);
+
+        // Most other keys are ruled out.
+        std::size_t bloomFalsePositives = 0;
+        std::size_t cuckooFalsePositives = 0;
+
+        for (std::size_t i = count; i < count * 2; ++i)
+        {
+            bloomFalsePositives += bloom.mightContain(ofxCache::KeyHash<std::size_t>::hash(i)) ? 1 : 0;
+            cuckooFalsePositives += cuckoo.mightContain(ofxCache::KeyHash<std::size_t>::hash(i)) ? 1 : 0;
+        }
+
+        ofxTest(bloomFalsePositives < count / 20, testName);
+        ofxTest(cuckooFalsePositives < count / 100, testName);
+
+        // Removed keys are ruled out, the others are kept.
+        for (std::size_t i = 0; i < count; i += 2)
+        {
+            ofxTest(cuckoo.remove(ofxCache::KeyHash<std::size_t>::hash(i)), testName);
+        }
+
+        std::size_t removedHits = 0;
+        cuckooMisses = 0;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            bool isMember = cuckoo.mightContain(ofxCache::KeyHash<std::size_t>::hash(i));
+
+            if (i % 2 == 0)
+            {
+                removedHits += isMember ? 1 : 0;
+            }
+            else
+            {
+                cuckooMisses += isMember ? 0 : 1;
+            }
+        }
+
+        ofxTest(removedHits < count / 100, testName);
+        ofxTestEq(cuckooMisses, 0, testName);
+
+        ofxTest(!bloom.remove(ofxCache::KeyHash<std::size_t>::hash(1)), testName);
+        ofxTest(bloom.mightContain(ofxCache::KeyHash<std::size_t>::hash(1)), testName);
+
+        bloom.clear();
+        cuckoo.clear();
+        ofxTest(!bloom.mightContain(ofxCache::KeyHash<std::size_t>::hash(1)), testName);
+        ofxTest(!cuckoo.mightContain(ofxCache::KeyHash<std::size_t>::hash(1)), testName);
+    }
+
     void onAdd(const std::pair<int, std::shared_ptr<int>>& args)
     {
         ++addCnt;
@@ -0,0 +1,411 @@
+#include "ofxCache.h"
+#include "ofx/Cache/BaseFileStore.h"
+#include "ofx/Cache/BaseHTTPStore.h"
+#include "ofxUnitTests.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/StreamSocket.h"
+#include <csignal>
+
+
+#define ENTITY_TAG "slow-body-1"
+
+
+// A local HTTP server that sends a large body very slowly. Range requests
+// validated by the entity tag are answered with the rest of the body.
+class SlowHTTPServer
+{
+public:
+    SlowHTTPServer():
+        _socket(Poco::Net::SocketAddress("127.0.0.1", 0)),
+        _thread([this]() { run(); })
+    {
+    }
+
+    ~SlowHTTPServer()
+    {
+        _isRunning = false;
+        _thread.join();
+    }
+
+    std::string uri() const
+    {
+        return "http://127.0.0.1:" + ofToString(_socket.address().port()) + "/slow.bin";
+    }
+
+    bool wasDisconnected() const
+    {
+        return _wasDisconnected;
+    }
+
+    /// The body bytes sent on the last connection.
+    std::size_t lastBodyBytes() const
+    {
+        return _lastBodyBytes;
+    }
+
+    void setChunkInterval(int milliseconds)
+    {
+        _chunkInterval = milliseconds;
+    }
+
+    static char bodyByte(std::size_t offset)
+    {
+        return char('a' + offset % 26);
+    }
+
+    enum
+    {
+        BODY_SIZE = 1024 * 1024,
+        CHUNK_SIZE = 1024,
+        CHUNK_INTERVAL_MILLISECONDS = 50
+    };
+
+private:
+    void run()
+    {
+        while (_isRunning)
+        {
+            if (!_socket.poll(Poco::Timespan(0, 100000), Poco::Net::Socket::SELECT_READ))
+            {
+                continue;
+            }
+
+            Poco::Net::StreamSocket client = _socket.acceptConnection();
+
+            try
+            {
+                std::string request;
+                char buffer[1024];
+
+                while (request.find("\r\n\r\n") == std::string::npos)
+                {
+                    int count = client.receiveBytes(buffer, sizeof(buffer));
+
+                    if (count <= 0)
+                    {
+                        break;
+                    }
+
+                    request.append(buffer, count);
+                }
+
+                std::size_t start = 0;
+                std::size_t range = request.find("Range: bytes=");
+
+                if (range != std::string::npos && request.find("If-Range: \"" ENTITY_TAG "\"") != std::string::npos)
+                {
+                    start = ofToInt(request.substr(range + 13));
+                }
+
+                std::string header = start > 0 ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+                header += "Content-Type: application/octet-stream\r\n";
+                header += "ETag: \"" ENTITY_TAG "\"\r\n";
+                header += "Content-Length: " + ofToString(BODY_SIZE - start) + "\r\n";
+
+                if (start > 0)
+                {
+                    header += "Content-Range: bytes " + ofToString(start) + "-" + ofToString(BODY_SIZE - 1) + "/" + ofToString(BODY_SIZE) + "\r\n";
+                }
+
+                header += "\r\n";
+                client.sendBytes(header.data(), header.size());
+
+                _lastBodyBytes = 0;
+
+                for (std::size_t offset = start; offset < BODY_SIZE && _isRunning;)
+                {
+                    std::string chunk;
+
+                    for (; chunk.size() < CHUNK_SIZE && offset < BODY_SIZE; ++offset)
+                    {
+                        chunk.push_back(bodyByte(offset));
+                    }
+
+                    client.sendBytes(chunk.data(), chunk.size());
+                    _lastBodyBytes += chunk.size();
+
+                    if (_chunkInterval > 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(_chunkInterval));
+                    }
+                }
+            }
+            catch (const Poco::Exception&)
+            {
+                _wasDisconnected = true;
+            }
+        }
+    }
+
+    Poco::Net::ServerSocket _socket;
+    std::atomic<bool> _isRunning { true };
+    std::atomic<bool> _wasDisconnected { false };
+    std::atomic<std::size_t> _lastBodyBytes { 0 };
+    std::atomic<int> _chunkInterval { CHUNK_INTERVAL_MILLISECONDS };
+    std::thread _thread;
+
+};
+
+
+class HTTPStore: public ofxCache::BaseReadableHTTPStore<std::string, ofBuffer>
+{
+public:
+    std::string keyToURI(const std::string& key) const override
+    {
+        return key;
+    }
+
+protected:
+    std::shared_ptr<ofBuffer> rawToValue(ofx::HTTP::ClientExchange& exchange) override
+    {
+        return std::make_shared<ofBuffer>(exchange.response().stream());
+    }
+
+    std::shared_ptr<ofBuffer> bufferToValue(ofBuffer& buffer) override
+    {
+        return std::make_shared<ofBuffer>(buffer);
+    }
+
+};
+
+
+class FileStore: public ofxCache::BaseReadableFileStore<std::string, ofBuffer>
+{
+public:
+    std::string keyToURI(const std::string& key) const override
+    {
+        return key;
+    }
+
+protected:
+    std::shared_ptr<ofBuffer> rawToValue(ofBuffer& buffer) override
+    {
+        return std::make_shared<ofBuffer>(buffer);
+    }
+
+};
+
+
+// A cache loading from an HTTPStore, which records when its loads finish.
+class HTTPCache: public ofxCache::BaseResourceCache<std::string, ofBuffer>
+{
+public:
+    HTTPCache(HTTPStore& store): _store(store)
+    {
+    }
+
+    std::shared_ptr<ofBuffer> load(ofxCache::CacheRequestTask<std::string, ofBuffer>& request) override
+    {
+        try
+        {
+            auto value = _store.get(request.key());
+            _finishedAt = ofGetElapsedTimeMillis();
+            return value;
+        }
+        catch (const Poco::Exception&)
+        {
+            _isAborted = true;
+            _finishedAt = ofGetElapsedTimeMillis();
+            throw;
+        }
+    }
+
+    std::string toTaskId(const std::string& key) const override
+    {
+        return "HTTPCache:" + key;
+    }
+
+    /// Wait until the load finished.
+    /// \returns the time it finished, or 0 if it is still running.
+    uint64_t waitForLoad(int milliseconds) const
+    {
+        for (int i = 0; i < milliseconds && _finishedAt == 0; i += 10)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        return _finishedAt;
+    }
+
+    bool isAborted() const
+    {
+        return _isAborted;
+    }
+
+private:
+    HTTPStore& _store;
+    std::atomic<uint64_t> _finishedAt { 0 };
+    std::atomic<bool> _isAborted { false };
+
+};
+
+
+class ofApp: public ofxUnitTestsApp
+{
+    void run()
+    {
+#ifndef TARGET_WIN32
+        // The slow server writes to connections the client aborted.
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+        testToken();
+        testFileCancel();
+        testHTTPCancelLatency();
+        testResumeDownload();
+    }
+
+    void testToken()
+    {
+        std::string testName = "testToken";
+
+        ofxCache::CancellationToken token;
+        int calls = 0;
+
+        ofxTest(ofxCache::CancellationToken::current() == nullptr, testName);
+
+        {
+            ofxCache::CancellationToken::Scope scope(token);
+            ofxTest(ofxCache::CancellationToken::current() == &token, testName);
+            ofxTest(!ofxCache::CancellationToken::isCurrentCancelled(), testName);
+        }
+
+        ofxTest(ofxCache::CancellationToken::current() == nullptr, testName);
+
+        {
+            ofxCache::CancellationToken::Callback callback(token, [&]() { ++calls; });
+            ofxCache::CancellationToken copy = token;
+            copy.cancel();
+            copy.cancel();
+        }
+
+        ofxTestEq(calls, 1, testName);
+        ofxTest(token.isCancelled(), testName);
+
+        // Callbacks registered after cancellation are called immediately.
+        ofxCache::CancellationToken::Callback late(token, [&]() { ++calls; });
+        ofxTestEq(calls, 2, testName);
+    }
+
+    void testFileCancel()
+    {
+        std::string testName = "testFileCancel";
+        std::string path = "cancel.bin";
+
+        ofBuffer data(std::string(FileStore::READ_CHUNK_SIZE * 4, 'x'));
+        ofBufferToFile(path, data);
+
+        FileStore store;
+        ofxTestEq(store.get(path)->size(), data.size(), testName);
+
+        ofxCache::CancellationToken token;
+        token.cancel();
+
+        bool isAborted = false;
+
+        try
+        {
+            ofxCache::CancellationToken::Scope scope(token);
+            store.get(path);
+        }
+        catch (const Poco::IOException&)
+        {
+            isAborted = true;
+        }
+
+        ofxTest(isAborted, testName);
+
+        ofFile::removeFile(path);
+    }
+
+    void testHTTPCancelLatency()
+    {
+        std::string testName = "testHTTPCancelLatency";
+
+        SlowHTTPServer server;
+        HTTPStore store;
+        HTTPCache cache(store);
+
+        cache.request(server.uri());
+
+        // Let the transfer get going; the whole body would take ~50 seconds.
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        // Cancelling the request cancels its task, which aborts the I/O.
+        uint64_t cancelledAt = ofGetElapsedTimeMillis();
+        cache.cancelRequest(server.uri());
+        uint64_t finishedAt = cache.waitForLoad(5000);
+
+        uint64_t latency = finishedAt - cancelledAt;
+        ofLogNotice(testName) << "Cancel latency: " << latency << " ms";
+
+        ofxTest(finishedAt != 0, testName);
+        ofxTest(cache.isAborted(), testName);
+        ofxTest(latency < 250, testName);
+
+        // The server notices the aborted connection on its next writes.
+        std::this_thread::sleep_for(std::chrono::milliseconds(SlowHTTPServer::CHUNK_INTERVAL_MILLISECONDS * 4));
+        ofxTest(server.wasDisconnected(), testName);
+    }
+
+    void testResumeDownload()
+    {
+        std::string testName = "testResumeDownload";
+        std::string path = "partial";
+
+        SlowHTTPServer server;
+        HTTPStore store;
+        store.setPartialDownloadPath(path);
+
+        {
+            HTTPCache cache(store);
+            cache.request(server.uri());
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            cache.cancelRequest(server.uri());
+            ofxTest(cache.waitForLoad(5000) != 0, testName);
+            ofxTest(cache.isAborted(), testName);
+        }
+
+        std::size_t firstBytes = server.lastBodyBytes();
+        ofxTest(firstBytes > 0 && firstBytes < SlowHTTPServer::BODY_SIZE, testName);
+
+        // The retry only transfers what the first request did not receive.
+        server.setChunkInterval(0);
+        auto value = store.get(server.uri());
+
+        ofxTest(value != nullptr, testName);
+        ofxTestEq(value->size(), SlowHTTPServer::BODY_SIZE, testName);
+        ofxTest(server.lastBodyBytes() < SlowHTTPServer::BODY_SIZE, testName);
+        ofxTest(server.lastBodyBytes() + firstBytes >= SlowHTTPServer::BODY_SIZE, testName);
+
+        bool isIntact = true;
+
+        for (std::size_t i = 0; value != nullptr && i < value->size(); ++i)
+        {
+            isIntact = isIntact && value->getData()[i] == SlowHTTPServer::bodyByte(i);
+        }
+
+        ofxTest(isIntact, testName);
+
+        // Completed downloads don't leave partial files behind.
+        ofDirectory directory(path);
+        ofxTestEq(directory.listDir(), 0, testName);
+        directory.remove(true);
+    }
+
+};
+
+
+#include "ofAppNoWindow.h"
+#include "ofAppRunner.h"
+
+
+int main()
+{
+	ofInit();
+	auto window = std::make_shared<ofAppNoWindow>();
+	auto app = std::make_shared<ofApp>();
+	ofRunApp(window, app);
+	return ofRunMainLoop();
+}